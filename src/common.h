@@ -19,6 +19,7 @@
 #endif
 
 #define RECV_BUFFER_SIZE 2048
+#define RECV_BATCH CONFIG_WIREGUARD_RX_BATCH_BUDGET /* Datagrams read per wakeup */
 #define STATS_TIMER 60 /* How often to print statistics (in seconds) */
 
 #if defined(CONFIG_USERSPACE)
@@ -37,9 +38,14 @@ struct data {
 
 	struct {
 		int sock;
-		char recv_buffer[RECV_BUFFER_SIZE];
+		char recv_buffer[RECV_BATCH][RECV_BUFFER_SIZE];
 		uint32_t counter;
 		atomic_t bytes_received;
+		struct {
+			atomic_t wakeups;
+			atomic_t packets;
+			atomic_t histogram[RECV_BATCH]; /* [n - 1]: wakeups that read n datagrams */
+		} batch;
 		struct k_work_delayable stats_print;
 	} udp;
 };
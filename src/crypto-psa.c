@@ -0,0 +1,154 @@
+/*
+ * Copyright (c) 2024 Chunghan Yi <chunghan.yi@gmail.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+// Crypto provider on the PSA Crypto API - ChaCha20-Poly1305 and X25519 go to whatever implements PSA on the
+// platform (mbedTLS in software, or a driver for a crypto accelerator). PSA has no BLAKE2s or XChaCha20, so
+// BLAKE2s and HChaCha20 stay on the built-in code.
+
+#include <zephyr/kernel.h>
+#include <string.h>
+#include <psa/crypto.h>
+
+#include "crypto.h"
+
+#define PSA_CHACHA20_NONCE_LEN		12
+#define PSA_CHACHA20_TAG_LEN		16
+
+static bool psa_provider_init(void) {
+	return (psa_crypto_init() == PSA_SUCCESS);
+}
+
+// The 64 bit WireGuard counter is the last 8 bytes of the 96 bit RFC 7539 nonce
+static void psa_provider_nonce(uint8_t *out, uint64_t nonce) {
+	memset(out, 0, 4);
+	U64TO8_LITTLE(out + 4, nonce);
+}
+
+// Keys are imported as volatile keys for the one operation and destroyed again
+static psa_status_t psa_provider_import_aead_key(const uint8_t *key, psa_key_id_t *id) {
+	psa_key_attributes_t attributes = PSA_KEY_ATTRIBUTES_INIT;
+	psa_status_t status;
+
+	psa_set_key_type(&attributes, PSA_KEY_TYPE_CHACHA20);
+	psa_set_key_bits(&attributes, CHACHA20_KEY_SIZE * 8);
+	psa_set_key_usage_flags(&attributes, PSA_KEY_USAGE_ENCRYPT | PSA_KEY_USAGE_DECRYPT);
+	psa_set_key_algorithm(&attributes, PSA_ALG_CHACHA20_POLY1305);
+	status = psa_import_key(&attributes, key, CHACHA20_KEY_SIZE, id);
+	psa_reset_key_attributes(&attributes);
+	return status;
+}
+
+static void psa_provider_aead_encrypt(uint8_t *dst, const uint8_t *src, size_t src_len, const uint8_t *ad, size_t ad_len, uint64_t nonce, const uint8_t *key) {
+	uint8_t iv[PSA_CHACHA20_NONCE_LEN];
+	psa_key_id_t id;
+	psa_status_t status;
+	size_t len = 0;
+
+	psa_provider_nonce(iv, nonce);
+	status = psa_provider_import_aead_key(key, &id);
+	if (status == PSA_SUCCESS) {
+		// PSA allows the output to be the same buffer as the input, which the in-place callers rely on
+		status = psa_aead_encrypt(id, PSA_ALG_CHACHA20_POLY1305, iv, sizeof(iv), ad, ad_len,
+			src, src_len, dst, src_len + PSA_CHACHA20_TAG_LEN, &len);
+		psa_destroy_key(id);
+	}
+	if (status != PSA_SUCCESS) {
+		// Never leave (possibly in-place) plaintext behind to be sent - the peer rejects the zeroed message
+		crypto_zero(dst, src_len + PSA_CHACHA20_TAG_LEN);
+	}
+}
+
+// PSA only releases plaintext that authenticated and clears dst otherwise, so this also serves decrypt_verify
+static bool psa_provider_aead_decrypt(uint8_t *dst, const uint8_t *src, size_t src_len, const uint8_t *ad, size_t ad_len, uint64_t nonce, const uint8_t *key) {
+	uint8_t iv[PSA_CHACHA20_NONCE_LEN];
+	psa_key_id_t id;
+	psa_status_t status;
+	size_t len = 0;
+
+	if (src_len < PSA_CHACHA20_TAG_LEN) {
+		return false;
+	}
+
+	psa_provider_nonce(iv, nonce);
+	status = psa_provider_import_aead_key(key, &id);
+	if (status == PSA_SUCCESS) {
+		status = psa_aead_decrypt(id, PSA_ALG_CHACHA20_POLY1305, iv, sizeof(iv), ad, ad_len,
+			src, src_len, dst, src_len - PSA_CHACHA20_TAG_LEN, &len);
+		psa_destroy_key(id);
+	}
+	return (status == PSA_SUCCESS);
+}
+
+// XChaCha20-Poly1305: HChaCha20 subkey from the first 16 bytes of the nonce, then ChaCha20-Poly1305 with the rest
+static void psa_provider_xaead_encrypt(uint8_t *dst, const uint8_t *src, size_t src_len, const uint8_t *ad, size_t ad_len, const uint8_t *nonce, const uint8_t *key) {
+	uint8_t subkey[CHACHA20_KEY_SIZE];
+
+	hchacha20(subkey, nonce, key);
+	psa_provider_aead_encrypt(dst, src, src_len, ad, ad_len, U8TO64_LITTLE(nonce + 16), subkey);
+	crypto_zero(subkey, sizeof(subkey));
+}
+
+static bool psa_provider_xaead_decrypt(uint8_t *dst, const uint8_t *src, size_t src_len, const uint8_t *ad, size_t ad_len, const uint8_t *nonce, const uint8_t *key) {
+	uint8_t subkey[CHACHA20_KEY_SIZE];
+	bool result;
+
+	hchacha20(subkey, nonce, key);
+	result = psa_provider_aead_decrypt(dst, src, src_len, ad, ad_len, U8TO64_LITTLE(nonce + 16), subkey);
+	crypto_zero(subkey, sizeof(subkey));
+	return result;
+}
+
+static int psa_provider_x25519(uint8_t *out, const uint8_t *scalar, const uint8_t *point) {
+	psa_key_attributes_t attributes = PSA_KEY_ATTRIBUTES_INIT;
+	psa_key_id_t id;
+	psa_status_t status;
+	size_t len = 0;
+
+	// PSA clamps Montgomery private keys on import
+	psa_set_key_type(&attributes, PSA_KEY_TYPE_ECC_KEY_PAIR(PSA_ECC_FAMILY_MONTGOMERY));
+	psa_set_key_bits(&attributes, 255);
+	psa_set_key_usage_flags(&attributes, PSA_KEY_USAGE_DERIVE);
+	psa_set_key_algorithm(&attributes, PSA_ALG_ECDH);
+	status = psa_import_key(&attributes, scalar, X25519_BYTES, &id);
+	psa_reset_key_attributes(&attributes);
+	if (status == PSA_SUCCESS) {
+		status = psa_raw_key_agreement(PSA_ALG_ECDH, id, point, X25519_BYTES, out, X25519_BYTES, &len);
+		psa_destroy_key(id);
+	}
+	if ((status != PSA_SUCCESS) || (len != X25519_BYTES)) {
+		crypto_zero(out, X25519_BYTES);
+		return -1;
+	}
+	return 0;
+}
+
+static bool psa_provider_random_bytes(void *bytes, size_t size) {
+	if (psa_generate_random(bytes, size) != PSA_SUCCESS) {
+		// Keys and indexes come from here - the caller gives up on what it was doing rather than use predictable bytes
+		crypto_zero(bytes, size);
+		return false;
+	}
+	return true;
+}
+
+static const struct wireguard_crypto_provider wireguard_crypto_psa = {
+	.name = "psa",
+	.init = psa_provider_init,
+	.aead_encrypt = psa_provider_aead_encrypt,
+	.aead_decrypt = psa_provider_aead_decrypt,
+	.aead_decrypt_verify = psa_provider_aead_decrypt,
+	.xaead_encrypt = psa_provider_xaead_encrypt,
+	.xaead_decrypt = psa_provider_xaead_decrypt,
+	.blake2s_init = blake2s_init,
+	.blake2s_update = blake2s_update,
+	.blake2s_flush = blake2s_flush,
+	.blake2s_final = blake2s_final,
+	.blake2s = blake2s,
+	.x25519 = psa_provider_x25519,
+	.random_bytes = psa_provider_random_bytes,
+};
+
+const struct wireguard_crypto_provider *const wireguard_crypto = &wireguard_crypto_psa;
@@ -35,22 +35,79 @@
  */
 
 #include "crypto.h"
+#include "wireguard-platform.h"
 
 #include <stdlib.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include <string.h>
 
+static bool builtin_init(void) {
+	return true;
+}
+
+static int builtin_x25519(uint8_t *out, const uint8_t *scalar, const uint8_t *point) {
+	return x25519(out, scalar, point, 1);
+}
+
+// The platform's generator cannot fail
+static bool builtin_random_bytes(void *bytes, size_t size) {
+	wireguard_random_bytes(bytes, size);
+	return true;
+}
+
+const struct wireguard_crypto_provider wireguard_crypto_builtin = {
+	.name = "builtin",
+	.init = builtin_init,
+	.aead_encrypt = chacha20poly1305_encrypt,
+	.aead_decrypt = chacha20poly1305_decrypt,
+	.aead_decrypt_verify = chacha20poly1305_decrypt_verify,
+	.xaead_encrypt = xchacha20poly1305_encrypt,
+	.xaead_decrypt = xchacha20poly1305_decrypt,
+	.blake2s_init = blake2s_init,
+	.blake2s_update = blake2s_update,
+	.blake2s_flush = blake2s_flush,
+	.blake2s_final = blake2s_final,
+	.blake2s = blake2s,
+	.x25519 = builtin_x25519,
+	.random_bytes = builtin_random_bytes,
+};
+
+#if !defined(CONFIG_WIREGUARD_CRYPTO_PROVIDER_PSA)
+const struct wireguard_crypto_provider *const wireguard_crypto = &wireguard_crypto_builtin;
+#endif
+
+#if defined(__GNUC__)
+// memset, then an empty asm that claims to read dest - the compiler cannot prove the stores dead, so they are kept
+// (the same thing explicit_bzero does in most libcs, without depending on the libc having it)
+void crypto_zero(void *dest, size_t len) {
+	memset(dest, 0, len);
+	__asm__ __volatile__("" : : "r"(dest) : "memory");
+}
+#else
 void crypto_zero(void *dest, size_t len) {
 	volatile uint8_t *p = (uint8_t *)dest;
 	while (len--) {
 		*p++ = 0;
 	}
 }
+#endif
 
+// Constant time - the whole buffer is always read, a word at a time, and differences are only ORed together
 bool crypto_equal(const uint8_t *a, const uint8_t *b, size_t size) {
-	uint8_t neq = 0;
+	uintptr_t neq = 0;
+	uintptr_t wa, wb;
+
+	while (size >= sizeof(uintptr_t)) {
+		memcpy(&wa, a, sizeof(wa));
+		memcpy(&wb, b, sizeof(wb));
+		neq |= wa ^ wb;
+		a += sizeof(uintptr_t);
+		b += sizeof(uintptr_t);
+		size -= sizeof(uintptr_t);
+	}
 	while (size > 0) {
-		neq |= *(uint8_t *)a ^ *(uint8_t *)b;
+		neq |= *a ^ *b;
 		a += 1;
 		b += 1;
 		size -= 1;
@@ -8,24 +8,57 @@
 // BLAKE2S IMPLEMENTATION
 #include "crypto/blake2s.h"
 #define wireguard_blake2s_ctx blake2s_ctx
-#define wireguard_blake2s_init(ctx,outlen,key,keylen) blake2s_init(ctx,outlen,key,keylen)
-#define wireguard_blake2s_update(ctx,in,inlen) blake2s_update(ctx,in,inlen)
-#define wireguard_blake2s_final(ctx,out) blake2s_final(ctx,out)
-#define wireguard_blake2s(out,outlen,key,keylen,in,inlen) blake2s(out,outlen,key,keylen,in,inlen)
+#define wireguard_blake2s_init(ctx,outlen,key,keylen) wireguard_crypto->blake2s_init(ctx,outlen,key,keylen)
+#define wireguard_blake2s_update(ctx,in,inlen) wireguard_crypto->blake2s_update(ctx,in,inlen)
+#define wireguard_blake2s_final(ctx,out) wireguard_crypto->blake2s_final(ctx,out)
+#define wireguard_blake2s_flush(ctx) wireguard_crypto->blake2s_flush(ctx)
+#define wireguard_blake2s(out,outlen,key,keylen,in,inlen) wireguard_crypto->blake2s(out,outlen,key,keylen,in,inlen)
 
 // X25519 IMPLEMENTATION
 #include "crypto/x25519.h"
-#define wireguard_x25519(a,b,c)	x25519(a,b,c,1)
+#define wireguard_x25519(a,b,c) wireguard_crypto->x25519(a,b,c)
 
 //#include "crypto/cortex/scalarmult.h"
 //#define wireguard_x25519(a,b,c)	crypto_scalarmult_curve25519(a,b,c)
 
 // CHACHA20POLY1305 IMPLEMENTATION
 #include "crypto/chacha20poly1305.h"
-#define wireguard_aead_encrypt(dst,src,srclen,ad,adlen,nonce,key) chacha20poly1305_encrypt(dst,src,srclen,ad,adlen,nonce,key)
-#define wireguard_aead_decrypt(dst,src,srclen,ad,adlen,nonce,key) chacha20poly1305_decrypt(dst,src,srclen,ad,adlen,nonce,key)
-#define wireguard_xaead_encrypt(dst,src,srclen,ad,adlen,nonce,key) xchacha20poly1305_encrypt(dst,src,srclen,ad,adlen,nonce,key)
-#define wireguard_xaead_decrypt(dst,src,srclen,ad,adlen,nonce,key) xchacha20poly1305_decrypt(dst,src,srclen,ad,adlen,nonce,key)
+#define wireguard_aead_encrypt(dst,src,srclen,ad,adlen,nonce,key) wireguard_crypto->aead_encrypt(dst,src,srclen,ad,adlen,nonce,key)
+#define wireguard_aead_decrypt(dst,src,srclen,ad,adlen,nonce,key) wireguard_crypto->aead_decrypt(dst,src,srclen,ad,adlen,nonce,key)
+#define wireguard_aead_decrypt_verify(dst,src,srclen,ad,adlen,nonce,key) wireguard_crypto->aead_decrypt_verify(dst,src,srclen,ad,adlen,nonce,key)
+#define wireguard_xaead_encrypt(dst,src,srclen,ad,adlen,nonce,key) wireguard_crypto->xaead_encrypt(dst,src,srclen,ad,adlen,nonce,key)
+#define wireguard_xaead_decrypt(dst,src,srclen,ad,adlen,nonce,key) wireguard_crypto->xaead_decrypt(dst,src,srclen,ad,adlen,nonce,key)
+
+// RANDOM
+#define wireguard_crypto_random(bytes,size) wireguard_crypto->random_bytes(bytes,size)
+
+// CRYPTO PROVIDER
+// The macros above go through this table, so a platform can put its own (e.g. hardware accelerated) primitives
+// behind them without touching wireguard.c. BLAKE2s contexts are always blake2s_ctx.
+struct wireguard_crypto_provider {
+	const char *name;
+	bool (*init)(void);
+	void (*aead_encrypt)(uint8_t *dst, const uint8_t *src, size_t src_len, const uint8_t *ad, size_t ad_len, uint64_t nonce, const uint8_t *key);
+	bool (*aead_decrypt)(uint8_t *dst, const uint8_t *src, size_t src_len, const uint8_t *ad, size_t ad_len, uint64_t nonce, const uint8_t *key);
+	bool (*aead_decrypt_verify)(uint8_t *dst, const uint8_t *src, size_t src_len, const uint8_t *ad, size_t ad_len, uint64_t nonce, const uint8_t *key);
+	void (*xaead_encrypt)(uint8_t *dst, const uint8_t *src, size_t src_len, const uint8_t *ad, size_t ad_len, const uint8_t *nonce, const uint8_t *key);
+	bool (*xaead_decrypt)(uint8_t *dst, const uint8_t *src, size_t src_len, const uint8_t *ad, size_t ad_len, const uint8_t *nonce, const uint8_t *key);
+	int (*blake2s_init)(blake2s_ctx *ctx, size_t outlen, const void *key, size_t keylen);
+	void (*blake2s_update)(blake2s_ctx *ctx, const void *in, size_t inlen);
+	void (*blake2s_flush)(blake2s_ctx *ctx);
+	void (*blake2s_final)(blake2s_ctx *ctx, void *out);
+	int (*blake2s)(void *out, size_t outlen, const void *key, size_t keylen, const void *in, size_t inlen);
+	// Returns 0 on success, non-zero for an all-zero result
+	int (*x25519)(uint8_t *out, const uint8_t *scalar, const uint8_t *point);
+	// Returns false if no random data could be produced - nothing may be derived from bytes then
+	bool (*random_bytes)(void *bytes, size_t size);
+};
+
+// The portable C code in src/crypto/
+extern const struct wireguard_crypto_provider wireguard_crypto_builtin;
+// The provider picked by CONFIG_WIREGUARD_CRYPTO_PROVIDER_*
+extern const struct wireguard_crypto_provider *const wireguard_crypto;
+#define wireguard_crypto_init() wireguard_crypto->init()
 
 
 // Endian / unaligned helper macros
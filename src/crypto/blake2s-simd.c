@@ -0,0 +1,114 @@
+// BLAKE2s compression using vector instructions
+// Rotations by 16 and 8 are byte shuffles (SSSE3), by 12 and 7 shift and or.
+
+#include "blake2s-simd.h"
+
+#if defined(BLAKE2S_SIMD)
+
+#include <string.h>
+#include <immintrin.h>
+
+static const uint32_t blake2s_simd_iv[8] = {
+	0x6A09E667, 0xBB67AE85, 0x3C6EF372, 0xA54FF53A,
+	0x510E527F, 0x9B05688C, 0x1F83D9AB, 0x5BE0CD19
+};
+
+// The BLAKE2s message schedule in load order: per round the first words of the four column G steps, then their
+// second words, then the same for the four diagonal steps
+static const uint8_t blake2s_simd_sigma[10][16] = {
+	{  0,  2,  4,  6,  1,  3,  5,  7,  8, 10, 12, 14,  9, 11, 13, 15 },
+	{ 14,  4,  9, 13, 10,  8, 15,  6,  1,  0, 11,  5, 12,  2,  7,  3 },
+	{ 11, 12,  5, 15,  8,  0,  2, 13, 10,  3,  7,  9, 14,  6,  1,  4 },
+	{  7,  3, 13, 11,  9,  1, 12, 14,  2,  5,  4, 15,  6, 10,  0,  8 },
+	{  9,  5,  2, 10,  0,  7,  4, 15, 14, 11,  6,  3,  1, 12,  8, 13 },
+	{  2,  6,  0,  8, 12, 10, 11,  3,  4,  7, 15,  1, 13,  5, 14,  9 },
+	{ 12,  1, 14,  4,  5, 15, 13, 10,  0,  6,  9,  8,  7,  3,  2, 11 },
+	{ 13,  7, 12,  3, 11, 14,  1,  9,  5, 15,  8,  2,  0,  4,  6, 10 },
+	{  6, 14, 11,  0, 15,  9,  3,  8, 12, 13,  1, 10,  2,  7,  4,  5 },
+	{ 10,  8,  7,  1,  2,  4,  6,  5, 15,  9,  3, 13, 11, 14, 12,  0 },
+};
+
+#define LOAD_MSG(r, i) _mm_setr_epi32((int)m[blake2s_simd_sigma[r][(i) + 0]], (int)m[blake2s_simd_sigma[r][(i) + 1]], \
+	(int)m[blake2s_simd_sigma[r][(i) + 2]], (int)m[blake2s_simd_sigma[r][(i) + 3]])
+
+#define ROTR_12(x) _mm_or_si128(_mm_srli_epi32(x, 12), _mm_slli_epi32(x, 20))
+#define ROTR_7(x) _mm_or_si128(_mm_srli_epi32(x, 7), _mm_slli_epi32(x, 25))
+
+// First and second half of G on all four columns (or diagonals) at once
+#define G1(buf)                                                         \
+	row1 = _mm_add_epi32(_mm_add_epi32(row1, buf), row2);           \
+	row4 = _mm_shuffle_epi8(_mm_xor_si128(row4, row1), rot16);      \
+	row3 = _mm_add_epi32(row3, row4);                               \
+	row2 = ROTR_12(_mm_xor_si128(row2, row3))
+
+#define G2(buf)                                                         \
+	row1 = _mm_add_epi32(_mm_add_epi32(row1, buf), row2);           \
+	row4 = _mm_shuffle_epi8(_mm_xor_si128(row4, row1), rot8);       \
+	row3 = _mm_add_epi32(row3, row4);                               \
+	row2 = ROTR_7(_mm_xor_si128(row2, row3))
+
+// Line the diagonals up as columns and back
+#define DIAGONALIZE()                                                   \
+	row2 = _mm_shuffle_epi32(row2, _MM_SHUFFLE(0, 3, 2, 1));        \
+	row3 = _mm_shuffle_epi32(row3, _MM_SHUFFLE(1, 0, 3, 2));        \
+	row4 = _mm_shuffle_epi32(row4, _MM_SHUFFLE(2, 1, 0, 3))
+
+#define UNDIAGONALIZE()                                                 \
+	row2 = _mm_shuffle_epi32(row2, _MM_SHUFFLE(2, 1, 0, 3));        \
+	row3 = _mm_shuffle_epi32(row3, _MM_SHUFFLE(1, 0, 3, 2));        \
+	row4 = _mm_shuffle_epi32(row4, _MM_SHUFFLE(0, 3, 2, 1))
+
+#define ROUND(r)                                                        \
+	G1(LOAD_MSG(r, 0));                                             \
+	G2(LOAD_MSG(r, 4));                                             \
+	DIAGONALIZE();                                                  \
+	G1(LOAD_MSG(r, 8));                                             \
+	G2(LOAD_MSG(r, 12));                                            \
+	UNDIAGONALIZE()
+
+__attribute__((target("ssse3")))
+static void blake2s_compress_ssse3(uint32_t h[8], const uint8_t block[64], const uint32_t t[2], int last) {
+	const __m128i rot16 = _mm_setr_epi8(2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12, 13);
+	const __m128i rot8 = _mm_setr_epi8(1, 2, 3, 0, 5, 6, 7, 4, 9, 10, 11, 8, 13, 14, 15, 12);
+	__m128i row1, row2, row3, row4;
+	__m128i h1, h2;
+	uint32_t m[16];
+
+	// x86 is little endian, so the block is already the message words
+	memcpy(m, block, sizeof(m));
+
+	row1 = h1 = _mm_loadu_si128((const __m128i *)&h[0]);
+	row2 = h2 = _mm_loadu_si128((const __m128i *)&h[4]);
+	row3 = _mm_loadu_si128((const __m128i *)&blake2s_simd_iv[0]);
+	row4 = _mm_xor_si128(_mm_loadu_si128((const __m128i *)&blake2s_simd_iv[4]),
+		_mm_setr_epi32((int)t[0], (int)t[1], last ? -1 : 0, 0));
+
+	ROUND(0);
+	ROUND(1);
+	ROUND(2);
+	ROUND(3);
+	ROUND(4);
+	ROUND(5);
+	ROUND(6);
+	ROUND(7);
+	ROUND(8);
+	ROUND(9);
+
+	_mm_storeu_si128((__m128i *)&h[0], _mm_xor_si128(h1, _mm_xor_si128(row1, row3)));
+	_mm_storeu_si128((__m128i *)&h[4], _mm_xor_si128(h2, _mm_xor_si128(row2, row4)));
+}
+
+int blake2s_compress_simd(uint32_t h[8], const uint8_t block[64], const uint32_t t[2], int last) {
+	static int ssse3 = -1;
+
+	if (ssse3 < 0) {
+		__builtin_cpu_init();
+		ssse3 = __builtin_cpu_supports("ssse3") ? 1 : 0;
+	}
+	if (ssse3) {
+		blake2s_compress_ssse3(h, block, t, last);
+	}
+	return ssse3;
+}
+
+#endif /* BLAKE2S_SIMD */
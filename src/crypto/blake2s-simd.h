@@ -0,0 +1,17 @@
+// BLAKE2s compression using vector instructions
+// The four rows of the working state are one SSE register each, so a round is two column and two diagonal G steps
+#ifndef _BLAKE2S_SIMD_H_
+#define _BLAKE2S_SIMD_H_
+
+#include <stdint.h>
+
+#if defined(CONFIG_WIREGUARD_BLAKE2S_SIMD) && (defined(__x86_64__) || defined(__i386__))
+// SSSE3, used when the CPU supports it
+#define BLAKE2S_SIMD
+
+// Compress one 64 byte block into h, t is the byte counter and last the final block flag
+// Returns 0 without touching h when the CPU has no SSSE3
+int blake2s_compress_simd(uint32_t h[8], const uint8_t block[64], const uint32_t t[2], int last);
+#endif
+
+#endif /* _BLAKE2S_SIMD_H_ */
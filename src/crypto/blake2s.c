@@ -1,7 +1,9 @@
 // Taken from RFC7693 - https://tools.ietf.org/html/rfc7693
 
 #include "blake2s.h"
+#include "blake2s-simd.h"
 #include "../crypto.h"
+#include <string.h>
 
 // Cyclic right rotation.
 
@@ -27,24 +29,42 @@ static const uint32_t blake2s_iv[8] =
 	0x510E527F, 0x9B05688C, 0x1F83D9AB, 0x5BE0CD19
 };
 
+// Message schedule - static so it is not rebuilt on the stack for every block
+static const uint8_t blake2s_sigma[10][16] = {
+	{ 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15 },
+	{ 14, 10, 4, 8, 9, 15, 13, 6, 1, 12, 0, 2, 11, 7, 5, 3 },
+	{ 11, 8, 12, 0, 5, 2, 15, 13, 10, 14, 3, 6, 7, 1, 9, 4 },
+	{ 7, 9, 3, 1, 13, 12, 11, 14, 2, 6, 5, 10, 4, 0, 15, 8 },
+	{ 9, 0, 5, 7, 2, 4, 10, 15, 14, 1, 11, 12, 6, 8, 3, 13 },
+	{ 2, 12, 6, 10, 0, 11, 8, 3, 4, 13, 7, 5, 15, 14, 1, 9 },
+	{ 12, 5, 1, 15, 14, 13, 4, 10, 0, 7, 6, 3, 9, 2, 8, 11 },
+	{ 13, 11, 7, 14, 12, 1, 3, 9, 5, 0, 15, 4, 8, 6, 2, 10 },
+	{ 6, 15, 14, 9, 11, 3, 0, 8, 12, 2, 13, 7, 1, 4, 10, 5 },
+	{ 10, 2, 8, 4, 7, 6, 1, 5, 15, 11, 9, 14, 3, 12, 13, 0 }
+};
+
+// One round. r is a literal, so every m[] index is a compile time constant.
+#define B2S_ROUND(r) {                                                          \
+	B2S_G( 0, 4,  8, 12, m[blake2s_sigma[r][ 0]], m[blake2s_sigma[r][ 1]]); \
+	B2S_G( 1, 5,  9, 13, m[blake2s_sigma[r][ 2]], m[blake2s_sigma[r][ 3]]); \
+	B2S_G( 2, 6, 10, 14, m[blake2s_sigma[r][ 4]], m[blake2s_sigma[r][ 5]]); \
+	B2S_G( 3, 7, 11, 15, m[blake2s_sigma[r][ 6]], m[blake2s_sigma[r][ 7]]); \
+	B2S_G( 0, 5, 10, 15, m[blake2s_sigma[r][ 8]], m[blake2s_sigma[r][ 9]]); \
+	B2S_G( 1, 6, 11, 12, m[blake2s_sigma[r][10]], m[blake2s_sigma[r][11]]); \
+	B2S_G( 2, 7,  8, 13, m[blake2s_sigma[r][12]], m[blake2s_sigma[r][13]]); \
+	B2S_G( 3, 4,  9, 14, m[blake2s_sigma[r][14]], m[blake2s_sigma[r][15]]); }
+
 // Compression function. "last" flag indicates last block.
 static void blake2s_compress(blake2s_ctx *ctx, int last)
 {
-	const uint8_t sigma[10][16] = {
-		{ 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15 },
-		{ 14, 10, 4, 8, 9, 15, 13, 6, 1, 12, 0, 2, 11, 7, 5, 3 },
-		{ 11, 8, 12, 0, 5, 2, 15, 13, 10, 14, 3, 6, 7, 1, 9, 4 },
-		{ 7, 9, 3, 1, 13, 12, 11, 14, 2, 6, 5, 10, 4, 0, 15, 8 },
-		{ 9, 0, 5, 7, 2, 4, 10, 15, 14, 1, 11, 12, 6, 8, 3, 13 },
-		{ 2, 12, 6, 10, 0, 11, 8, 3, 4, 13, 7, 5, 15, 14, 1, 9 },
-		{ 12, 5, 1, 15, 14, 13, 4, 10, 0, 7, 6, 3, 9, 2, 8, 11 },
-		{ 13, 11, 7, 14, 12, 1, 3, 9, 5, 0, 15, 4, 8, 6, 2, 10 },
-		{ 6, 15, 14, 9, 11, 3, 0, 8, 12, 2, 13, 7, 1, 4, 10, 5 },
-		{ 10, 2, 8, 4, 7, 6, 1, 5, 15, 11, 9, 14, 3, 12, 13, 0 }
-	};
 	int i;
 	uint32_t v[16], m[16];
 
+#if defined(BLAKE2S_SIMD)
+	if (blake2s_compress_simd(ctx->h, ctx->b, ctx->t, last))
+		return;
+#endif
+
 	for (i = 0; i < 8; i++) {           // init work variables
 	   v[i] = ctx->h[i];
 	   v[i + 8] = blake2s_iv[i];
@@ -57,16 +77,16 @@ static void blake2s_compress(blake2s_ctx *ctx, int last)
 	for (i = 0; i < 16; i++)            // get little-endian words
 		m[i] = U8TO32_LITTLE(&ctx->b[4 * i]);
 
-	for (i = 0; i < 10; i++) {          // ten rounds
-		B2S_G( 0, 4,  8, 12, m[sigma[i][ 0]], m[sigma[i][ 1]]);
-		B2S_G( 1, 5,  9, 13, m[sigma[i][ 2]], m[sigma[i][ 3]]);
-		B2S_G( 2, 6, 10, 14, m[sigma[i][ 4]], m[sigma[i][ 5]]);
-		B2S_G( 3, 7, 11, 15, m[sigma[i][ 6]], m[sigma[i][ 7]]);
-		B2S_G( 0, 5, 10, 15, m[sigma[i][ 8]], m[sigma[i][ 9]]);
-		B2S_G( 1, 6, 11, 12, m[sigma[i][10]], m[sigma[i][11]]);
-		B2S_G( 2, 7,  8, 13, m[sigma[i][12]], m[sigma[i][13]]);
-		B2S_G( 3, 4,  9, 14, m[sigma[i][14]], m[sigma[i][15]]);
-	}
+	B2S_ROUND(0);                       // ten rounds
+	B2S_ROUND(1);
+	B2S_ROUND(2);
+	B2S_ROUND(3);
+	B2S_ROUND(4);
+	B2S_ROUND(5);
+	B2S_ROUND(6);
+	B2S_ROUND(7);
+	B2S_ROUND(8);
+	B2S_ROUND(9);
 
 	for( i = 0; i < 8; ++i )
 		ctx->h[i] ^= v[i] ^ v[i + 8];
@@ -106,9 +126,10 @@ int blake2s_init(blake2s_ctx *ctx, size_t outlen,
 void blake2s_update(blake2s_ctx *ctx,
 	const void *in, size_t inlen)       // data bytes
 {
-	size_t i;
+	const uint8_t *p = (const uint8_t *) in;
+	size_t n;
 
-	for (i = 0; i < inlen; i++) {
+	while (inlen > 0) {
 		if (ctx->c == 64) {             // buffer full ?
 			ctx->t[0] += ctx->c;        // add counters
 			if (ctx->t[0] < ctx->c)     // carry overflow ?
@@ -116,7 +137,27 @@ void blake2s_update(blake2s_ctx *ctx,
 			blake2s_compress(ctx, 0);   // compress (not last)
 			ctx->c = 0;                 // counter to zero
 		}
-		ctx->b[ctx->c++] = ((const uint8_t *) in)[i];
+		n = 64 - ctx->c;                // copy as much as fits
+		if (n > inlen)
+			n = inlen;
+		memcpy(&ctx->b[ctx->c], p, n);
+		ctx->c += n;
+		p += n;
+		inlen -= n;
+	}
+}
+
+// Compress a full input buffer now rather than on the next update, so the
+//      context can be copied and continued without redoing that block.
+//      More input must follow before blake2s_final().
+void blake2s_flush(blake2s_ctx *ctx)
+{
+	if (ctx->c == 64) {                 // buffer full ?
+		ctx->t[0] += ctx->c;            // add counters
+		if (ctx->t[0] < ctx->c)         // carry overflow ?
+			ctx->t[1]++;                // high word
+		blake2s_compress(ctx, 0);       // compress (not last)
+		ctx->c = 0;                     // counter to zero
 	}
 }
 
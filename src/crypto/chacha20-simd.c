@@ -0,0 +1,161 @@
+// Multi-block ChaCha20 using vector instructions
+// Each vector register holds the same state word of 4 or 8 consecutive blocks, so the quarter rounds are the
+// scalar ones applied lane-wise. The results are stored word-major and XORed into the data block by block.
+
+#include "chacha20-simd.h"
+
+#if defined(CHACHA20_SIMD)
+
+#include <string.h>
+#include <stdint.h>
+#include "../crypto.h"
+
+#include <immintrin.h>
+
+#define CHACHA20_SIMD_MAX_LANES 8
+
+// 2.1. The ChaCha Quarter Round, on vectors - V_ADD, V_XOR and V_ROTL are defined per backend
+#define V_QUARTERROUND(a, b, c, d)                          \
+	a = V_ADD(a, b);  d = V_XOR(d, a);  d = V_ROTL(d, 16);  \
+	c = V_ADD(c, d);  b = V_XOR(b, c);  b = V_ROTL(b, 12);  \
+	a = V_ADD(a, b);  d = V_XOR(d, a);  d = V_ROTL(d,  8);  \
+	c = V_ADD(c, d);  b = V_XOR(b, c);  b = V_ROTL(b,  7)
+
+#define V_DOUBLEROUND(x)                                    \
+	V_QUARTERROUND(x[0], x[4], x[ 8], x[12]);           \
+	V_QUARTERROUND(x[1], x[5], x[ 9], x[13]);           \
+	V_QUARTERROUND(x[2], x[6], x[10], x[14]);           \
+	V_QUARTERROUND(x[3], x[7], x[11], x[15]);           \
+	V_QUARTERROUND(x[0], x[5], x[10], x[15]);           \
+	V_QUARTERROUND(x[1], x[6], x[11], x[12]);           \
+	V_QUARTERROUND(x[2], x[7], x[ 8], x[13]);           \
+	V_QUARTERROUND(x[3], x[4], x[ 9], x[14])
+
+// stream holds word w of block b at stream[w * lanes + b]
+static void chacha20_simd_xor(uint8_t *out, const uint8_t *in, const uint32_t *stream, int lanes) {
+	uint32_t v;
+	int b;
+	int w;
+
+	// All the vector targets are little endian, so the words are already in serialised order
+	for (b = 0; b < lanes; ++b) {
+		for (w = 0; w < 16; ++w) {
+			memcpy(&v, in + (4 * w), sizeof(v));
+			v ^= stream[(w * lanes) + b];
+			memcpy(out + (4 * w), &v, sizeof(v));
+		}
+		in += CHACHA20_BLOCK_SIZE;
+		out += CHACHA20_BLOCK_SIZE;
+	}
+}
+
+#define V_ADD(a, b) _mm_add_epi32(a, b)
+#define V_XOR(a, b) _mm_xor_si128(a, b)
+#define V_ROTL(v, n) _mm_or_si128(_mm_slli_epi32(v, n), _mm_srli_epi32(v, 32 - (n)))
+
+__attribute__((target("sse2")))
+static void chacha20_sse2_4blocks(const uint32_t *state, uint32_t *stream) {
+	__m128i s[16];
+	__m128i x[16];
+	int i;
+
+	for (i = 0; i < 16; ++i) {
+		s[i] = _mm_set1_epi32((int)state[i]);
+	}
+	// Word 12 is the block counter, one per lane
+	s[12] = _mm_add_epi32(s[12], _mm_set_epi32(3, 2, 1, 0));
+	for (i = 0; i < 16; ++i) {
+		x[i] = s[i];
+	}
+
+	for (i = 0; i < 10; ++i) {
+		V_DOUBLEROUND(x);
+	}
+
+	for (i = 0; i < 16; ++i) {
+		_mm_storeu_si128((__m128i *)(stream + (4 * i)), _mm_add_epi32(x[i], s[i]));
+	}
+}
+
+#undef V_ADD
+#undef V_XOR
+#undef V_ROTL
+#define V_ADD(a, b) _mm256_add_epi32(a, b)
+#define V_XOR(a, b) _mm256_xor_si256(a, b)
+#define V_ROTL(v, n) _mm256_or_si256(_mm256_slli_epi32(v, n), _mm256_srli_epi32(v, 32 - (n)))
+
+__attribute__((target("avx2")))
+static void chacha20_avx2_8blocks(const uint32_t *state, uint32_t *stream) {
+	__m256i s[16];
+	__m256i x[16];
+	int i;
+
+	for (i = 0; i < 16; ++i) {
+		s[i] = _mm256_set1_epi32((int)state[i]);
+	}
+	s[12] = _mm256_add_epi32(s[12], _mm256_set_epi32(7, 6, 5, 4, 3, 2, 1, 0));
+	for (i = 0; i < 16; ++i) {
+		x[i] = s[i];
+	}
+
+	for (i = 0; i < 10; ++i) {
+		V_DOUBLEROUND(x);
+	}
+
+	for (i = 0; i < 16; ++i) {
+		_mm256_storeu_si256((__m256i *)(stream + (8 * i)), _mm256_add_epi32(x[i], s[i]));
+	}
+}
+
+// 0 scalar only, otherwise the number of lanes of the best supported backend
+static int chacha20_simd_lanes(void) {
+	static int lanes = -1;
+
+	if (lanes < 0) {
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("avx2")) {
+			lanes = 8;
+		} else if (__builtin_cpu_supports("sse2")) {
+			lanes = 4;
+		} else {
+			lanes = 0;
+		}
+	}
+	return lanes;
+}
+
+static void chacha20_simd_blocks(int lanes, const uint32_t *state, uint32_t *stream) {
+	if (lanes == 8) {
+		chacha20_avx2_8blocks(state, stream);
+	} else {
+		chacha20_sse2_4blocks(state, stream);
+	}
+}
+
+size_t chacha20_simd(struct chacha20_ctx *ctx, uint8_t *out, const uint8_t *in, size_t len) {
+	uint32_t stream[16 * CHACHA20_SIMD_MAX_LANES];
+	int max_lanes = chacha20_simd_lanes();
+	int lanes;
+	size_t done = 0;
+
+	if (max_lanes == 0) {
+		return 0;
+	}
+
+	while ((len - done) >= 4 * CHACHA20_BLOCK_SIZE) {
+		// SSE2 does 4 lanes, so a run too short for 8 still stays off the scalar path
+		lanes = ((len - done) >= (size_t)max_lanes * CHACHA20_BLOCK_SIZE) ? max_lanes : 4;
+		chacha20_simd_blocks(lanes, ctx->state, stream);
+		// Word 12 is a block counter
+		ctx->state[12] += lanes;
+		chacha20_simd_xor(out + done, in + done, stream, lanes);
+		done += (size_t)lanes * CHACHA20_BLOCK_SIZE;
+	}
+
+	if (done) {
+		crypto_zero(stream, sizeof(stream));
+	}
+	return done;
+}
+
+#endif /* CHACHA20_SIMD */
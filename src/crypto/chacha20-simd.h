@@ -0,0 +1,25 @@
+// Multi-block ChaCha20 using vector instructions
+// Computes 4 (SSE2) or 8 (AVX2) consecutive keystream blocks at once, the scalar chacha20() handles the rest
+#ifndef _CHACHA20_SIMD_H_
+#define _CHACHA20_SIMD_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include "chacha20.h"
+
+#if defined(CONFIG_WIREGUARD_CHACHA20_SIMD)
+#if defined(__x86_64__) || defined(__i386__)
+// SSE2 and AVX2, picked at runtime from what the CPU supports
+#define CHACHA20_SIMD_X86
+#endif
+#endif
+
+#if defined(CHACHA20_SIMD_X86)
+#define CHACHA20_SIMD
+
+// Encrypt as many whole multi-block chunks from the start of in as the backend handles and advance the block counter
+// Returns the number of bytes processed, which may be 0 (too short, or no usable vector unit)
+size_t chacha20_simd(struct chacha20_ctx *ctx, uint8_t *out, const uint8_t *in, size_t len);
+#endif
+
+#endif /* _CHACHA20_SIMD_H_ */
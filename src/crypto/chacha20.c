@@ -36,6 +36,7 @@
 // HChaCha20 is described here: https://tools.ietf.org/id/draft-arciszewski-xchacha-02.html
 
 #include "chacha20.h"
+#include "chacha20-simd.h"
 
 #include <string.h>
 #include <stdint.h>
@@ -99,47 +100,115 @@ static inline void INNER_BLOCK(uint32_t *block) {
 //	state += working_state
 //	return serialize(state)
 // end
-static void chacha20_block(struct chacha20_ctx *ctx, uint8_t *stream) {
-	uint32_t working_state[16];
+// The serialisation is left to the caller, which can combine it with the XOR
+// The working state is kept in locals rather than an array so the compiler can hold it in registers
+static void chacha20_block(struct chacha20_ctx *ctx, uint32_t *stream) {
+	uint32_t x0 = ctx->state[0], x1 = ctx->state[1], x2 = ctx->state[2], x3 = ctx->state[3];
+	uint32_t x4 = ctx->state[4], x5 = ctx->state[5], x6 = ctx->state[6], x7 = ctx->state[7];
+	uint32_t x8 = ctx->state[8], x9 = ctx->state[9], x10 = ctx->state[10], x11 = ctx->state[11];
+	uint32_t x12 = ctx->state[12], x13 = ctx->state[13], x14 = ctx->state[14], x15 = ctx->state[15];
 	int i;
 
-	for (i = 0; i < 16; ++i) {
-		working_state[i] = ctx->state[i];
+	for (i = 0; i < 10; ++i) {
+		QUARTERROUND(x0, x4, x8,  x12); // column 0
+		QUARTERROUND(x1, x5, x9,  x13); // column 1
+		QUARTERROUND(x2, x6, x10, x14); // column 2
+		QUARTERROUND(x3, x7, x11, x15); // column 3
+		QUARTERROUND(x0, x5, x10, x15); // diagonal 1
+		QUARTERROUND(x1, x6, x11, x12); // diagonal 2
+		QUARTERROUND(x2, x7, x8,  x13); // diagonal 3
+		QUARTERROUND(x3, x4, x9,  x14); // diagonal 4
 	}
 
-	TWENTY_ROUNDS(working_state);
+	stream[0] = PLUS(x0, ctx->state[0]);
+	stream[1] = PLUS(x1, ctx->state[1]);
+	stream[2] = PLUS(x2, ctx->state[2]);
+	stream[3] = PLUS(x3, ctx->state[3]);
+	stream[4] = PLUS(x4, ctx->state[4]);
+	stream[5] = PLUS(x5, ctx->state[5]);
+	stream[6] = PLUS(x6, ctx->state[6]);
+	stream[7] = PLUS(x7, ctx->state[7]);
+	stream[8] = PLUS(x8, ctx->state[8]);
+	stream[9] = PLUS(x9, ctx->state[9]);
+	stream[10] = PLUS(x10, ctx->state[10]);
+	stream[11] = PLUS(x11, ctx->state[11]);
+	stream[12] = PLUS(x12, ctx->state[12]);
+	stream[13] = PLUS(x13, ctx->state[13]);
+	stream[14] = PLUS(x14, ctx->state[14]);
+	stream[15] = PLUS(x15, ctx->state[15]);
+}
+
+#if defined(__GNUC__) && defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+// Keystream words are already in the serialised byte order, XOR them straight into the output
+typedef uint32_t __attribute__((__may_alias__)) chacha20_word_t;
+
+static inline void chacha20_xor_block(uint8_t *out, const uint8_t *in, const uint32_t *stream) {
+	uint32_t v;
+	int i;
+
+	if ((((uintptr_t)out | (uintptr_t)in) & (sizeof(uint32_t) - 1)) == 0) {
+		for (i = 0; i < 16; ++i) {
+			((chacha20_word_t *)out)[i] = ((const chacha20_word_t *)in)[i] ^ stream[i];
+		}
+	} else {
+		// memcpy of a word is a single load/store where the CPU allows unaligned access
+		for (i = 0; i < 16; ++i) {
+			memcpy(&v, in + (4 * i), sizeof(v));
+			v ^= stream[i];
+			memcpy(out + (4 * i), &v, sizeof(v));
+		}
+	}
+}
+#else
+static inline void chacha20_xor_block(uint8_t *out, const uint8_t *in, const uint32_t *stream) {
+	int i;
 
 	for (i = 0; i < 16; ++i) {
-		U32TO8_LITTLE(stream + (4 * i), PLUS(working_state[i], ctx->state[i]));
+		U32TO8_LITTLE(out + (4 * i), U8TO32_LITTLE(in + (4 * i)) ^ stream[i]);
 	}
 }
+#endif
 
 void chacha20(struct chacha20_ctx *ctx, uint8_t *out, const uint8_t *in, uint32_t len) {
+	uint32_t stream[16];
 	uint8_t output[CHACHA20_BLOCK_SIZE];
 	uint32_t i;
 
+#if defined(CHACHA20_SIMD)
+	// Runs of 4 or 8 blocks go to the vector unit when there is one
+	if (len >= 4 * CHACHA20_BLOCK_SIZE) {
+		i = chacha20_simd(ctx, out, in, len);
+		len -= i;
+		out += i;
+		in += i;
+	}
+#endif
+
+	// Full blocks are XORed a word at a time without going through a byte buffer
+	while (len >= CHACHA20_BLOCK_SIZE) {
+		chacha20_block(ctx, stream);
+		// Word 12 is a block counter
+		ctx->state[12] = PLUSONE(ctx->state[12]);
+		chacha20_xor_block(out, in, stream);
+		len -= CHACHA20_BLOCK_SIZE;
+		out += CHACHA20_BLOCK_SIZE;
+		in += CHACHA20_BLOCK_SIZE;
+	}
+
 	if (len) {
-		for (;;) {
-			chacha20_block(ctx, output);
-			// Word 12 is a block counter
-			ctx->state[12] = PLUSONE(ctx->state[12]);
-			if (len <= 64) {
-				for (i = 0;i < len;++i) {
-					out[i] = in[i] ^ output[i];
-			    }
-			    return;
-			}
-			for (i = 0;i < 64;++i) {
-				out[i] = in[i] ^ output[i];
-			}
-			len -= 64;
-			out += 64;
-			in += 64;
+		chacha20_block(ctx, stream);
+		ctx->state[12] = PLUSONE(ctx->state[12]);
+		for (i = 0; i < 16; ++i) {
+			U32TO8_LITTLE(output + (4 * i), stream[i]);
 		}
+		for (i = 0; i < len; ++i) {
+			out[i] = in[i] ^ output[i];
+		}
+		crypto_zero(output, sizeof(output));
 	}
+	crypto_zero(stream, sizeof(stream));
 }
 
-
 // 2.3.  The ChaCha20 Block Function
 // The first four words (0-3) are constants: 0x61707865, 0x3320646e, 0x79622d32, 0x6b206574
 // The next eight words (4-11) are taken from the 256-bit key by reading the bytes in little-endian order, in 4-byte chunks.
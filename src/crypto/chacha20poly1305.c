@@ -38,6 +38,7 @@
 
 #include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
 #include "../crypto.h"
 
 #define POLY1305_KEY_SIZE		32
@@ -45,6 +46,10 @@
 
 static const uint8_t zero[CHACHA20_BLOCK_SIZE] = { 0 };
 
+// Step of the single pass AEAD loops - small enough to stay in L1, large enough for the multi-block ChaCha20 and
+// Poly1305 backends to see several blocks at a time
+#define CHACHA20POLY1305_CHUNK_SIZE (8 * CHACHA20_BLOCK_SIZE)
+
 // 2.6.  Generating the Poly1305 Key Using ChaCha20
 static void generate_poly1305_key(struct poly1305_context *poly1305_state, struct chacha20_ctx *chacha20_state, const uint8_t *key, uint64_t nonce) {
 	uint8_t block[POLY1305_KEY_SIZE] = {0};
@@ -64,7 +69,8 @@ static void generate_poly1305_key(struct poly1305_context *poly1305_state, struc
 }
 
 // 2.8.  AEAD Construction (Encryption)
-void chacha20poly1305_encrypt(uint8_t *dst, const uint8_t *src, size_t src_len, const uint8_t *ad, size_t ad_len, uint64_t nonce, const uint8_t *key) {
+// Reference version: the whole message is encrypted and then authenticated in a second pass
+void chacha20poly1305_encrypt_ref(uint8_t *dst, const uint8_t *src, size_t src_len, const uint8_t *ad, size_t ad_len, uint64_t nonce, const uint8_t *key) {
 	struct poly1305_context poly1305_state;
 	struct chacha20_ctx chacha20_state;
 	uint8_t block[8];
@@ -105,7 +111,8 @@ void chacha20poly1305_encrypt(uint8_t *dst, const uint8_t *src, size_t src_len,
 }
 
 // 2.8.  AEAD Construction (Decryption)
-bool chacha20poly1305_decrypt(uint8_t *dst, const uint8_t *src, size_t src_len, const uint8_t *ad, size_t ad_len, uint64_t nonce, const uint8_t *key) {
+// Reference version: the whole message is authenticated and then decrypted in a second pass
+bool chacha20poly1305_decrypt_ref(uint8_t *dst, const uint8_t *src, size_t src_len, const uint8_t *ad, size_t ad_len, uint64_t nonce, const uint8_t *key) {
 	struct poly1305_context poly1305_state;
 	struct chacha20_ctx chacha20_state;
 	uint8_t block[8];
@@ -161,6 +168,152 @@ bool chacha20poly1305_decrypt(uint8_t *dst, const uint8_t *src, size_t src_len,
 	return result;
 }
 
+// The parts of the Poly1305 message that come before the text: the AAD and padding1
+static void poly1305_ad(struct poly1305_context *poly1305_state, const uint8_t *ad, size_t ad_len) {
+	size_t padded_len;
+
+	// - The AAD
+	poly1305_update(poly1305_state, ad, ad_len);
+	// - padding1 -- the padding is up to 15 zero bytes, and it brings the total length so far to an integral multiple of 16
+	padded_len = (ad_len + 15) & 0xFFFFFFF0; // Round up to next 16 bytes
+	poly1305_update(poly1305_state, zero, padded_len - ad_len);
+}
+
+// The parts of the Poly1305 message that come after the text: padding2 and the two lengths, then the tag
+static void poly1305_lengths_finish(struct poly1305_context *poly1305_state, size_t ad_len, size_t text_len, uint8_t *mac) {
+	uint8_t block[8];
+	size_t padded_len;
+
+	// - padding2 -- the padding is up to 15 zero bytes, and it brings the total length so far to an integral multiple of 16.
+	padded_len = (text_len + 15) & 0xFFFFFFF0; // Round up to next 16 bytes
+	poly1305_update(poly1305_state, zero, padded_len - text_len);
+	// - The length of the additional data in octets (as a 64-bit little-endian integer)
+	U64TO8_LITTLE(block, (uint64_t)ad_len);
+	poly1305_update(poly1305_state, block, sizeof(block));
+	// - The length of the ciphertext in octets (as a 64-bit little-endian integer).
+	U64TO8_LITTLE(block, (uint64_t)text_len);
+	poly1305_update(poly1305_state, block, sizeof(block));
+
+	poly1305_finish(poly1305_state, mac);
+}
+
+// 2.8.  AEAD Construction (Encryption), single pass
+// Each chunk is authenticated right after it has been encrypted, while it is still in the cache
+void chacha20poly1305_encrypt(uint8_t *dst, const uint8_t *src, size_t src_len, const uint8_t *ad, size_t ad_len, uint64_t nonce, const uint8_t *key) {
+	struct poly1305_context poly1305_state;
+	struct chacha20_ctx chacha20_state;
+	size_t offset;
+	size_t len;
+
+	generate_poly1305_key(&poly1305_state, &chacha20_state, key, nonce);
+	poly1305_ad(&poly1305_state, ad, ad_len);
+
+	for (offset = 0; offset < src_len; offset += len) {
+		len = src_len - offset;
+		if (len > CHACHA20POLY1305_CHUNK_SIZE) {
+			len = CHACHA20POLY1305_CHUNK_SIZE;
+		}
+		chacha20(&chacha20_state, dst + offset, src + offset, len);
+		poly1305_update(&poly1305_state, dst + offset, len);
+	}
+
+	poly1305_lengths_finish(&poly1305_state, ad_len, src_len, dst + src_len);
+
+	// Make sure we leave nothing sensitive on the stack
+	crypto_zero(&chacha20_state, sizeof(chacha20_state));
+}
+
+// The raw keystream for one nonce: block 0 (whose first 32 bytes are the Poly1305 key) followed by the text blocks
+void chacha20poly1305_keystream(uint8_t *out, size_t blocks, uint64_t nonce, const uint8_t *key) {
+	struct chacha20_ctx chacha20_state;
+
+	chacha20_init(&chacha20_state, key, nonce);
+	memset(out, 0, (blocks + 1) * CHACHA20_BLOCK_SIZE);
+	chacha20(&chacha20_state, out, out, (blocks + 1) * CHACHA20_BLOCK_SIZE);
+
+	crypto_zero(&chacha20_state, sizeof(chacha20_state));
+}
+
+// Same result as chacha20poly1305_encrypt() but with the keystream from chacha20poly1305_keystream() - only XOR and MAC are left
+void chacha20poly1305_encrypt_keystream(uint8_t *dst, const uint8_t *src, size_t src_len, const uint8_t *ad, size_t ad_len, const uint8_t *keystream) {
+	struct poly1305_context poly1305_state;
+	const uint8_t *stream = keystream + CHACHA20_BLOCK_SIZE;
+	size_t x;
+
+	poly1305_init(&poly1305_state, keystream);
+	poly1305_ad(&poly1305_state, ad, ad_len);
+
+	for (x = 0; x < src_len; x++) {
+		dst[x] = src[x] ^ stream[x];
+	}
+	poly1305_update(&poly1305_state, dst, src_len);
+
+	poly1305_lengths_finish(&poly1305_state, ad_len, src_len, dst + src_len);
+}
+
+// 2.8.  AEAD Construction (Decryption), single pass
+// Each chunk is authenticated and then decrypted - on a bad tag dst is wiped, so unauthenticated plaintext is never returned
+bool chacha20poly1305_decrypt(uint8_t *dst, const uint8_t *src, size_t src_len, const uint8_t *ad, size_t ad_len, uint64_t nonce, const uint8_t *key) {
+	struct poly1305_context poly1305_state;
+	struct chacha20_ctx chacha20_state;
+	uint8_t mac[POLY1305_MAC_SIZE];
+	size_t dst_len;
+	size_t offset;
+	size_t len;
+	bool result = false;
+
+	if (src_len >= POLY1305_MAC_SIZE) {
+		dst_len = src_len - POLY1305_MAC_SIZE;
+
+		generate_poly1305_key(&poly1305_state, &chacha20_state, key, nonce);
+		poly1305_ad(&poly1305_state, ad, ad_len);
+
+		for (offset = 0; offset < dst_len; offset += len) {
+			len = dst_len - offset;
+			if (len > CHACHA20POLY1305_CHUNK_SIZE) {
+				len = CHACHA20POLY1305_CHUNK_SIZE;
+			}
+			// MAC the ciphertext before it is (possibly in-place) overwritten
+			poly1305_update(&poly1305_state, src + offset, len);
+			chacha20(&chacha20_state, dst + offset, src + offset, len);
+		}
+
+		poly1305_lengths_finish(&poly1305_state, ad_len, dst_len, mac);
+
+		result = crypto_equal(mac, src + dst_len, POLY1305_MAC_SIZE);
+		if (!result) {
+			crypto_zero(dst, dst_len);
+		}
+		crypto_zero(&chacha20_state, sizeof(chacha20_state));
+	}
+	return result;
+}
+
+// Verify first, then decrypt - dst is not written at all unless the tag is good
+bool chacha20poly1305_decrypt_verify(uint8_t *dst, const uint8_t *src, size_t src_len, const uint8_t *ad, size_t ad_len, uint64_t nonce, const uint8_t *key) {
+	struct poly1305_context poly1305_state;
+	struct chacha20_ctx chacha20_state;
+	uint8_t mac[POLY1305_MAC_SIZE];
+	size_t dst_len;
+	bool result = false;
+
+	if (src_len >= POLY1305_MAC_SIZE) {
+		dst_len = src_len - POLY1305_MAC_SIZE;
+
+		generate_poly1305_key(&poly1305_state, &chacha20_state, key, nonce);
+		poly1305_ad(&poly1305_state, ad, ad_len);
+		poly1305_update(&poly1305_state, src, dst_len);
+		poly1305_lengths_finish(&poly1305_state, ad_len, dst_len, mac);
+
+		if (crypto_equal(mac, src + dst_len, POLY1305_MAC_SIZE)) {
+			chacha20(&chacha20_state, dst, src, dst_len);
+			result = true;
+		}
+		crypto_zero(&chacha20_state, sizeof(chacha20_state));
+	}
+	return result;
+}
+
 // AEAD_XChaCha20_Poly1305
 // XChaCha20-Poly1305 is a variant of the ChaCha20-Poly1305 AEAD construction as defined in [RFC7539] that uses a 192-bit nonce instead of a 96-bit nonce.
 // The algorithm for XChaCha20-Poly1305 is as follows:
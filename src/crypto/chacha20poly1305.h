@@ -36,11 +36,22 @@
 #include <stdbool.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include "chacha20.h"
+#include "poly1305-donna.h"
 
 // Aead(key, counter, plain text, auth text) ChaCha20Poly1305 AEAD, as specified in RFC7539 [17], with its nonce being composed of 32 bits of zeros followed by the 64-bit little-endian value of counter.
 // AEAD_CHACHA20_POLY1305 as described in https://tools.ietf.org/html/rfc7539
+// Both run over the message once, 64 bytes at a time - on a bad tag decrypt wipes dst and returns false
 void chacha20poly1305_encrypt(uint8_t *dst, const uint8_t *src, size_t src_len, const uint8_t *ad, size_t ad_len, uint64_t nonce, const uint8_t *key);
 bool chacha20poly1305_decrypt(uint8_t *dst, const uint8_t *src, size_t src_len, const uint8_t *ad, size_t ad_len, uint64_t nonce, const uint8_t *key);
+// Checks the tag over the whole message first and leaves dst untouched if it is bad
+bool chacha20poly1305_decrypt_verify(uint8_t *dst, const uint8_t *src, size_t src_len, const uint8_t *ad, size_t ad_len, uint64_t nonce, const uint8_t *key);
+// Precomputed keystream: (blocks + 1) * 64 bytes for the nonce, the first block keys Poly1305 and the rest covers up to blocks * 64 bytes of text
+void chacha20poly1305_keystream(uint8_t *out, size_t blocks, uint64_t nonce, const uint8_t *key);
+void chacha20poly1305_encrypt_keystream(uint8_t *dst, const uint8_t *src, size_t src_len, const uint8_t *ad, size_t ad_len, const uint8_t *keystream);
+// Straightforward two pass versions, kept as the reference the above must match
+void chacha20poly1305_encrypt_ref(uint8_t *dst, const uint8_t *src, size_t src_len, const uint8_t *ad, size_t ad_len, uint64_t nonce, const uint8_t *key);
+bool chacha20poly1305_decrypt_ref(uint8_t *dst, const uint8_t *src, size_t src_len, const uint8_t *ad, size_t ad_len, uint64_t nonce, const uint8_t *key);
 
 // Xaead(key, nonce, plain text, auth text) XChaCha20Poly1305 AEAD, with a 24-byte random nonce, instantiated using HChaCha20 [6] and ChaCha20Poly1305.
 // AEAD_XChaCha20_Poly1305 as described in https://tools.ietf.org/id/draft-arciszewski-xchacha-02.html
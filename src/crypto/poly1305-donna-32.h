@@ -131,6 +131,27 @@ poly1305_blocks(poly1305_state_internal_t *st, const unsigned char *m, size_t by
 	st->h[4] = h4;
 }
 
+#if defined(POLY1305_SIMD)
+/* h and r as five 26 bit limbs, the representation the vector code works in */
+static void
+poly1305_load26(const poly1305_state_internal_t *st, unsigned int h[5], unsigned int r[5]) {
+	size_t i;
+
+	for (i = 0; i < 5; i++) {
+		h[i] = (unsigned int)st->h[i];
+		r[i] = (unsigned int)st->r[i];
+	}
+}
+
+static void
+poly1305_store26(poly1305_state_internal_t *st, const unsigned int h[5]) {
+	size_t i;
+
+	for (i = 0; i < 5; i++)
+		st->h[i] = h[i];
+}
+#endif
+
 POLY1305_NOINLINE void
 poly1305_finish(poly1305_context *ctx, unsigned char mac[16]) {
 	poly1305_state_internal_t *st = (poly1305_state_internal_t *)ctx;
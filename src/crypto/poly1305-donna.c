@@ -1,7 +1,46 @@
 // Taken from https://github.com/floodyberry/poly1305-donna - public domain or MIT
 
 #include "poly1305-donna.h"
+#include "poly1305-simd.h"
+
+// CONFIG_WIREGUARD_POLY1305_DONNA_32/64 force a variant, otherwise 64 bit limbs are used when the compiler can multiply them
+#if defined(CONFIG_WIREGUARD_POLY1305_DONNA_32)
+#define POLY1305_32BIT
+#elif defined(CONFIG_WIREGUARD_POLY1305_DONNA_64)
+#if !defined(__SIZEOF_INT128__)
+#error "CONFIG_WIREGUARD_POLY1305_DONNA_64 needs a compiler with __int128"
+#endif
+#define POLY1305_64BIT
+#elif defined(__SIZEOF_INT128__)
+#define POLY1305_64BIT
+#else
+#define POLY1305_32BIT
+#endif
+
+#if defined(POLY1305_64BIT)
+#include "poly1305-donna-64.h"
+#else
 #include "poly1305-donna-32.h"
+#endif
+
+#if defined(POLY1305_SIMD)
+#include "../crypto.h"
+
+static size_t
+poly1305_blocks_simd(poly1305_state_internal_t *st, const unsigned char *m, size_t bytes) {
+	unsigned int h[5];
+	unsigned int r[5];
+	size_t done;
+
+	poly1305_load26(st, h, r);
+	done = poly1305_simd(h, r, m, bytes);
+	if (done)
+		poly1305_store26(st, h);
+	crypto_zero(h, sizeof(h));
+	crypto_zero(r, sizeof(r));
+	return done;
+}
+#endif
 
 void
 poly1305_update(poly1305_context *ctx, const unsigned char *m, size_t bytes) {
@@ -27,6 +66,14 @@ poly1305_update(poly1305_context *ctx, const unsigned char *m, size_t bytes) {
 	/* process full blocks */
 	if (bytes >= poly1305_block_size) {
 		size_t want = (bytes & ~(poly1305_block_size - 1));
+#if defined(POLY1305_SIMD)
+		if (want >= POLY1305_SIMD_MIN_BYTES) {
+			size_t done = poly1305_blocks_simd(st, m, want);
+			m += done;
+			bytes -= done;
+			want -= done;
+		}
+#endif
 		poly1305_blocks(st, m, want);
 		m += want;
 		bytes -= want;
@@ -0,0 +1,167 @@
+// Multi-block Poly1305 using vector instructions
+// Each 64 bit lane of an AVX2 register holds one 26 bit limb of one of the four chains, so the limb products of
+// the scalar donna-32 code map onto _mm256_mul_epu32. The message is only ever a full block here (hibit set).
+
+#include "poly1305-simd.h"
+
+#if defined(POLY1305_SIMD)
+
+#include <stdint.h>
+#include <immintrin.h>
+#include "../crypto.h"
+
+// a * b mod 2^130 - 5, partially reduced, all in 26 bit limbs
+static void poly1305_mul26(unsigned int out[5], const unsigned int a[5], const unsigned int b[5]) {
+	uint64_t s1 = (uint64_t)b[1] * 5;
+	uint64_t s2 = (uint64_t)b[2] * 5;
+	uint64_t s3 = (uint64_t)b[3] * 5;
+	uint64_t s4 = (uint64_t)b[4] * 5;
+	uint64_t d0, d1, d2, d3, d4, c;
+
+	d0 = (uint64_t)a[0] * b[0] + a[1] * s4 + a[2] * s3 + a[3] * s2 + a[4] * s1;
+	d1 = (uint64_t)a[0] * b[1] + (uint64_t)a[1] * b[0] + a[2] * s4 + a[3] * s3 + a[4] * s2;
+	d2 = (uint64_t)a[0] * b[2] + (uint64_t)a[1] * b[1] + (uint64_t)a[2] * b[0] + a[3] * s4 + a[4] * s3;
+	d3 = (uint64_t)a[0] * b[3] + (uint64_t)a[1] * b[2] + (uint64_t)a[2] * b[1] + (uint64_t)a[3] * b[0] + a[4] * s4;
+	d4 = (uint64_t)a[0] * b[4] + (uint64_t)a[1] * b[3] + (uint64_t)a[2] * b[2] + (uint64_t)a[3] * b[1] + (uint64_t)a[4] * b[0];
+
+	           c = d0 >> 26; out[0] = d0 & 0x3ffffff;
+	d1 += c;   c = d1 >> 26; out[1] = d1 & 0x3ffffff;
+	d2 += c;   c = d2 >> 26; out[2] = d2 & 0x3ffffff;
+	d3 += c;   c = d3 >> 26; out[3] = d3 & 0x3ffffff;
+	d4 += c;   c = d4 >> 26; out[4] = d4 & 0x3ffffff;
+	d0 = out[0] + (c * 5);
+	out[0] = d0 & 0x3ffffff;
+	out[1] += (unsigned int)(d0 >> 26);
+}
+
+__attribute__((target("avx2")))
+static void poly1305_avx2_4way(unsigned int h[5], const unsigned int rpow[4][5], const unsigned char *m, size_t chunks) {
+	const __m256i mask = _mm256_set1_epi64x(0x3ffffff);
+	const __m256i hibit = _mm256_set1_epi64x(1 << 24);
+	__m256i r[5], s[5];
+	__m256i x[5];
+	__m256i d[5];
+	__m256i lo, hi, c;
+	uint64_t lanes[4];
+	uint64_t t[5];
+	int i;
+
+// d = x * r, with s = 5 * r standing in for the limbs that wrap around 2^130
+#define MUL_4WAY()                                                                                    \
+	d[0] = _mm256_add_epi64(_mm256_add_epi64(_mm256_add_epi64(_mm256_add_epi64(                   \
+		_mm256_mul_epu32(x[0], r[0]), _mm256_mul_epu32(x[1], s[4])), _mm256_mul_epu32(x[2], s[3])), \
+		_mm256_mul_epu32(x[3], s[2])), _mm256_mul_epu32(x[4], s[1]));                             \
+	d[1] = _mm256_add_epi64(_mm256_add_epi64(_mm256_add_epi64(_mm256_add_epi64(                   \
+		_mm256_mul_epu32(x[0], r[1]), _mm256_mul_epu32(x[1], r[0])), _mm256_mul_epu32(x[2], s[4])), \
+		_mm256_mul_epu32(x[3], s[3])), _mm256_mul_epu32(x[4], s[2]));                             \
+	d[2] = _mm256_add_epi64(_mm256_add_epi64(_mm256_add_epi64(_mm256_add_epi64(                   \
+		_mm256_mul_epu32(x[0], r[2]), _mm256_mul_epu32(x[1], r[1])), _mm256_mul_epu32(x[2], r[0])), \
+		_mm256_mul_epu32(x[3], s[4])), _mm256_mul_epu32(x[4], s[3]));                             \
+	d[3] = _mm256_add_epi64(_mm256_add_epi64(_mm256_add_epi64(_mm256_add_epi64(                   \
+		_mm256_mul_epu32(x[0], r[3]), _mm256_mul_epu32(x[1], r[2])), _mm256_mul_epu32(x[2], r[1])), \
+		_mm256_mul_epu32(x[3], r[0])), _mm256_mul_epu32(x[4], s[4]));                             \
+	d[4] = _mm256_add_epi64(_mm256_add_epi64(_mm256_add_epi64(_mm256_add_epi64(                   \
+		_mm256_mul_epu32(x[0], r[4]), _mm256_mul_epu32(x[1], r[3])), _mm256_mul_epu32(x[2], r[2])), \
+		_mm256_mul_epu32(x[3], r[1])), _mm256_mul_epu32(x[4], r[0]))
+
+	// Every lane steps by r^4 while there is more message
+	for (i = 0; i < 5; i++) {
+		r[i] = _mm256_set1_epi64x(rpow[3][i]);
+		s[i] = _mm256_set1_epi64x((uint64_t)rpow[3][i] * 5);
+	}
+
+	// The running h goes into the first chain
+	for (i = 0; i < 5; i++) {
+		x[i] = _mm256_set_epi64x(0, 0, 0, h[i]);
+	}
+
+	while (chunks--) {
+		// Four blocks, one per lane: lo and hi are the two 64 bit halves of each block
+		lo = _mm256_loadu_si256((const __m256i *)m);
+		hi = _mm256_loadu_si256((const __m256i *)(m + 32));
+		c = _mm256_unpacklo_epi64(lo, hi);
+		hi = _mm256_unpackhi_epi64(lo, hi);
+		lo = _mm256_permute4x64_epi64(c, _MM_SHUFFLE(3, 1, 2, 0));
+		hi = _mm256_permute4x64_epi64(hi, _MM_SHUFFLE(3, 1, 2, 0));
+
+		d[0] = _mm256_and_si256(lo, mask);
+		d[1] = _mm256_and_si256(_mm256_srli_epi64(lo, 26), mask);
+		d[2] = _mm256_and_si256(_mm256_or_si256(_mm256_srli_epi64(lo, 52), _mm256_slli_epi64(hi, 12)), mask);
+		d[3] = _mm256_and_si256(_mm256_srli_epi64(hi, 14), mask);
+		d[4] = _mm256_or_si256(_mm256_srli_epi64(hi, 40), hibit);
+
+		for (i = 0; i < 5; i++) {
+			x[i] = _mm256_add_epi64(x[i], d[i]);
+		}
+		m += 64;
+
+		if (chunks) {
+			// x *= r^4, (partial) x %= p
+			MUL_4WAY();
+			c = _mm256_srli_epi64(d[0], 26); x[0] = _mm256_and_si256(d[0], mask);
+			d[1] = _mm256_add_epi64(d[1], c); c = _mm256_srli_epi64(d[1], 26); x[1] = _mm256_and_si256(d[1], mask);
+			d[2] = _mm256_add_epi64(d[2], c); c = _mm256_srli_epi64(d[2], 26); x[2] = _mm256_and_si256(d[2], mask);
+			d[3] = _mm256_add_epi64(d[3], c); c = _mm256_srli_epi64(d[3], 26); x[3] = _mm256_and_si256(d[3], mask);
+			d[4] = _mm256_add_epi64(d[4], c); c = _mm256_srli_epi64(d[4], 26); x[4] = _mm256_and_si256(d[4], mask);
+			x[0] = _mm256_add_epi64(x[0], _mm256_add_epi64(c, _mm256_slli_epi64(c, 2)));
+			c = _mm256_srli_epi64(x[0], 26); x[0] = _mm256_and_si256(x[0], mask);
+			x[1] = _mm256_add_epi64(x[1], c);
+		}
+	}
+
+	// Lane 0 still needs r^4, lane 1 r^3, lane 2 r^2 and lane 3 r
+	for (i = 0; i < 5; i++) {
+		r[i] = _mm256_set_epi64x(rpow[0][i], rpow[1][i], rpow[2][i], rpow[3][i]);
+		s[i] = _mm256_mul_epu32(r[i], _mm256_set1_epi64x(5));
+	}
+	MUL_4WAY();
+#undef MUL_4WAY
+
+	// Add the chains together and reduce
+	for (i = 0; i < 5; i++) {
+		_mm256_storeu_si256((__m256i *)lanes, d[i]);
+		t[i] = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+	}
+	t[1] += t[0] >> 26; h[0] = t[0] & 0x3ffffff;
+	t[2] += t[1] >> 26; h[1] = t[1] & 0x3ffffff;
+	t[3] += t[2] >> 26; h[2] = t[2] & 0x3ffffff;
+	t[4] += t[3] >> 26; h[3] = t[3] & 0x3ffffff;
+	t[0] = h[0] + ((t[4] >> 26) * 5); h[4] = t[4] & 0x3ffffff;
+	h[0] = t[0] & 0x3ffffff;
+	h[1] += (unsigned int)(t[0] >> 26);
+}
+
+static int poly1305_simd_avx2(void) {
+	static int avx2 = -1;
+
+	if (avx2 < 0) {
+		__builtin_cpu_init();
+		avx2 = __builtin_cpu_supports("avx2") ? 1 : 0;
+	}
+	return avx2;
+}
+
+size_t poly1305_simd(unsigned int h[5], const unsigned int r[5], const unsigned char *m, size_t bytes) {
+	unsigned int rpow[4][5];
+	size_t chunks = bytes / 64;
+	int i;
+
+	if (chunks == 0 || !poly1305_simd_avx2()) {
+		return 0;
+	}
+
+	// r, r^2, r^3, r^4
+	for (i = 0; i < 5; i++) {
+		rpow[0][i] = r[i];
+	}
+	poly1305_mul26(rpow[1], rpow[0], r);
+	poly1305_mul26(rpow[2], rpow[1], r);
+	poly1305_mul26(rpow[3], rpow[2], r);
+
+	poly1305_avx2_4way(h, (const unsigned int (*)[5])rpow, m, chunks);
+
+	crypto_zero(rpow, sizeof(rpow));
+	return chunks * 64;
+}
+
+#endif /* POLY1305_SIMD */
@@ -0,0 +1,20 @@
+// Multi-block Poly1305 using vector instructions
+// Four interleaved Horner chains (h = h * r^4 + m per lane) combined at the end with r^4, r^3, r^2 and r
+#ifndef _POLY1305_SIMD_H_
+#define _POLY1305_SIMD_H_
+
+#include <stddef.h>
+
+#if defined(CONFIG_WIREGUARD_POLY1305_SIMD) && (defined(__x86_64__) || defined(__i386__))
+// AVX2, used when the CPU supports it
+#define POLY1305_SIMD
+
+// Shorter runs are not worth computing r^2..r^4 for
+#define POLY1305_SIMD_MIN_BYTES (128)
+
+// Absorb as many whole 64 byte chunks of m as the backend handles into h, both h and r in 26 bit limbs
+// Returns the number of bytes processed, 0 when the CPU has no AVX2
+size_t poly1305_simd(unsigned int h[5], const unsigned int r[5], const unsigned char *m, size_t bytes);
+#endif
+
+#endif /* _POLY1305_SIMD_H_ */
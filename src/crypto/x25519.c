@@ -14,12 +14,20 @@
 //#include "strobe_config.h"
 // STROBE header replacement
 #include <string.h>
+// 64 bit limbs when the compiler can multiply them into 128 bits, 32 bit limbs otherwise
+#ifndef X25519_WBITS
+#if defined(__SIZEOF_INT128__)
+#define X25519_WBITS 64
+#else
 #define X25519_WBITS 32
+#endif
+#endif
 #define X25519_SUPPORT_SIGN 0
 #define X25519_MEMCPY_PARAMS 1
 #define X25519_USE_POWER_CHAIN 1
 #if BYTE_ORDER == LITTLE_ENDIAN
 static inline uint32_t eswap_letoh_32(uint32_t w) { return w; }
+static inline uint64_t eswap_letoh_64(uint64_t w) { return w; }
 #else
 #error "Fix eswap() on non-little-endian machine"
 #endif
@@ -254,7 +262,7 @@ static void x25519_core(fe xs[5], const uint8_t scalar[X25519_BYTES], const uint
 #if X25519_MEMCPY_PARAMS
     fe x1i;
     swapin(x1i,x1);
-    x1 = (const uint8_t *)x1;
+    x1 = (const uint8_t *)x1i;
 #endif
     limb_t swap = 0;
     limb_t *x2 = xs[0],*x3=xs[2],*z3=xs[3];
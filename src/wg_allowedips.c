@@ -0,0 +1,226 @@
+/*
+ * Copyright (c) 2024 Chunghan Yi <chunghan.yi@gmail.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <string.h>
+
+#include "wg_allowedips.h"
+
+#define NODE(_table, _i)	(&(_table)->nodes[(_i) - 1])
+
+static uint32_t prefix_mask(uint8_t cidr) {
+	return cidr ? (0xFFFFFFFFu << (32 - cidr)) : 0;
+}
+
+/* Bit pos counted from the most significant one - pos must be below 32 */
+static unsigned int bit_at(uint32_t ip, uint8_t pos) {
+	return (ip >> (31 - pos)) & 1;
+}
+
+static uint8_t common_bits(uint32_t a, uint32_t b) {
+	uint32_t diff = a ^ b;
+	return diff ? (uint8_t)__builtin_clz(diff) : 32;
+}
+
+static uint16_t node_alloc(struct wg_allowedips *table, uint32_t bits, uint8_t cidr, uint16_t peer) {
+	uint16_t i = table->free;
+	struct wg_allowedips_node *node = NODE(table, i);
+
+	table->free = node->child[0];
+	table->free_count--;
+	memset(node, 0, sizeof(*node));
+	node->bits = bits;
+	node->cidr = cidr;
+	node->peer = peer;
+	node->used = true;
+	return i;
+}
+
+static void node_free(struct wg_allowedips *table, uint16_t i) {
+	struct wg_allowedips_node *node = NODE(table, i);
+
+	node->used = false;
+	node->child[0] = table->free;
+	node->child[1] = 0;
+	table->free = i;
+	table->free_count++;
+}
+
+/* Hang node i below parent (or make it the root) - the node is complete before it becomes reachable */
+static void node_link(struct wg_allowedips *table, uint16_t parent, uint16_t i) {
+	struct wg_allowedips_node *node = NODE(table, i);
+	struct wg_allowedips_node *up;
+
+	node->parent = parent;
+	if (parent) {
+		up = NODE(table, parent);
+		up->child[bit_at(node->bits, up->cidr)] = i;
+	} else {
+		table->root = i;
+	}
+}
+
+/* Drop nodes that no longer carry a prefix and join fewer than two branches, from i upwards */
+static void node_compact(struct wg_allowedips *table, uint16_t i) {
+	struct wg_allowedips_node *node;
+	struct wg_allowedips_node *up;
+	uint16_t child;
+	uint16_t parent;
+
+	while (i) {
+		node = NODE(table, i);
+		if ((node->peer != WG_ALLOWEDIPS_NONE) || (node->child[0] && node->child[1])) {
+			break;
+		}
+		child = node->child[0] ? node->child[0] : node->child[1];
+		parent = node->parent;
+		if (child) {
+			NODE(table, child)->parent = parent;
+		}
+		if (parent) {
+			up = NODE(table, parent);
+			up->child[up->child[1] == i] = child;
+		} else {
+			table->root = child;
+		}
+		node_free(table, i);
+		if (child) {
+			break;
+		}
+		/* The parent lost a branch and may now be a join node with a single child */
+		i = parent;
+	}
+}
+
+void wg_allowedips_init(struct wg_allowedips *table) {
+	uint16_t i;
+
+	memset(table, 0, sizeof(*table));
+	for (i = 1; i <= WG_ALLOWEDIPS_NODES; i++) {
+		NODE(table, i)->child[0] = (i < WG_ALLOWEDIPS_NODES) ? (i + 1) : 0;
+	}
+	table->free = 1;
+	table->free_count = WG_ALLOWEDIPS_NODES;
+}
+
+bool wg_allowedips_insert(struct wg_allowedips *table, uint32_t ip, uint8_t cidr, uint16_t peer) {
+	struct wg_allowedips_node *node = NULL;
+	uint16_t parent = 0;
+	uint16_t cur = table->root;
+	uint16_t i;
+	uint16_t join;
+	uint8_t common;
+
+	if ((cidr > 32) || (peer == WG_ALLOWEDIPS_NONE)) {
+		return false;
+	}
+	ip &= prefix_mask(cidr);
+
+	/* Walk down while the nodes are shorter prefixes of the new one */
+	while (cur) {
+		node = NODE(table, cur);
+		if ((node->cidr > cidr) || (common_bits(node->bits, ip) < node->cidr)) {
+			break;
+		}
+		if (node->cidr == cidr) {
+			/* Same prefix - it changes owner, or a join node becomes a real entry */
+			node->peer = peer;
+			return true;
+		}
+		parent = cur;
+		cur = node->child[bit_at(ip, node->cidr)];
+	}
+
+	if (table->free_count < (cur ? 2 : 1)) {
+		return false;
+	}
+	i = node_alloc(table, ip, cidr, peer);
+	if (!cur) {
+		node_link(table, parent, i);
+		return true;
+	}
+
+	/* cur is off the new prefix's path: either the new prefix covers it, or they differ at an earlier bit and need a join node */
+	common = common_bits(node->bits, ip);
+	if (common > cidr) {
+		common = cidr;
+	}
+	if (common == cidr) {
+		NODE(table, i)->child[bit_at(node->bits, cidr)] = cur;
+		node->parent = i;
+		node_link(table, parent, i);
+	} else {
+		join = node_alloc(table, ip & prefix_mask(common), common, WG_ALLOWEDIPS_NONE);
+		NODE(table, join)->child[bit_at(ip, common)] = i;
+		NODE(table, join)->child[bit_at(node->bits, common)] = cur;
+		NODE(table, i)->parent = join;
+		node->parent = join;
+		node_link(table, parent, join);
+	}
+	return true;
+}
+
+bool wg_allowedips_remove(struct wg_allowedips *table, uint32_t ip, uint8_t cidr, uint16_t peer) {
+	struct wg_allowedips_node *node;
+	uint16_t cur = table->root;
+
+	if (cidr > 32) {
+		return false;
+	}
+	ip &= prefix_mask(cidr);
+
+	while (cur) {
+		node = NODE(table, cur);
+		if ((node->cidr > cidr) || ((ip & prefix_mask(node->cidr)) != node->bits)) {
+			break;
+		}
+		if (node->cidr == cidr) {
+			if (node->peer != peer) {
+				break;
+			}
+			node->peer = WG_ALLOWEDIPS_NONE;
+			node_compact(table, cur);
+			return true;
+		}
+		cur = node->child[bit_at(ip, node->cidr)];
+	}
+	return false;
+}
+
+void wg_allowedips_remove_peer(struct wg_allowedips *table, uint16_t peer) {
+	struct wg_allowedips_node *node;
+	uint16_t i;
+
+	/* Compacting only ever frees nodes without a peer, so a plain walk over the pool sees every entry of peer */
+	for (i = 1; i <= WG_ALLOWEDIPS_NODES; i++) {
+		node = NODE(table, i);
+		if (node->used && (node->peer == peer)) {
+			node->peer = WG_ALLOWEDIPS_NONE;
+			node_compact(table, i);
+		}
+	}
+}
+
+uint16_t wg_allowedips_lookup(const struct wg_allowedips *table, uint32_t ip) {
+	const struct wg_allowedips_node *node;
+	uint16_t cur = table->root;
+	uint16_t result = WG_ALLOWEDIPS_NONE;
+
+	while (cur) {
+		node = NODE(table, cur);
+		if ((ip & prefix_mask(node->cidr)) != node->bits) {
+			break;
+		}
+		if (node->peer != WG_ALLOWEDIPS_NONE) {
+			/* Longer prefixes further down override this one */
+			result = node->peer;
+		}
+		if (node->cidr == 32) {
+			break;
+		}
+		cur = node->child[bit_at(ip, node->cidr)];
+	}
+	return result;
+}
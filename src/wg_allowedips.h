@@ -0,0 +1,57 @@
+/*
+ * Copyright (c) 2024 Chunghan Yi <chunghan.yi@gmail.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef _WG_ALLOWEDIPS_H_
+#define _WG_ALLOWEDIPS_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * Allowed IPs of all peers of a device, kept in one path-compressed binary
+ * (Patricia) trie over IPv4 prefixes.
+ *
+ * A lookup returns the peer of the longest prefix that contains the address
+ * and visits at most one node per prefix length. Prefixes can be added and
+ * removed at any time. Nodes come from a fixed pool inside the table; every
+ * prefix needs one node and may need one more to join it to the rest of the
+ * trie. Addresses and prefixes are in host byte order.
+ */
+
+#define WG_ALLOWEDIPS_NONE	(0xFFFF)	/* no peer, same value as WIREGUARD_INVALID_PEER */
+#define WG_ALLOWEDIPS_NODES	(CONFIG_WIREGUARD_ALLOWED_IPS * 2)
+
+struct wg_allowedips_node {
+	uint32_t bits;		/* prefix, bits past cidr are zero */
+	uint16_t peer;		/* WG_ALLOWEDIPS_NONE for nodes that only join two branches */
+	uint16_t child[2];	/* node index + 1, 0 if there is no child */
+	uint16_t parent;	/* node index + 1, 0 for the root */
+	uint8_t cidr;
+	bool used;
+};
+
+struct wg_allowedips {
+	uint16_t root;		/* node index + 1, 0 while the trie is empty */
+	uint16_t free;		/* first unused node + 1, linked through child[0] */
+	uint16_t free_count;
+	struct wg_allowedips_node nodes[WG_ALLOWEDIPS_NODES];
+};
+
+void wg_allowedips_init(struct wg_allowedips *table);
+
+/* Add or replace a prefix - false if the pool is exhausted */
+bool wg_allowedips_insert(struct wg_allowedips *table, uint32_t ip, uint8_t cidr, uint16_t peer);
+
+/* Remove a prefix if it belongs to peer - false if there is no such entry */
+bool wg_allowedips_remove(struct wg_allowedips *table, uint32_t ip, uint8_t cidr, uint16_t peer);
+
+/* Remove every prefix of peer */
+void wg_allowedips_remove_peer(struct wg_allowedips *table, uint16_t peer);
+
+/* Peer of the longest matching prefix, WG_ALLOWEDIPS_NONE if no prefix matches */
+uint16_t wg_allowedips_lookup(const struct wg_allowedips *table, uint32_t ip);
+
+#endif /* _WG_ALLOWEDIPS_H_ */
@@ -18,6 +18,8 @@ LOG_MODULE_DECLARE(wg, LOG_LEVEL_DBG);
 
 #include "common.h"
 #include "wireguardif.h"
+#include "wireguard.h"
+#include "wg_trace.h"
 
 extern struct netif *wg_netif;
 
@@ -48,44 +50,84 @@ static int start_udp_proto(struct data *data, struct sockaddr *bind_addr,
 	return ret;
 }
 
+static void update_batch_stats(struct data *data, int count)
+{
+	atomic_inc(&data->udp.batch.wakeups);
+	atomic_add(&data->udp.batch.packets, count);
+	if (count > 0) {
+		atomic_inc(&data->udp.batch.histogram[count - 1]);
+	}
+}
+
 static int process_udp(struct data *data)
 {
 	int ret = 0;
 	int r;
-	struct pbuf u;
-	struct sockaddr_in unknownaddr;
-	socklen_t len = sizeof(struct sockaddr_in);
+	int i;
+	int count;
+	struct zsock_pollfd fds;
+	struct pbuf u[RECV_BATCH];
+	struct sockaddr_in from[RECV_BATCH];
+	socklen_t len;
 	ip_addr_t addr;
 	struct wireguard_device *device = (struct wireguard_device *)(wg_netif->state);
 
 	//NET_INFO("Waiting for UDP packets on port %d (%s)...", WG_PORT, data->proto);
 
-	size_t u_len = 2048; /* TBD */
-	u.payload = malloc(u_len);
+	fds.fd = data->udp.sock;
+	fds.events = ZSOCK_POLLIN;
 
 	do {
-		r = recvfrom(data->udp.sock, u.payload, u_len,
-				0, (struct sockaddr *)&unknownaddr, &len);
-		if (r < 0) {
-			NET_ERR("UDP (%s): Connection error %d", data->proto, errno);
+		if (zsock_poll(&fds, 1, -1) < 0) {
+			NET_ERR("UDP (%s): Poll error %d", data->proto, errno);
 			ret = -errno;
 			break;
-		} else if (r) {
-			atomic_add(&data->udp.bytes_received, r);
 		}
 
-		NET_DBG("<<  Received a UDP packet: size %d from %s:%d",
-				r, inet_ntoa(unknownaddr.sin_addr), ntohs(unknownaddr.sin_port));
-		u.len = u.tot_len = r;
-		addr.u_addr.ip4.addr = unknownaddr.sin_addr.s_addr;
-		wireguardif_network_rx(device, &u, &addr, ntohs(unknownaddr.sin_port));
-	} while (true);
+		/* Drain whatever is already queued on the socket, up to the budget */
+		for (count = 0; count < RECV_BATCH; count++) {
+			len = sizeof(struct sockaddr_in);
+			r = recvfrom(data->udp.sock, data->udp.recv_buffer[count], RECV_BUFFER_SIZE,
+					ZSOCK_MSG_DONTWAIT, (struct sockaddr *)&from[count], &len);
+			if (r < 0) {
+				if (errno != EAGAIN && errno != EWOULDBLOCK) {
+					NET_ERR("UDP (%s): Connection error %d", data->proto, errno);
+					ret = -errno;
+				}
+				break;
+			} else if (r) {
+				atomic_add(&data->udp.bytes_received, r);
+			}
+
+			WG_TRACE_DBG("<<  Received a UDP packet: size %d from %s:%d",
+					r, inet_ntoa(from[count].sin_addr), ntohs(from[count].sin_port));
+			WG_TRACE_PKT(WG_TRACE_UDP_RX, WIREGUARDIF_INVALID_INDEX,
+					from[count].sin_addr.s_addr, 0, r);
+			u[count].payload = data->udp.recv_buffer[count];
+			u[count].len = u[count].tot_len = r;
+		}
+
+		update_batch_stats(data, count);
+
+		/* Handshakes first, so a session they complete is in place for the data queued behind them */
+		for (i = 0; i < count; i++) {
+			if (u[i].len > 0 && ((uint8_t *)u[i].payload)[0] != MESSAGE_TRANSPORT_DATA) {
+				addr.u_addr.ip4.addr = from[i].sin_addr.s_addr;
+				wireguardif_network_rx(device, &u[i], &addr, ntohs(from[i].sin_port));
+			}
+		}
+
+		/* Then decrypt the data messages back to back */
+		for (i = 0; i < count; i++) {
+			if (u[i].len > 0 && ((uint8_t *)u[i].payload)[0] == MESSAGE_TRANSPORT_DATA) {
+				addr.u_addr.ip4.addr = from[i].sin_addr.s_addr;
+				wireguardif_network_rx(device, &u[i], &addr, ntohs(from[i].sin_port));
+			}
+		}
+	} while (ret == 0);
 
-	if (u.payload)
-		free(u.payload);
 	return ret;
 }
-
 static void process_udp4(void)
 {
 	int ret;
@@ -120,6 +162,13 @@ static void print_stats(struct k_work *work)
 	struct k_work_delayable *dwork = k_work_delayable_from_work(work);
 	struct data *data = CONTAINER_OF(dwork, struct data, udp.stats_print);
 	int total_received = atomic_get(&data->udp.bytes_received);
+	int wakeups = atomic_get(&data->udp.batch.wakeups);
+	int packets = atomic_get(&data->udp.batch.packets);
+
+	if (wakeups) {
+		LOG_INF("%s UDP: %d packets in %d wakeups (%d.%02d per wakeup)", data->proto,
+			packets, wakeups, packets / wakeups, (packets % wakeups) * 100 / wakeups);
+	}
 
 	if (total_received) {
 		if ((total_received / STATS_TIMER) < 1024) {
@@ -13,6 +13,7 @@ LOG_MODULE_REGISTER(wg, LOG_LEVEL_DBG);
 #include <zephyr/kernel.h>
 #include <zephyr/linker/sections.h>
 #include <errno.h>
+#include <string.h>
 #include <zephyr/shell/shell.h>
 
 #include <zephyr/net/net_core.h>
@@ -25,6 +26,7 @@ LOG_MODULE_REGISTER(wg, LOG_LEVEL_DBG);
 #include "wireguard_vpn.h"
 #include "wireguardif.h"
 #include "wg_timer.h"
+#include "wg_trace.h"
 
 #define APP_BANNER "wireguard"
 
@@ -183,10 +185,75 @@ static int cmd_quit(const struct shell *sh,
 	return 0;
 }
 
+static int cmd_stats(const struct shell *sh,
+			  size_t argc, char *argv[])
+{
+	struct wireguardif_stats stats;
+
+	if (wg_netif == NULL || wg_netif->state == NULL) {
+		shell_error(sh, "WireGuard interface is not initialized");
+		return -ENOEXEC;
+	}
+
+	wireguardif_get_stats(wg_netif, &stats);
+
+	shell_print(sh, "TX pool      : %u/%u in use", stats.tx_pool_used, stats.tx_pool_size);
+	shell_print(sh, "TX pool empty: %u", stats.tx_pool_exhausted);
+	if (IS_ENABLED(CONFIG_WIREGUARD_TX_STAGING)) {
+		shell_print(sh, "TX staged    : %u", stats.tx_staged);
+		shell_print(sh, "TX stage drop: %u", stats.tx_staged_dropped);
+	}
+	if (IS_ENABLED(CONFIG_WIREGUARD_ROUTE_CACHE)) {
+		shell_print(sh, "Route hits   : %u", stats.route_cache_hits);
+		shell_print(sh, "Route misses : %u", stats.route_cache_misses);
+	}
+
+	if (IS_ENABLED(CONFIG_NET_UDP)) {
+		struct data *data = &conf.ipv4;
+		int wakeups = atomic_get(&data->udp.batch.wakeups);
+		int packets = atomic_get(&data->udp.batch.packets);
+
+		shell_print(sh, "RX wakeups   : %d", wakeups);
+		shell_print(sh, "RX packets   : %d", packets);
+		for (int i = 0; i < RECV_BATCH; i++) {
+			int n = atomic_get(&data->udp.batch.histogram[i]);
+
+			if (n) {
+				shell_print(sh, "RX batch %2d  : %d", i + 1, n);
+			}
+		}
+	}
+
+	return 0;
+}
+
+#if defined(CONFIG_WIREGUARD_PKT_TRACE)
+static int cmd_trace(const struct shell *sh,
+			  size_t argc, char *argv[])
+{
+	if (argc > 1 && strcmp(argv[1], "clear") == 0) {
+		wg_trace_clear();
+		return 0;
+	}
+
+	wg_trace_dump(sh);
+
+	return 0;
+}
+#endif
+
 SHELL_STATIC_SUBCMD_SET_CREATE(wg_commands,
 	SHELL_CMD(quit, NULL,
 		  "Quit the WG application\n",
 		  cmd_quit),
+	SHELL_CMD(stats, NULL,
+		  "Show WG data path statistics\n",
+		  cmd_stats),
+#if defined(CONFIG_WIREGUARD_PKT_TRACE)
+	SHELL_CMD_ARG(trace, NULL,
+		  "Dump the sampled packet trace, \"clear\" to reset it\n",
+		  cmd_trace, 1, 1),
+#endif
 	SHELL_SUBCMD_SET_END
 );
 
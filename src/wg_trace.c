@@ -0,0 +1,123 @@
+/*
+ * Copyright (c) 2024 Chunghan Yi <chunghan.yi@gmail.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <zephyr/kernel.h>
+#include <zephyr/shell/shell.h>
+#include <zephyr/net/net_ip.h>
+#include <string.h>
+
+#include "wg_trace.h"
+
+#define TRACE_ENTRIES CONFIG_WIREGUARD_PKT_TRACE_ENTRIES
+
+static struct wg_trace_record trace_ring[TRACE_ENTRIES];
+static uint32_t trace_head;	/* number of records ever written */
+static struct k_spinlock trace_lock;
+static atomic_t trace_seen;
+
+static const char *const trace_event_names[] = {
+	[WG_TRACE_UDP_RX] = "udp-rx",
+	[WG_TRACE_TUN_TX] = "tun-tx",
+	[WG_TRACE_TUN_RX] = "tun-rx",
+};
+
+void wg_trace_packet(enum wg_trace_event event, uint16_t peer, uint32_t src, uint32_t dst, uint16_t len)
+{
+	struct wg_trace_record *rec;
+	k_spinlock_key_t key;
+
+	/* Everything but the sampled packets costs one atomic increment */
+	if ((atomic_inc(&trace_seen) % CONFIG_WIREGUARD_PKT_TRACE_SAMPLE) != 0) {
+		return;
+	}
+
+	key = k_spin_lock(&trace_lock);
+	rec = &trace_ring[trace_head % TRACE_ENTRIES];
+	rec->cycles = k_cycle_get_32();
+	rec->src = src;
+	rec->dst = dst;
+	rec->len = len;
+	rec->event = event;
+	rec->peer = peer;
+	trace_head++;
+	k_spin_unlock(&trace_lock, key);
+}
+
+static void print_addr(char *buf, size_t len, uint32_t addr)
+{
+	uint32_t a = ntohl(addr);
+
+	snprintk(buf, len, "%u.%u.%u.%u",
+		 (a >> 24) & 0xFF, (a >> 16) & 0xFF, (a >> 8) & 0xFF, a & 0xFF);
+}
+
+/* Records copied out of the ring at a time - keeps the shell stack small */
+#define TRACE_DUMP_CHUNK 8
+
+void wg_trace_dump(const struct shell *sh)
+{
+	struct wg_trace_record records[TRACE_DUMP_CHUNK];
+	char src[sizeof("255.255.255.255")];
+	char dst[sizeof("255.255.255.255")];
+	k_spinlock_key_t key;
+	uint32_t head;
+	uint32_t now;
+	uint32_t i;
+	uint32_t n;
+	uint32_t x;
+
+	key = k_spin_lock(&trace_lock);
+	head = trace_head;
+	k_spin_unlock(&trace_lock, key);
+
+	shell_print(sh, "Sampling 1 in %d packets, %u of %u packets recorded",
+		    CONFIG_WIREGUARD_PKT_TRACE_SAMPLE, head, (uint32_t)atomic_get(&trace_seen));
+	shell_print(sh, "%10s %-6s %4s %5s %-15s    %s", "usec", "event", "peer", "len", "src", "dst");
+
+	i = head - MIN(head, TRACE_ENTRIES);
+	while (i != head) {
+		/* Copy a few records at a time so the data path is not held up while printing */
+		key = k_spin_lock(&trace_lock);
+		now = trace_head;
+		if ((now < head) || (now - head >= TRACE_ENTRIES)) {
+			/* Cleared meanwhile, or everything left to print was overwritten */
+			k_spin_unlock(&trace_lock, key);
+			break;
+		}
+		if (now - i > TRACE_ENTRIES) {
+			/* These were overwritten while the earlier ones were printed */
+			i = now - TRACE_ENTRIES;
+		}
+		n = MIN(head - i, TRACE_DUMP_CHUNK);
+		for (x = 0; x < n; x++) {
+			records[x] = trace_ring[(i + x) % TRACE_ENTRIES];
+		}
+		k_spin_unlock(&trace_lock, key);
+
+		for (x = 0; x < n; x++) {
+			struct wg_trace_record *rec = &records[x];
+
+			print_addr(src, sizeof(src), rec->src);
+			print_addr(dst, sizeof(dst), rec->dst);
+			shell_print(sh, "%10u %-6s %4d %5u %-15s -> %s",
+				    k_cyc_to_us_floor32(rec->cycles),
+				    rec->event < ARRAY_SIZE(trace_event_names) ?
+					trace_event_names[rec->event] : "?",
+				    rec->peer, rec->len, src, dst);
+		}
+		i += n;
+	}
+}
+
+void wg_trace_clear(void)
+{
+	k_spinlock_key_t key;
+
+	key = k_spin_lock(&trace_lock);
+	trace_head = 0;
+	atomic_set(&trace_seen, 0);
+	k_spin_unlock(&trace_lock, key);
+}
@@ -0,0 +1,72 @@
+/*
+ * Copyright (c) 2024 Chunghan Yi <chunghan.yi@gmail.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef _WG_TRACE_H_
+#define _WG_TRACE_H_
+
+#include <stdint.h>
+#include <zephyr/logging/log.h>
+
+/*
+ * Per-packet logging of the data path.
+ *
+ * These are only compiled in when CONFIG_WIREGUARD_DATA_PATH_TRACE_LEVEL
+ * is at least the level of the message. Below that the arguments are never
+ * evaluated and the format strings do not end up in the image.
+ */
+#define WG_TRACE_LEVEL_ERR 1
+#define WG_TRACE_LEVEL_WRN 2
+#define WG_TRACE_LEVEL_INF 3
+#define WG_TRACE_LEVEL_DBG 4
+
+#define Z_WG_TRACE(_level, _log, ...)						\
+	do {									\
+		if (CONFIG_WIREGUARD_DATA_PATH_TRACE_LEVEL >= (_level)) {	\
+			_log(__VA_ARGS__);					\
+		}								\
+	} while (0)
+
+#define WG_TRACE_ERR(...) Z_WG_TRACE(WG_TRACE_LEVEL_ERR, LOG_ERR, __VA_ARGS__)
+#define WG_TRACE_WRN(...) Z_WG_TRACE(WG_TRACE_LEVEL_WRN, LOG_WRN, __VA_ARGS__)
+#define WG_TRACE_INF(...) Z_WG_TRACE(WG_TRACE_LEVEL_INF, LOG_INF, __VA_ARGS__)
+#define WG_TRACE_DBG(...) Z_WG_TRACE(WG_TRACE_LEVEL_DBG, LOG_DBG, __VA_ARGS__)
+
+/*
+ * Sampled packet trace.
+ *
+ * One in CONFIG_WIREGUARD_PKT_TRACE_SAMPLE packets is stored as a binary
+ * record in a ring buffer, formatting only happens when the ring is dumped
+ * with "wireguard trace".
+ */
+enum wg_trace_event {
+	WG_TRACE_UDP_RX,	/* WireGuard datagram received, addresses are the outer ones */
+	WG_TRACE_TUN_TX,	/* plaintext packet sent on the tunnel */
+	WG_TRACE_TUN_RX,	/* plaintext packet decrypted and passed up */
+};
+
+struct wg_trace_record {
+	uint32_t cycles;
+	uint32_t src;		/* IPv4 addresses in network byte order */
+	uint32_t dst;
+	uint16_t len;
+	uint16_t peer;		/* WIREGUARDIF_INVALID_INDEX if not known */
+	uint8_t event;
+};
+
+#if defined(CONFIG_WIREGUARD_PKT_TRACE)
+struct shell;
+
+void wg_trace_packet(enum wg_trace_event event, uint16_t peer, uint32_t src, uint32_t dst, uint16_t len);
+void wg_trace_dump(const struct shell *sh);
+void wg_trace_clear(void);
+
+#define WG_TRACE_PKT(_event, _peer, _src, _dst, _len) \
+	wg_trace_packet((_event), (_peer), (_src), (_dst), (_len))
+#else
+#define WG_TRACE_PKT(_event, _peer, _src, _dst, _len) do { } while (0)
+#endif
+
+#endif /*_WG_TRACE_H_*/
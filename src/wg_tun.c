@@ -18,6 +18,7 @@ LOG_MODULE_DECLARE(wg, LOG_LEVEL_DBG);
 #include <zephyr/net/virtual_mgmt.h>
 
 #include "wireguardif.h"
+#include "wg_trace.h"
 #include "lwip_h/ip4.h"
 
 extern struct netif *wg_netif;
@@ -106,7 +107,8 @@ static int virtual_wg_interface_send(struct net_if *iface,
 {
 	struct virtual_wg_context *ctx = net_if_get_device(iface)->data;
 	int r;
-	struct pbuf u;
+	err_t err;
+	struct pbuf u[WIREGUARDIF_MAX_PBUFS];
 	ip_addr_t addr;
 	struct ip_hdr *ip;
 	int real_len = net_pkt_get_len(pkt);
@@ -115,10 +117,9 @@ static int virtual_wg_interface_send(struct net_if *iface,
 		return -ENOENT;
 	}
 
-	u.payload = pkt->frags->data;
 	r = real_len;
-	ip = (struct ip_hdr *)u.payload;
-	LOG_DBG("<< Sending a VPN message: size %d from SRC = %"PRIu32".%"PRIu32".%"PRIu32".%"PRIu32" to DST = %"PRIu32".%"PRIu32".%"PRIu32".%"PRIu32"",
+	ip = (struct ip_hdr *)pkt->frags->data;
+	WG_TRACE_DBG("<< Sending a VPN message: size %d from SRC = %"PRIu32".%"PRIu32".%"PRIu32".%"PRIu32" to DST = %"PRIu32".%"PRIu32".%"PRIu32".%"PRIu32"",
 			r,
 			(ntohl(ip->src.addr)  >> 24) & 0xFF,
 			(ntohl(ip->src.addr)  >> 16) & 0xFF,
@@ -128,16 +129,30 @@ static int virtual_wg_interface_send(struct net_if *iface,
 			(ntohl(ip->dest.addr) >> 16) & 0xFF,
 			(ntohl(ip->dest.addr) >>  8) & 0xFF,
 			(ntohl(ip->dest.addr) >>  0) & 0xFF);
+	WG_TRACE_PKT(WG_TRACE_TUN_TX, WIREGUARDIF_INVALID_INDEX, ip->src.addr, ip->dest.addr, r);
 
 	if (r > 4096) {
 		net_pkt_unref(pkt);
-		LOG_DBG("Hmm, too big message(r:%d) received.", r);
+		WG_TRACE_DBG("Hmm, too big message(r:%d) received.", r);
 		return NET_CONTINUE;
 	}
 
-	u.len = u.tot_len = r;
 	addr.u_addr.ip4.addr = ip->dest.addr;
-	wireguardif_output(wg_netif, &u, &addr);
+
+	/* The packet may be spread over several buffers, they are copied in one go when it is encrypted */
+	err = ERR_BUF;
+	if (wireguardif_pkt_to_pbuf(pkt, u, ARRAY_SIZE(u))) {
+		err = wireguardif_output(wg_netif, u, &addr);
+	}
+
+#if defined(CONFIG_WIREGUARD_TX_STAGING)
+	/* No session with the peer yet, keep the packet until the handshake is done */
+	if (err == ERR_CONN && wireguardif_stage_pkt(wg_netif, pkt, &addr) == ERR_OK) {
+		return NET_CONTINUE;
+	}
+#else
+	ARG_UNUSED(err);
+#endif
 
 	net_pkt_unref(pkt);
 	return NET_CONTINUE;
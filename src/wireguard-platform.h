@@ -38,8 +38,7 @@
 #include <stdbool.h>
 
 // Peers are allocated statically inside the device structure to avoid malloc
-#define WIREGUARD_MAX_PEERS 1
-#define WIREGUARD_MAX_SRC_IPS 2
+#define WIREGUARD_MAX_PEERS CONFIG_WIREGUARD_MAX_PEERS
 
 // Per device limit on accepting (valid) initiation requests - per peer
 #define MAX_INITIATIONS_PER_SECOND	(2)
@@ -38,6 +38,8 @@
 
 #include "crypto.h"
 
+#include <zephyr/kernel.h>
+
 // For HMAC calculation
 #define WIREGUARD_BLAKE2S_BLOCK_SIZE (64)
 
@@ -52,6 +54,74 @@ static const char *base64_lookup = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqr
 
 static const uint8_t zero_key[WIREGUARD_PUBLIC_KEY_LEN] = { 0 };
 
+// Handshakes are created from both the receive path and the timer, so reserving an index and probing the table are serialised
+static struct k_spinlock index_table_lock;
+
+#if defined(CONFIG_WIREGUARD_KEYSTREAM_PREFETCH)
+// Keystream for one upcoming sending counter: the block that keys Poly1305 followed by the text blocks
+#define KEYSTREAM_LEN		((CONFIG_WIREGUARD_KEYSTREAM_PREFETCH_BLOCKS + 1) * CHACHA20_BLOCK_SIZE)
+// Longest (padded) plaintext a prefetched keystream covers
+#define KEYSTREAM_MAX_TEXT	(CONFIG_WIREGUARD_KEYSTREAM_PREFETCH_BLOCKS * CHACHA20_BLOCK_SIZE)
+
+struct keystream_slot {
+	bool ready; // Set once the stream is complete, cleared when it is used or wiped
+	uint32_t local_index; // Keypair the keystream is for
+	uint64_t counter;
+	uint8_t stream[KEYSTREAM_LEN];
+};
+
+// Prefetched keystream of one peer, for whichever of its keypairs is sending - kept out of the keypairs so they stay cheap
+// to copy. The slots, and the sending counters of the peer's keypairs, only change under the lock. generation is odd
+// while the peer's keypairs are being rewritten, and moves on whenever they were.
+struct keystream_ring {
+	struct k_spinlock lock;
+	uint32_t generation;
+	struct keystream_slot slots[CONFIG_WIREGUARD_KEYSTREAM_PREFETCH_DEPTH];
+};
+
+// At the same index as the peer in wireguard_device.peers
+static struct keystream_ring keystream_rings[WIREGUARD_MAX_PEERS];
+
+static struct keystream_ring *keystream_ring_get(struct wireguard_device *device, struct wireguard_peer *peer) {
+	return &keystream_rings[peer - device->peers];
+}
+
+// Every change to a peer's keypairs is bracketed by these, so a prefetch that read them meanwhile throws its work away
+static void keystream_write_begin(struct wireguard_device *device, struct wireguard_peer *peer) {
+	struct keystream_ring *ring = keystream_ring_get(device, peer);
+	k_spinlock_key_t key = k_spin_lock(&ring->lock);
+
+	ring->generation++;
+	k_spin_unlock(&ring->lock, key);
+}
+
+// Keystream of keypairs the peer no longer holds is wiped
+static void keystream_write_end(struct wireguard_device *device, struct wireguard_peer *peer) {
+	struct keystream_ring *ring = keystream_ring_get(device, peer);
+	struct keystream_slot *slot;
+	k_spinlock_key_t key;
+	size_t x;
+
+	key = k_spin_lock(&ring->lock);
+	for (x = 0; x < CONFIG_WIREGUARD_KEYSTREAM_PREFETCH_DEPTH; x++) {
+		slot = &ring->slots[x];
+		if ((slot->local_index != 0) && !get_peer_keypair_for_idx(peer, slot->local_index)) {
+			crypto_zero(slot, sizeof(struct keystream_slot));
+		}
+	}
+	ring->generation++;
+	k_spin_unlock(&ring->lock, key);
+}
+
+// Keypairs only exist inside the peers array, so the peer follows from the address
+static struct wireguard_peer *keypair_peer(struct wireguard_device *device, struct wireguard_keypair *keypair) {
+	return &device->peers[((uint8_t *)keypair - (uint8_t *)device->peers) / sizeof(struct wireguard_peer)];
+}
+#else
+static void keystream_write_begin(struct wireguard_device *device, struct wireguard_peer *peer) { }
+static void keystream_write_end(struct wireguard_device *device, struct wireguard_peer *peer) { }
+#endif
+
 // Calculated in wireguard_init
 static uint8_t construction_hash[WIREGUARD_HASH_LEN];
 static uint8_t identifier_hash[WIREGUARD_HASH_LEN];
@@ -70,6 +140,79 @@ void wireguard_init() {
 	wireguard_blake2s_final(&ctx, identifier_hash);
 }
 
+// Keys come off the network, so they are mixed with a per-device random seed before picking a slot
+static size_t peer_table_home(const struct wireguard_device *device, uint32_t key, size_t size) {
+	uint32_t h = (key ^ device->table_seed) * 0x9E3779B1;
+	return (h ^ (h >> 16)) & (size - 1);
+}
+
+static void peer_table_insert(struct wireguard_device *device, struct wireguard_peer_slot *table, size_t size,
+	uint32_t key, struct wireguard_peer *peer) {
+	size_t x = peer_table_home(device, key, size);
+
+	while (table[x].peer != 0) {
+		x = (x + 1) & (size - 1);
+	}
+	table[x].key = key;
+	table[x].peer = (uint16_t)(peer - device->peers) + 1;
+}
+
+// Backward shift deletion - later entries of the same probe run move up into the hole, so no tombstones are needed.
+// A NULL peer removes the entry for key whoever owns it, for tables where keys are unique.
+static void peer_table_remove(struct wireguard_device *device, struct wireguard_peer_slot *table, size_t size,
+	uint32_t key, struct wireguard_peer *peer) {
+	uint16_t value = peer ? (uint16_t)(peer - device->peers) + 1 : 0;
+	size_t x = peer_table_home(device, key, size);
+	size_t y;
+	size_t home;
+
+	while ((table[x].peer != 0) && !((table[x].key == key) && (!value || (table[x].peer == value)))) {
+		x = (x + 1) & (size - 1);
+	}
+	if (table[x].peer != 0) {
+		for (y = (x + 1) & (size - 1); table[y].peer != 0; y = (y + 1) & (size - 1)) {
+			home = peer_table_home(device, table[y].key, size);
+			// The entry at y may fill the hole at x unless its home slot lies after x (cyclically) on the way to y
+			if (((y - home) & (size - 1)) >= ((y - x) & (size - 1))) {
+				table[x] = table[y];
+				x = y;
+			}
+		}
+		table[x].peer = 0;
+	}
+}
+
+// Enter index for peer unless some peer already uses it - the check and the insert happen under one lock
+static bool index_table_reserve(struct wireguard_device *device, uint32_t index, struct wireguard_peer *peer) {
+	k_spinlock_key_t key = k_spin_lock(&index_table_lock);
+	bool result = true;
+	size_t x;
+
+	for (x = peer_table_home(device, index, WIREGUARD_INDEX_TABLE_SIZE); device->index_table[x].peer != 0; x = (x + 1) & (WIREGUARD_INDEX_TABLE_SIZE - 1)) {
+		if (device->index_table[x].key == index) {
+			result = false;
+			break;
+		}
+	}
+	if (result) {
+		device->index_table[x].key = index;
+		device->index_table[x].peer = (uint16_t)(peer - device->peers) + 1;
+	}
+	k_spin_unlock(&index_table_lock, key);
+	return result;
+}
+
+// Give an index back once nothing holds it any more - 0 is never handed out and is ignored
+static void index_table_release(struct wireguard_device *device, uint32_t index) {
+	k_spinlock_key_t key;
+
+	if (index != 0) {
+		key = k_spin_lock(&index_table_lock);
+		peer_table_remove(device, device->index_table, WIREGUARD_INDEX_TABLE_SIZE, index, NULL);
+		k_spin_unlock(&index_table_lock, key);
+	}
+}
+
 struct wireguard_peer *peer_alloc(struct wireguard_device *device) {
 	struct wireguard_peer *result = NULL;
 	struct wireguard_peer *tmp;
@@ -85,15 +228,37 @@ struct wireguard_peer *peer_alloc(struct wireguard_device *device) {
 	return result;
 }
 
+void peer_free(struct wireguard_device *device, struct wireguard_peer *peer) {
+	struct wireguard_peer_identity *identity = peer_identity(device, peer);
+
+	keystream_write_begin(device, peer);
+	if (peer->valid) {
+		peer_table_remove(device, device->pubkey_table, WIREGUARD_PUBKEY_TABLE_SIZE, U8TO32_LITTLE(identity->public_key), peer);
+		index_table_release(device, identity->handshake.local_index);
+		index_table_release(device, peer->curr_keypair.local_index);
+		index_table_release(device, peer->next_keypair.local_index);
+		index_table_release(device, peer->prev_keypair.local_index);
+	}
+	crypto_zero(peer, sizeof(struct wireguard_peer));
+	crypto_zero(identity, sizeof(struct wireguard_peer_identity));
+	peer->valid = false;
+	keystream_write_end(device, peer);
+}
+
+struct wireguard_peer_identity *peer_identity(struct wireguard_device *device, struct wireguard_peer *peer) {
+	return &device->peer_identities[peer - device->peers];
+}
+
 struct wireguard_peer *peer_lookup_by_pubkey(struct wireguard_device *device, uint8_t *public_key) {
 	struct wireguard_peer *result = NULL;
 	struct wireguard_peer *tmp;
-	int x;
+	uint32_t key = U8TO32_LITTLE(public_key);
+	size_t x;
 
-	for (x=0; x < WIREGUARD_MAX_PEERS; x++) {
-		tmp = &device->peers[x];
-		if (tmp->valid) {
-			if (memcmp(tmp->public_key, public_key, WIREGUARD_PUBLIC_KEY_LEN) == 0) {
+	for (x = peer_table_home(device, key, WIREGUARD_PUBKEY_TABLE_SIZE); device->pubkey_table[x].peer != 0; x = (x + 1) & (WIREGUARD_PUBKEY_TABLE_SIZE - 1)) {
+		if (device->pubkey_table[x].key == key) {
+			tmp = &device->peers[device->pubkey_table[x].peer - 1];
+			if (tmp->valid && (memcmp(peer_identity(device, tmp)->public_key, public_key, WIREGUARD_PUBLIC_KEY_LEN) == 0)) {
 				result = tmp;
 				break;
 			}
@@ -102,20 +267,16 @@ struct wireguard_peer *peer_lookup_by_pubkey(struct wireguard_device *device, ui
 	return result;
 }
 
-uint8_t wireguard_peer_index(struct wireguard_device *device, struct wireguard_peer *peer) {
-	uint8_t result = 0xFF;
-	uint8_t x;
+uint16_t wireguard_peer_index(struct wireguard_device *device, struct wireguard_peer *peer) {
+	uint16_t result = WIREGUARD_INVALID_PEER;
 
-	for (x=0; x < WIREGUARD_MAX_PEERS; x++) {
-		if (peer == &device->peers[x]) {
-			result = x;
-			break;
-		}
+	if ((peer >= device->peers) && (peer < &device->peers[WIREGUARD_MAX_PEERS])) {
+		result = (uint16_t)(peer - device->peers);
 	}
 	return result;
 }
 
-struct wireguard_peer *peer_lookup_by_peer_index(struct wireguard_device *device, uint8_t peer_index) {
+struct wireguard_peer *peer_lookup_by_peer_index(struct wireguard_device *device, uint16_t peer_index) {
 	struct wireguard_peer *result = NULL;
 	if (peer_index < WIREGUARD_MAX_PEERS) {
 		if (device->peers[peer_index].valid) {
@@ -127,36 +288,45 @@ struct wireguard_peer *peer_lookup_by_peer_index(struct wireguard_device *device
 
 struct wireguard_peer *peer_lookup_by_receiver(struct wireguard_device *device, uint32_t receiver) {
 	struct wireguard_peer *result = NULL;
-	struct wireguard_peer *tmp;
-	int x;
-
-	for (x=0; x < WIREGUARD_MAX_PEERS; x++) {
-		tmp = &device->peers[x];
-		if (tmp->valid) {
-			if ((tmp->curr_keypair.valid && (tmp->curr_keypair.local_index == receiver)) ||
-				(tmp->next_keypair.valid && (tmp->next_keypair.local_index == receiver)) ||
-				(tmp->prev_keypair.valid && (tmp->prev_keypair.local_index == receiver))
-				) {
-				result = tmp;
-				break;
-			}
+	struct wireguard_peer *tmp = NULL;
+	k_spinlock_key_t key;
+	size_t x;
+
+	// Indexes are unique, so the probe stops at the first match
+	key = k_spin_lock(&index_table_lock);
+	for (x = peer_table_home(device, receiver, WIREGUARD_INDEX_TABLE_SIZE); device->index_table[x].peer != 0; x = (x + 1) & (WIREGUARD_INDEX_TABLE_SIZE - 1)) {
+		if (device->index_table[x].key == receiver) {
+			tmp = &device->peers[device->index_table[x].peer - 1];
+			break;
 		}
 	}
+	k_spin_unlock(&index_table_lock, key);
+	if (tmp && tmp->valid && get_peer_keypair_for_idx(tmp, receiver)) {
+		result = tmp;
+	}
 	return result;
 }
 
 struct wireguard_peer *peer_lookup_by_handshake(struct wireguard_device *device, uint32_t receiver) {
 	struct wireguard_peer *result = NULL;
-	struct wireguard_peer *tmp;
-	int x;
-
-	for (x=0; x < WIREGUARD_MAX_PEERS; x++) {
-		tmp = &device->peers[x];
-		if (tmp->valid) {
-			if (tmp->handshake.valid && tmp->handshake.initiator && (tmp->handshake.local_index == receiver)) {
-				result = tmp;
-				break;
-			}
+	struct wireguard_peer *tmp = NULL;
+	struct wireguard_handshake *handshake;
+	k_spinlock_key_t key;
+	size_t x;
+
+	// Indexes are unique, so the probe stops at the first match
+	key = k_spin_lock(&index_table_lock);
+	for (x = peer_table_home(device, receiver, WIREGUARD_INDEX_TABLE_SIZE); device->index_table[x].peer != 0; x = (x + 1) & (WIREGUARD_INDEX_TABLE_SIZE - 1)) {
+		if (device->index_table[x].key == receiver) {
+			tmp = &device->peers[device->index_table[x].peer - 1];
+			break;
+		}
+	}
+	k_spin_unlock(&index_table_lock, key);
+	if (tmp && tmp->valid) {
+		handshake = &peer_identity(device, tmp)->handshake;
+		if (handshake->valid && handshake->initiator && (handshake->local_index == receiver)) {
+			result = tmp;
 		}
 	}
 	return result;
@@ -168,9 +338,17 @@ bool wireguard_expired(uint32_t created_millis, uint32_t valid_seconds) {
 }
 
 
-static void generate_cookie_secret(struct wireguard_device *device) {
-	wireguard_random_bytes(device->cookie_secret, WIREGUARD_HASH_LEN);
-	device->cookie_secret_millis = wireguard_sys_now();
+// On failure the old secret is kept and replacing it is tried again next time
+static bool generate_cookie_secret(struct wireguard_device *device) {
+	uint8_t secret[WIREGUARD_HASH_LEN];
+	bool result = wireguard_crypto_random(secret, WIREGUARD_HASH_LEN);
+
+	if (result) {
+		memcpy(device->cookie_secret, secret, WIREGUARD_HASH_LEN);
+		device->cookie_secret_millis = wireguard_sys_now();
+	}
+	crypto_zero(secret, sizeof(secret));
+	return result;
 }
 
 static void generate_peer_cookie(struct wireguard_device *device, uint8_t *cookie,
@@ -261,111 +439,147 @@ static void wireguard_hmac(uint8_t *digest, const uint8_t *key, size_t key_len,
 	wireguard_blake2s_final(&ctx, digest); // finish up 2nd pass
 }
 
-static void wireguard_kdf1(uint8_t *tau1, const uint8_t *chaining_key, const uint8_t *data, size_t data_len) {
-	uint8_t tau0[WIREGUARD_HASH_LEN];
-	uint8_t output[WIREGUARD_HASH_LEN + 1];
+// HMAC with the pad blocks already compressed, for deriving several values from one key
+struct wireguard_hmac_ctx {
+	wireguard_blake2s_ctx inner; // state after K XOR ipad
+	wireguard_blake2s_ctx outer; // state after K XOR opad
+};
 
-	// tau0 = Hmac(key, input)
-	wireguard_hmac(tau0, chaining_key, WIREGUARD_HASH_LEN, data, data_len);
-	// tau1 := Hmac(tau0, 0x1)
-	output[0] = 1;
-	wireguard_hmac(output, tau0, WIREGUARD_HASH_LEN, output, 1);
-	memcpy(tau1, output, WIREGUARD_HASH_LEN);
+static void wireguard_hmac_init(struct wireguard_hmac_ctx *hmac, const uint8_t *key, size_t key_len) {
+	uint8_t k_pad[WIREGUARD_BLAKE2S_BLOCK_SIZE];
+	int i;
 
-	// Wipe intermediates
-	crypto_zero(tau0, sizeof(tau0));
-	crypto_zero(output, sizeof(output));
+	// Only used with HASH_LEN keys, which are never longer than a block
+	memset(k_pad, 0, sizeof(k_pad));
+	memcpy(k_pad, key, key_len);
+
+	for (i=0; i < WIREGUARD_BLAKE2S_BLOCK_SIZE; i++) {
+		k_pad[i] ^= 0x36;
+	}
+	wireguard_blake2s_init(&hmac->inner, WIREGUARD_HASH_LEN, NULL, 0);
+	wireguard_blake2s_update(&hmac->inner, k_pad, WIREGUARD_BLAKE2S_BLOCK_SIZE);
+	wireguard_blake2s_flush(&hmac->inner);
+
+	for (i=0; i < WIREGUARD_BLAKE2S_BLOCK_SIZE; i++) {
+		k_pad[i] ^= 0x36 ^ 0x5c;
+	}
+	wireguard_blake2s_init(&hmac->outer, WIREGUARD_HASH_LEN, NULL, 0);
+	wireguard_blake2s_update(&hmac->outer, k_pad, WIREGUARD_BLAKE2S_BLOCK_SIZE);
+	wireguard_blake2s_flush(&hmac->outer);
+
+	crypto_zero(k_pad, sizeof(k_pad));
 }
 
-static void wireguard_kdf2(uint8_t *tau1, uint8_t *tau2, const uint8_t *chaining_key,
-	const uint8_t *data, size_t data_len) {
-	uint8_t tau0[WIREGUARD_HASH_LEN];
-	uint8_t output[WIREGUARD_HASH_LEN + 1];
+// Hmac(key, text) from the precomputed pad states - text_len must not be 0, as the pad block has already been
+// compressed as a non-final block
+static void wireguard_hmac_digest(const struct wireguard_hmac_ctx *hmac, uint8_t *digest, const uint8_t *text, size_t text_len) {
+	wireguard_blake2s_ctx ctx;
 
-	// tau0 = Hmac(key, input)
-	wireguard_hmac(tau0, chaining_key, WIREGUARD_HASH_LEN, data, data_len);
-	// tau1 := Hmac(tau0, 0x1)
-	output[0] = 1;
-	wireguard_hmac(output, tau0, WIREGUARD_HASH_LEN, output, 1);
-	memcpy(tau1, output, WIREGUARD_HASH_LEN);
+	memcpy(&ctx, &hmac->inner, sizeof(ctx));
+	wireguard_blake2s_update(&ctx, text, text_len);
+	wireguard_blake2s_final(&ctx, digest);
 
-	// tau2 := Hmac(tau0,tau1 || 0x2)
-	output[WIREGUARD_HASH_LEN] = 2;
-	wireguard_hmac(output, tau0, WIREGUARD_HASH_LEN, output, WIREGUARD_HASH_LEN + 1);
-	memcpy(tau2, output, WIREGUARD_HASH_LEN);
+	memcpy(&ctx, &hmac->outer, sizeof(ctx));
+	wireguard_blake2s_update(&ctx, digest, WIREGUARD_HASH_LEN);
+	wireguard_blake2s_final(&ctx, digest);
 
-	// Wipe intermediates
-	crypto_zero(tau0, sizeof(tau0));
-	crypto_zero(output, sizeof(output));
+	crypto_zero(&ctx, sizeof(ctx));
 }
 
-static void wireguard_kdf3(uint8_t *tau1, uint8_t *tau2, uint8_t *tau3, const uint8_t *chaining_key,
-	const uint8_t *data, size_t data_len) {
+// tau1..tau3 of the KDF chain - tau_n := Hmac(tau0, tau_n-1 || n), all with the same tau0 key
+static void wireguard_kdf(uint8_t **tau, int count, const uint8_t *chaining_key, const uint8_t *data, size_t data_len) {
+	struct wireguard_hmac_ctx hmac;
 	uint8_t tau0[WIREGUARD_HASH_LEN];
 	uint8_t output[WIREGUARD_HASH_LEN + 1];
+	int i;
 
 	// tau0 = Hmac(key, input)
 	wireguard_hmac(tau0, chaining_key, WIREGUARD_HASH_LEN, data, data_len);
+	wireguard_hmac_init(&hmac, tau0, WIREGUARD_HASH_LEN);
+
 	// tau1 := Hmac(tau0, 0x1)
 	output[0] = 1;
-	wireguard_hmac(output, tau0, WIREGUARD_HASH_LEN, output, 1);
-	memcpy(tau1, output, WIREGUARD_HASH_LEN);
-
-	// tau2 := Hmac(tau0,tau1 || 0x2)
-	output[WIREGUARD_HASH_LEN] = 2;
-	wireguard_hmac(output, tau0, WIREGUARD_HASH_LEN, output, WIREGUARD_HASH_LEN + 1);
-	memcpy(tau2, output, WIREGUARD_HASH_LEN);
-
-	// tau3 := Hmac(tau0,tau1,tau2 || 0x3)
-	output[WIREGUARD_HASH_LEN] = 3;
-	wireguard_hmac(output, tau0, WIREGUARD_HASH_LEN, output, WIREGUARD_HASH_LEN + 1);
-	memcpy(tau3, output, WIREGUARD_HASH_LEN);
+	wireguard_hmac_digest(&hmac, output, output, 1);
+	memcpy(tau[0], output, WIREGUARD_HASH_LEN);
+
+	// tau2 := Hmac(tau0,tau1 || 0x2), tau3 := Hmac(tau0,tau2 || 0x3)
+	for (i = 1; i < count; i++) {
+		output[WIREGUARD_HASH_LEN] = i + 1;
+		wireguard_hmac_digest(&hmac, output, output, WIREGUARD_HASH_LEN + 1);
+		memcpy(tau[i], output, WIREGUARD_HASH_LEN);
+	}
 
 	// Wipe intermediates
+	crypto_zero(&hmac, sizeof(hmac));
 	crypto_zero(tau0, sizeof(tau0));
 	crypto_zero(output, sizeof(output));
 }
 
-bool wireguard_check_replay(struct wireguard_keypair *keypair, uint64_t seq) {
-	// Implementation of packet replay window - as per RFC2401
-	// Adapted from code in Appendix C at https://tools.ietf.org/html/rfc2401
-	uint32_t diff;
+void wireguard_kdf1(uint8_t *tau1, const uint8_t *chaining_key, const uint8_t *data, size_t data_len) {
+	uint8_t *tau[1] = { tau1 };
+	wireguard_kdf(tau, 1, chaining_key, data, data_len);
+}
+
+void wireguard_kdf2(uint8_t *tau1, uint8_t *tau2, const uint8_t *chaining_key,
+	const uint8_t *data, size_t data_len) {
+	uint8_t *tau[2] = { tau1, tau2 };
+	wireguard_kdf(tau, 2, chaining_key, data, data_len);
+}
+
+void wireguard_kdf3(uint8_t *tau1, uint8_t *tau2, uint8_t *tau3, const uint8_t *chaining_key,
+	const uint8_t *data, size_t data_len) {
+	uint8_t *tau[3] = { tau1, tau2, tau3 };
+	wireguard_kdf(tau, 3, chaining_key, data, data_len);
+}
+
+// Implementation of packet replay window - as per RFC 6479
+// A ring of WIREGUARD_REPLAY_WORDS words where bit (counter + 1) % CONFIG_WIREGUARD_REPLAY_WINDOW is set once counter has been
+// received. The words ahead of the current one are cleared as the window moves forwards, so a jump costs at most one pass over the ring
+bool wireguard_replay_would_accept(const struct wireguard_keypair *keypair, uint64_t seq) {
 	bool result = false;
-	size_t ReplayWindowSize = sizeof(keypair->replay_bitmap); // 32 bits
 
-	if (seq != 0) {
-		if (seq > keypair->replay_counter) {
-			// new larger sequence number
-			diff = seq - keypair->replay_counter;
-			if (diff < ReplayWindowSize) {
-				// In window
-				keypair->replay_bitmap <<= diff;
-				// set bit for this packet
-				keypair->replay_bitmap |= 1;
-			} else {
-				// This packet has a "way larger"
-				keypair->replay_bitmap = 1;
-			}
-			keypair->replay_counter = seq;
+	if (seq < REJECT_AFTER_MESSAGES) {
+		seq++;
+		if ((seq + WIREGUARD_REPLAY_WINDOW) < keypair->replay_counter) {
+			// too old
+		} else if (seq > keypair->replay_counter) {
 			// larger is good
 			result = true;
+		} else if (!(keypair->replay_bitmap[(seq / 32) & (WIREGUARD_REPLAY_WORDS - 1)] & ((uint32_t)1 << (seq % 32)))) {
+			// out of order but good
+			result = true;
 		} else {
-			diff = keypair->replay_counter - seq;
-			if (diff < ReplayWindowSize) {
-				if (keypair->replay_bitmap & ((uint32_t)1 << diff)) {
-					// already seen
-				} else {
-					// mark as seen
-					keypair->replay_bitmap |= ((uint32_t)1 << diff);
-					// out of order but good
-					result = true;
-				}
-			} else {
-				// too old or wrapped
+			// already seen
+		}
+	}
+	return result;
+}
+
+bool wireguard_replay_commit(struct wireguard_keypair *keypair, uint64_t seq) {
+	uint64_t index;
+	uint64_t index_current;
+	uint64_t top;
+	uint64_t x;
+	bool result = false;
+
+	if (wireguard_replay_would_accept(keypair, seq)) {
+		seq++;
+		index = seq / 32;
+		if (seq > keypair->replay_counter) {
+			// new larger sequence number - clear the words the window slides over
+			index_current = keypair->replay_counter / 32;
+			top = index - index_current;
+			if (top > WIREGUARD_REPLAY_WORDS) {
+				top = WIREGUARD_REPLAY_WORDS;
 			}
+			for (x = 1; x <= top; x++) {
+				keypair->replay_bitmap[(index_current + x) & (WIREGUARD_REPLAY_WORDS - 1)] = 0;
+			}
+			keypair->replay_counter = seq;
 		}
-	} else {
-		// first == 0 or wrapped
+		// mark as seen
+		keypair->replay_bitmap[index & (WIREGUARD_REPLAY_WORDS - 1)] |= ((uint32_t)1 << (seq % 32));
+		result = true;
 	}
 	return result;
 }
@@ -381,30 +595,21 @@ struct wireguard_keypair *get_peer_keypair_for_idx(struct wireguard_peer *peer,
 	return NULL;
 }
 
-static uint32_t wireguard_generate_unique_index(struct wireguard_device *device) {
+// The index is reserved in the device's index table for peer_owner - whoever ends up holding it must release it again.
+// 0 if the random number generator failed.
+static uint32_t wireguard_generate_unique_index(struct wireguard_device *device, struct wireguard_peer *peer_owner) {
 	// We need a random 32-bit number but make sure it's not already been used in the context of this device
 	uint32_t result;
 	uint8_t buf[4];
-	int x;
-	struct wireguard_peer *peer;
-	bool existing;
 
 	do {
-		do {
-			wireguard_random_bytes(buf, 4);
-			result = U8TO32_LITTLE(buf);
-		} while ((result == 0) || (result == 0xFFFFFFFF)); // Don't allow 0 or 0xFFFFFFFF as valid values
-
-		existing = false;
-		for (x=0; x < WIREGUARD_MAX_PEERS; x++) {
-			peer = &device->peers[x];
-			existing = (result == peer->curr_keypair.local_index) ||
-					(result == peer->prev_keypair.local_index) ||
-					(result == peer->next_keypair.local_index) ||
-					(result == peer->handshake.local_index);
-
+		if (!wireguard_crypto_random(buf, 4)) {
+			// 0 is never a valid index, the caller gives up
+			return 0;
 		}
-	} while (existing);
+		result = U8TO32_LITTLE(buf);
+		// Don't allow 0 or 0xFFFFFFFF as valid values
+	} while ((result == 0) || (result == 0xFFFFFFFF) || !index_table_reserve(device, result, peer_owner));
 
 	return result;
 }
@@ -414,9 +619,13 @@ static void wireguard_clamp_private_key(uint8_t *key) {
 	key[31] = (key[31] & 127) | 64;
 }
 
+// A failed random number generator leaves an all-zero key, which wireguard_generate_public_key() refuses
 static void wireguard_generate_private_key(uint8_t *key) {
-	wireguard_random_bytes(key, WIREGUARD_PRIVATE_KEY_LEN);
-	wireguard_clamp_private_key(key);
+	if (wireguard_crypto_random(key, WIREGUARD_PRIVATE_KEY_LEN)) {
+		wireguard_clamp_private_key(key);
+	} else {
+		crypto_zero(key, WIREGUARD_PRIVATE_KEY_LEN);
+	}
 }
 
 static bool wireguard_generate_public_key(uint8_t *public_key, const uint8_t *private_key) {
@@ -455,38 +664,65 @@ bool wireguard_check_mac2(struct wireguard_device *device, const uint8_t *data,
 	return result;
 }
 
-void keypair_destroy(struct wireguard_keypair *keypair) {
+// Wipe a keypair whose index has moved on to another slot - keypair_release() also gives the index back
+static void keypair_wipe(struct wireguard_keypair *keypair) {
 	crypto_zero(keypair, sizeof(struct wireguard_keypair));
 	keypair->valid = false;
 }
 
-void keypair_update(struct wireguard_peer *peer, struct wireguard_keypair *received_keypair) {
+static void keypair_release(struct wireguard_device *device, struct wireguard_keypair *keypair) {
+	index_table_release(device, keypair->local_index);
+	keypair_wipe(keypair);
+}
+
+void keypair_destroy(struct wireguard_device *device, struct wireguard_keypair *keypair) {
+#if defined(CONFIG_WIREGUARD_KEYSTREAM_PREFETCH)
+	struct wireguard_peer *peer = keypair_peer(device, keypair);
+
+	keystream_write_begin(device, peer);
+	keypair_release(device, keypair);
+	keystream_write_end(device, peer);
+#else
+	keypair_release(device, keypair);
+#endif
+}
+
+void keypair_update(struct wireguard_device *device, struct wireguard_peer *peer, struct wireguard_keypair *received_keypair) {
 	bool key_is_next = (received_keypair == &peer->next_keypair);
 
 	if (key_is_next) {
+		keystream_write_begin(device, peer);
+		index_table_release(device, peer->prev_keypair.local_index);
 		peer->prev_keypair = peer->curr_keypair;
 		peer->curr_keypair = peer->next_keypair;
-		keypair_destroy(&peer->next_keypair);
+		keypair_wipe(&peer->next_keypair);
+		keystream_write_end(device, peer);
 	}
 }
 
-static void add_new_keypair(struct wireguard_peer *peer, struct wireguard_keypair new_keypair) {
-	if (new_keypair.initiator) {
+static void add_new_keypair(struct wireguard_device *device, struct wireguard_peer *peer, const struct wireguard_keypair *new_keypair) {
+	keystream_write_begin(device, peer);
+	// Keypairs that get overwritten here are dropped, so their indexes are released first
+	if (new_keypair->initiator) {
+		index_table_release(device, peer->prev_keypair.local_index);
 		if (peer->next_keypair.valid) {
+			index_table_release(device, peer->curr_keypair.local_index);
 			peer->prev_keypair = peer->next_keypair;
-			keypair_destroy(&peer->next_keypair);
+			keypair_wipe(&peer->next_keypair);
 		} else {
 			peer->prev_keypair = peer->curr_keypair;
 		}
-		peer->curr_keypair = new_keypair;
+		peer->curr_keypair = *new_keypair;
 	} else {
-		peer->next_keypair =  new_keypair;
-		keypair_destroy(&peer->prev_keypair);
+		index_table_release(device, peer->next_keypair.local_index);
+		peer->next_keypair = *new_keypair;
+		keypair_release(device, &peer->prev_keypair);
 	}
+	keystream_write_end(device, peer);
 }
 
-void wireguard_start_session(struct wireguard_peer *peer, bool initiator) {
-	struct wireguard_handshake *handshake = &peer->handshake;
+void wireguard_start_session(struct wireguard_device *device, struct wireguard_peer *peer, bool initiator) {
+	struct wireguard_handshake *handshake = &peer_identity(device, peer)->handshake;
 	struct wireguard_keypair new_keypair;
 
 	crypto_zero(&new_keypair, sizeof(struct wireguard_keypair));
@@ -506,7 +742,7 @@ void wireguard_start_session(struct wireguard_peer *peer, bool initiator) {
 		wireguard_kdf2(new_keypair.receiving_key, new_keypair.sending_key, handshake->chaining_key, NULL, 0);
 	}
 
-	new_keypair.replay_bitmap = 0;
+	memset(new_keypair.replay_bitmap, 0, sizeof(new_keypair.replay_bitmap));
 	new_keypair.replay_counter = 0;
 
 	new_keypair.last_tx = 0;
@@ -523,7 +759,9 @@ void wireguard_start_session(struct wireguard_peer *peer, bool initiator) {
 	handshake->local_index = 0;
 	handshake->valid = false;
 
-	add_new_keypair(peer, new_keypair);
+	// The handshake index now belongs to the new keypair
+	add_new_keypair(device, peer, &new_keypair);
+	crypto_zero(&new_keypair, sizeof(new_keypair));
 }
 
 uint8_t wireguard_get_message_type(const uint8_t *data, size_t len) {
@@ -564,6 +802,7 @@ struct wireguard_peer *wireguard_process_initiation_message(struct wireguard_dev
 	struct message_handshake_initiation *msg) {
 	struct wireguard_peer *ret_peer = NULL;
 	struct wireguard_peer *peer = NULL;
+	struct wireguard_peer_identity *identity;
 	struct wireguard_handshake *handshake;
 	uint8_t key[WIREGUARD_SESSION_KEY_LEN];
 	uint8_t chaining_key[WIREGUARD_HASH_LEN];
@@ -610,10 +849,11 @@ struct wireguard_peer *wireguard_process_initiation_message(struct wireguard_dev
 
 			peer = peer_lookup_by_pubkey(device, s);
 			if (peer) {
-				handshake = &peer->handshake;
+				identity = peer_identity(device, peer);
+				handshake = &identity->handshake;
 
 				// (Ci,k) := Kdf2(Ci,DH(Sprivi,Spubr))
-				wireguard_kdf2(chaining_key, key, chaining_key, peer->public_key_dh, WIREGUARD_PUBLIC_KEY_LEN);
+				wireguard_kdf2(chaining_key, key, chaining_key, identity->public_key_dh, WIREGUARD_PUBLIC_KEY_LEN);
 
 				// msg.timestamp := AEAD(k, 0, Timestamp(), Hi)
 				if (wireguard_aead_decrypt(t, msg->enc_timestamp, sizeof(msg->enc_timestamp), hash, WIREGUARD_HASH_LEN, 0, key)) {
@@ -623,14 +863,14 @@ struct wireguard_peer *wireguard_process_initiation_message(struct wireguard_dev
 					now = wireguard_sys_now();
 
 					// Check that timestamp is increasing and we haven't had too many initiations (should only get one per peer every 5 seconds max?)
-					replay = (memcmp(t, peer->greatest_timestamp, WIREGUARD_TAI64N_LEN) <= 0); // tai64n is big endian so we can use memcmp to compare
-					rate_limit = (peer->last_initiation_rx - now) < (1000 / MAX_INITIATIONS_PER_SECOND);
+					replay = (memcmp(t, identity->greatest_timestamp, WIREGUARD_TAI64N_LEN) <= 0); // tai64n is big endian so we can use memcmp to compare
+					rate_limit = (identity->last_initiation_rx - now) < (1000 / MAX_INITIATIONS_PER_SECOND);
 
 					if (!replay && !rate_limit) {
 						// Success! Copy everything to peer
-						peer->last_initiation_rx = now;
-						if (memcmp(t, peer->greatest_timestamp, WIREGUARD_TAI64N_LEN) > 0) {
-							memcpy(peer->greatest_timestamp, t, WIREGUARD_TAI64N_LEN);
+						identity->last_initiation_rx = now;
+						if (memcmp(t, identity->greatest_timestamp, WIREGUARD_TAI64N_LEN) > 0) {
+							memcpy(identity->greatest_timestamp, t, WIREGUARD_TAI64N_LEN);
 							// TODO: Need to notify if the higher layers want to persist latest timestamp/nonce somewhere
 						}
 						memcpy(handshake->remote_ephemeral, e, WIREGUARD_PUBLIC_KEY_LEN);
@@ -667,7 +907,8 @@ struct wireguard_peer *wireguard_process_initiation_message(struct wireguard_dev
 
 bool wireguard_process_handshake_response(struct wireguard_device *device, struct wireguard_peer *peer,
 	struct message_handshake_response *src) {
-	struct wireguard_handshake *handshake = &peer->handshake;
+	struct wireguard_peer_identity *identity = peer_identity(device, peer);
+	struct wireguard_handshake *handshake = &identity->handshake;
 
 	bool result = false;
 	uint8_t key[WIREGUARD_SESSION_KEY_LEN];
@@ -685,7 +926,7 @@ bool wireguard_process_handshake_response(struct wireguard_device *device, struc
 		memcpy(hash, handshake->hash, WIREGUARD_HASH_LEN);
 		memcpy(chaining_key, handshake->chaining_key, WIREGUARD_HASH_LEN);
 		memcpy(ephemeral_private, handshake->ephemeral_private, WIREGUARD_PUBLIC_KEY_LEN);
-		memcpy(preshared_key, peer->preshared_key, WIREGUARD_SESSION_KEY_LEN);
+		memcpy(preshared_key, identity->preshared_key, WIREGUARD_SESSION_KEY_LEN);
 
 		// (Eprivr, Epubr) := DH-Generate()
 		// Not required
@@ -712,7 +953,7 @@ bool wireguard_process_handshake_response(struct wireguard_device *device, struc
 				wireguard_kdf1(chaining_key, chaining_key, dh_calculation, WIREGUARD_PUBLIC_KEY_LEN);
 
 				// (Cr, t, k) := Kdf3(Cr, Q)
-				wireguard_kdf3(chaining_key, tau, key, chaining_key, peer->preshared_key, WIREGUARD_SESSION_KEY_LEN);
+				wireguard_kdf3(chaining_key, tau, key, chaining_key, identity->preshared_key, WIREGUARD_SESSION_KEY_LEN);
 
 				// Hr := Hash(Hr | t)
 				wireguard_mix_hash(hash, tau, WIREGUARD_HASH_LEN);
@@ -752,22 +993,23 @@ bool wireguard_process_handshake_response(struct wireguard_device *device, struc
 	return result;
 }
 
-bool wireguard_process_cookie_message(struct wireguard_device *device __attribute__((unused)),
+bool wireguard_process_cookie_message(struct wireguard_device *device,
 	struct wireguard_peer *peer, struct message_cookie_reply *src) {
+	struct wireguard_peer_identity *identity = peer_identity(device, peer);
 	uint8_t cookie[WIREGUARD_COOKIE_LEN];
 	bool result = false;
 
-	if (peer->handshake_mac1_valid) {
+	if (identity->handshake_mac1_valid) {
 
 		result = wireguard_xaead_decrypt(cookie, src->enc_cookie, sizeof(src->enc_cookie),
-					peer->handshake_mac1, WIREGUARD_COOKIE_LEN, src->nonce, peer->label_cookie_key);
+					identity->handshake_mac1, WIREGUARD_COOKIE_LEN, src->nonce, identity->label_cookie_key);
 
 		if (result) {
 			// 5.4.7 Under Load: Cookie Reply Message
 			// Upon receiving this message, if it is valid, the only thing the recipient of this message should do is store the cookie along with the time at which it was received
-			memcpy(peer->cookie, cookie, WIREGUARD_COOKIE_LEN);
-			peer->cookie_millis = wireguard_sys_now();
-			peer->handshake_mac1_valid = false;
+			memcpy(identity->cookie, cookie, WIREGUARD_COOKIE_LEN);
+			identity->cookie_millis = wireguard_sys_now();
+			identity->handshake_mac1_valid = false;
 		}
 	} else {
 		// We didn't send any initiation packet so we shouldn't be getting a cookie reply!
@@ -782,7 +1024,8 @@ bool wireguard_create_handshake_initiation(struct wireguard_device *device, stru
 	uint8_t dh_calculation[WIREGUARD_PUBLIC_KEY_LEN];
 	bool result = false;
 
-	struct wireguard_handshake *handshake = &peer->handshake;
+	struct wireguard_peer_identity *identity = peer_identity(device, peer);
+	struct wireguard_handshake *handshake = &identity->handshake;
 
 	memset(dst, 0, sizeof(struct message_handshake_initiation));
 
@@ -793,7 +1036,7 @@ bool wireguard_create_handshake_initiation(struct wireguard_device *device, stru
 	memcpy(handshake->hash, identifier_hash, WIREGUARD_HASH_LEN);
 
 	// Hi := Hash(Hi || Spubr)
-	wireguard_mix_hash(handshake->hash, peer->public_key, WIREGUARD_PUBLIC_KEY_LEN);
+	wireguard_mix_hash(handshake->hash, identity->public_key, WIREGUARD_PUBLIC_KEY_LEN);
 
 	// (Eprivi, Epubi) := DH-Generate()
 	wireguard_generate_private_key(handshake->ephemeral_private);
@@ -809,7 +1052,7 @@ bool wireguard_create_handshake_initiation(struct wireguard_device *device, stru
 		wireguard_mix_hash(handshake->hash, dst->ephemeral, WIREGUARD_PUBLIC_KEY_LEN);
 
 		// Calculate DH(Eprivi,Spubr)
-		wireguard_x25519(dh_calculation, handshake->ephemeral_private, peer->public_key);
+		wireguard_x25519(dh_calculation, handshake->ephemeral_private, identity->public_key);
 		if (!crypto_equal(dh_calculation, zero_key, WIREGUARD_PUBLIC_KEY_LEN)) {
 
 			// (Ci,k) := Kdf2(Ci,DH(Eprivi,Spubr))
@@ -823,7 +1066,7 @@ bool wireguard_create_handshake_initiation(struct wireguard_device *device, stru
 
 			// (Ci,k) := Kdf2(Ci,DH(Sprivi,Spubr))
 			// note DH(Sprivi,Spubr) is precomputed per peer
-			wireguard_kdf2(handshake->chaining_key, key, handshake->chaining_key, peer->public_key_dh, WIREGUARD_PUBLIC_KEY_LEN);
+			wireguard_kdf2(handshake->chaining_key, key, handshake->chaining_key, identity->public_key_dh, WIREGUARD_PUBLIC_KEY_LEN);
 
 			// msg.timestamp := AEAD(k, 0, Timestamp(), Hi)
 			wireguard_tai64n_now(timestamp);
@@ -833,13 +1076,17 @@ bool wireguard_create_handshake_initiation(struct wireguard_device *device, stru
 			wireguard_mix_hash(handshake->hash, dst->enc_timestamp, sizeof(dst->enc_timestamp));
 
 			dst->type = MESSAGE_HANDSHAKE_INITIATION;
-			dst->sender = wireguard_generate_unique_index(device);
+			dst->sender = wireguard_generate_unique_index(device, peer);
 
-			handshake->valid = true;
-			handshake->initiator = true;
-			handshake->local_index = dst->sender;
+			if (dst->sender != 0) {
+				// A previous handshake that never became a session gives up its index
+				index_table_release(device, handshake->local_index);
+				handshake->valid = true;
+				handshake->initiator = true;
+				handshake->local_index = dst->sender;
 
-			result = true;
+				result = true;
+			}
 		}
 	}
 
@@ -847,15 +1094,15 @@ bool wireguard_create_handshake_initiation(struct wireguard_device *device, stru
 		// 5.4.4 Cookie MACs
 		// msg.mac1 := Mac(Hash(Label-Mac1 || Spubm' ), msgA)
 		// The value Hash(Label-Mac1 || Spubm' ) above can be pre-computed
-		wireguard_mac(dst->mac1, dst, (sizeof(struct message_handshake_initiation)-(2*WIREGUARD_COOKIE_LEN)), peer->label_mac1_key, WIREGUARD_SESSION_KEY_LEN);
+		wireguard_mac(dst->mac1, dst, (sizeof(struct message_handshake_initiation)-(2*WIREGUARD_COOKIE_LEN)), identity->label_mac1_key, WIREGUARD_SESSION_KEY_LEN);
 
 		// if Lm = E or Lm ≥ 120:
-		if ((peer->cookie_millis == 0) || wireguard_expired(peer->cookie_millis, COOKIE_SECRET_MAX_AGE)) {
+		if ((identity->cookie_millis == 0) || wireguard_expired(identity->cookie_millis, COOKIE_SECRET_MAX_AGE)) {
 			// msg.mac2 := 0
 			crypto_zero(dst->mac2, WIREGUARD_COOKIE_LEN);
 		} else {
 			// msg.mac2 := Mac(Lm, msgB)
-			wireguard_mac(dst->mac2, dst, (sizeof(struct message_handshake_initiation)-(WIREGUARD_COOKIE_LEN)), peer->cookie, WIREGUARD_COOKIE_LEN);
+			wireguard_mac(dst->mac2, dst, (sizeof(struct message_handshake_initiation)-(WIREGUARD_COOKIE_LEN)), identity->cookie, WIREGUARD_COOKIE_LEN);
 
 		}
 	}
@@ -867,7 +1114,8 @@ bool wireguard_create_handshake_initiation(struct wireguard_device *device, stru
 
 bool wireguard_create_handshake_response(struct wireguard_device *device, struct wireguard_peer *peer,
 	struct message_handshake_response *dst) {
-	struct wireguard_handshake *handshake = &peer->handshake;
+	struct wireguard_peer_identity *identity = peer_identity(device, peer);
+	struct wireguard_handshake *handshake = &identity->handshake;
 	uint8_t key[WIREGUARD_SESSION_KEY_LEN];
 	uint8_t dh_calculation[WIREGUARD_PUBLIC_KEY_LEN];
 	uint8_t tau[WIREGUARD_HASH_LEN];
@@ -898,12 +1146,12 @@ bool wireguard_create_handshake_response(struct wireguard_device *device, struct
 
 				// Cr := Kdf1(Cr, DH(Eprivr, Spubi))
 				// Calculate DH(Eprivi,Spubr)
-				wireguard_x25519(dh_calculation, handshake->ephemeral_private, peer->public_key);
+				wireguard_x25519(dh_calculation, handshake->ephemeral_private, identity->public_key);
 				if (!crypto_equal(dh_calculation, zero_key, WIREGUARD_PUBLIC_KEY_LEN)) {
 					wireguard_kdf1(handshake->chaining_key, handshake->chaining_key, dh_calculation, WIREGUARD_PUBLIC_KEY_LEN);
 
 					// (Cr, t, k) := Kdf3(Cr, Q)
-					wireguard_kdf3(handshake->chaining_key, tau, key, handshake->chaining_key, peer->preshared_key, WIREGUARD_SESSION_KEY_LEN);
+					wireguard_kdf3(handshake->chaining_key, tau, key, handshake->chaining_key, identity->preshared_key, WIREGUARD_SESSION_KEY_LEN);
 
 					// Hr := Hash(Hr | t)
 					wireguard_mix_hash(handshake->hash, tau, WIREGUARD_HASH_LEN);
@@ -916,11 +1164,14 @@ bool wireguard_create_handshake_response(struct wireguard_device *device, struct
 
 					dst->type = MESSAGE_HANDSHAKE_RESPONSE;
 					dst->receiver = handshake->remote_index;
-					dst->sender = wireguard_generate_unique_index(device);
-					// Update handshake object too
-					handshake->local_index = dst->sender;
+					dst->sender = wireguard_generate_unique_index(device, peer);
+					if (dst->sender != 0) {
+						// Update handshake object too
+						index_table_release(device, handshake->local_index);
+						handshake->local_index = dst->sender;
 
-					result = true;
+						result = true;
+					}
 				} else {
 					// Bad x25519
 				}
@@ -936,15 +1187,15 @@ bool wireguard_create_handshake_response(struct wireguard_device *device, struct
 		// 5.4.4 Cookie MACs
 		// msg.mac1 := Mac(Hash(Label-Mac1 || Spubm' ), msgA)
 		// The value Hash(Label-Mac1 || Spubm' ) above can be pre-computed
-		wireguard_mac(dst->mac1, dst, (sizeof(struct message_handshake_response)-(2*WIREGUARD_COOKIE_LEN)), peer->label_mac1_key, WIREGUARD_SESSION_KEY_LEN);
+		wireguard_mac(dst->mac1, dst, (sizeof(struct message_handshake_response)-(2*WIREGUARD_COOKIE_LEN)), identity->label_mac1_key, WIREGUARD_SESSION_KEY_LEN);
 
 		// if Lm = E or Lm ≥ 120:
-		if ((peer->cookie_millis == 0) || wireguard_expired(peer->cookie_millis, COOKIE_SECRET_MAX_AGE)) {
+		if ((identity->cookie_millis == 0) || wireguard_expired(identity->cookie_millis, COOKIE_SECRET_MAX_AGE)) {
 			// msg.mac2 := 0
 			crypto_zero(dst->mac2, WIREGUARD_COOKIE_LEN);
 		} else {
 			// msg.mac2 := Mac(Lm, msgB)
-			wireguard_mac(dst->mac2, dst, (sizeof(struct message_handshake_response)-(WIREGUARD_COOKIE_LEN)), peer->cookie, WIREGUARD_COOKIE_LEN);
+			wireguard_mac(dst->mac2, dst, (sizeof(struct message_handshake_response)-(WIREGUARD_COOKIE_LEN)), identity->cookie, WIREGUARD_COOKIE_LEN);
 		}
 	}
 
@@ -954,49 +1205,58 @@ bool wireguard_create_handshake_response(struct wireguard_device *device, struct
 	return result;
 }
 
-void wireguard_create_cookie_reply(struct wireguard_device *device, struct message_cookie_reply *dst,
+bool wireguard_create_cookie_reply(struct wireguard_device *device, struct message_cookie_reply *dst,
 	const uint8_t *mac1, uint32_t index, uint8_t *source_addr_port, size_t source_length) {
 	uint8_t cookie[WIREGUARD_COOKIE_LEN];
 
 	crypto_zero(dst, sizeof(struct message_cookie_reply));
 	dst->type = MESSAGE_COOKIE_REPLY;
 	dst->receiver = index;
-	wireguard_random_bytes(dst->nonce, COOKIE_NONCE_LEN);
+	// The nonce must never repeat under the same key
+	if (!wireguard_crypto_random(dst->nonce, COOKIE_NONCE_LEN)) {
+		return false;
+	}
 	generate_peer_cookie(device, cookie, source_addr_port, source_length);
 	wireguard_xaead_encrypt(dst->enc_cookie, cookie, WIREGUARD_COOKIE_LEN, mac1,
 		WIREGUARD_COOKIE_LEN, dst->nonce, device->label_cookie_key);
+	crypto_zero(cookie, sizeof(cookie));
+	return true;
 }
 
 bool wireguard_peer_init(struct wireguard_device *device, struct wireguard_peer *peer,
 	const uint8_t *public_key, const uint8_t *preshared_key) {
+	struct wireguard_peer_identity *identity = peer_identity(device, peer);
+
 	// Clear out structure
 	memset(peer, 0, sizeof(struct wireguard_peer));
+	memset(identity, 0, sizeof(struct wireguard_peer_identity));
 
 	if (device->valid) {
 		// Copy across the public key into our peer structure
-		memcpy(peer->public_key, public_key, WIREGUARD_PUBLIC_KEY_LEN);
+		memcpy(identity->public_key, public_key, WIREGUARD_PUBLIC_KEY_LEN);
 		if (preshared_key) {
-			memcpy(peer->preshared_key, preshared_key, WIREGUARD_SESSION_KEY_LEN);
+			memcpy(identity->preshared_key, preshared_key, WIREGUARD_SESSION_KEY_LEN);
 		} else {
-			crypto_zero(peer->preshared_key, WIREGUARD_SESSION_KEY_LEN);
+			crypto_zero(identity->preshared_key, WIREGUARD_SESSION_KEY_LEN);
 		}
 
-		if (wireguard_x25519(peer->public_key_dh, device->private_key, peer->public_key) == 0) {
+		if (wireguard_x25519(identity->public_key_dh, device->private_key, identity->public_key) == 0) {
 			// Zero out handshake
-			memset(&peer->handshake, 0, sizeof(struct wireguard_handshake));
-			peer->handshake.valid = false;
+			memset(&identity->handshake, 0, sizeof(struct wireguard_handshake));
+			identity->handshake.valid = false;
 
 			// Zero out any cookie info - we haven't received one yet
-			peer->cookie_millis = 0;
-			memset(&peer->cookie, 0, WIREGUARD_COOKIE_LEN);
+			identity->cookie_millis = 0;
+			memset(&identity->cookie, 0, WIREGUARD_COOKIE_LEN);
 
 			// Precompute keys to deal with mac1/2 calculation
-			wireguard_mac_key(peer->label_mac1_key, peer->public_key, LABEL_MAC1, sizeof(LABEL_MAC1));
-			wireguard_mac_key(peer->label_cookie_key, peer->public_key, LABEL_COOKIE, sizeof(LABEL_COOKIE));
+			wireguard_mac_key(identity->label_mac1_key, identity->public_key, LABEL_MAC1, sizeof(LABEL_MAC1));
+			wireguard_mac_key(identity->label_cookie_key, identity->public_key, LABEL_COOKIE, sizeof(LABEL_COOKIE));
 
 			peer->valid = true;
+			peer_table_insert(device, device->pubkey_table, WIREGUARD_PUBKEY_TABLE_SIZE, U8TO32_LITTLE(identity->public_key), peer);
 		} else {
-			crypto_zero(peer->public_key_dh, WIREGUARD_PUBLIC_KEY_LEN);
+			crypto_zero(identity->public_key_dh, WIREGUARD_PUBLIC_KEY_LEN);
 		}
 	}
 	return peer->valid;
@@ -1007,9 +1267,10 @@ bool wireguard_device_init(struct wireguard_device *device, const uint8_t *priva
 	memcpy(device->private_key, private_key, WIREGUARD_PRIVATE_KEY_LEN);
 	// Ensure private key is correctly "clamped"
 	wireguard_clamp_private_key(device->private_key);
-	device->valid = wireguard_generate_public_key(device->public_key, private_key);
+	device->valid = wireguard_crypto_init() && wireguard_generate_public_key(device->public_key, private_key) &&
+		wireguard_crypto_random(&device->table_seed, sizeof(device->table_seed)) && generate_cookie_secret(device);
 	if (device->valid) {
-		generate_cookie_secret(device);
+		wg_allowedips_init(&device->allowed_ips);
 		// 5.4.4 Cookie MACs - The value Hash(Label-Mac1 || Spubm' ) above can be pre-computed.
 		wireguard_mac_key(device->label_mac1_key, device->public_key, LABEL_MAC1, sizeof(LABEL_MAC1));
 		// 5.4.7 Under Load: Cookie Reply Message - The value Hash(Label-Cookie || Spubm) above can be pre-computed.
@@ -1026,6 +1287,118 @@ void wireguard_encrypt_packet(uint8_t *dst, const uint8_t *src, size_t src_len,
 	keypair->sending_counter++;
 }
 
+#if defined(CONFIG_WIREGUARD_KEYSTREAM_PREFETCH)
+static bool keystream_slot_matches(const struct keystream_slot *slot, uint32_t local_index, uint64_t counter) {
+	return slot->ready && (slot->local_index == local_index) && (slot->counter == counter);
+}
+
+void wireguard_keystream_prefetch(struct wireguard_device *device, struct wireguard_peer *peer, struct wireguard_keypair *keypair) {
+	struct keystream_ring *ring = keystream_ring_get(device, peer);
+	struct keystream_slot *slot;
+	uint8_t key[WIREGUARD_SESSION_KEY_LEN];
+	k_spinlock_key_t lock_key;
+	uint32_t generation;
+	uint32_t local_index;
+	uint64_t counter;
+	uint64_t x;
+	bool valid;
+	bool fill;
+
+	lock_key = k_spin_lock(&ring->lock);
+	generation = ring->generation;
+	counter = keypair->sending_counter;
+	k_spin_unlock(&ring->lock, lock_key);
+
+	// Only good if the keypair was not being rewritten while it was read
+	valid = peer->valid && keypair->valid && keypair->sending_valid;
+	local_index = keypair->local_index;
+	memcpy(key, keypair->sending_key, sizeof(key));
+	lock_key = k_spin_lock(&ring->lock);
+	valid = valid && ((generation & 1) == 0) && (ring->generation == generation);
+	k_spin_unlock(&ring->lock, lock_key);
+
+	for (x = counter; valid && (x < counter + CONFIG_WIREGUARD_KEYSTREAM_PREFETCH_DEPTH) && (x < REJECT_AFTER_MESSAGES); x++) {
+		slot = &ring->slots[x % CONFIG_WIREGUARD_KEYSTREAM_PREFETCH_DEPTH];
+		fill = false;
+		lock_key = k_spin_lock(&ring->lock);
+		if ((ring->generation != generation) || (keypair->sending_counter > x)) {
+			valid = false;
+		} else if (!keystream_slot_matches(slot, local_index, x)) {
+			// Claim the slot - it is written without the lock and only used once it is ready
+			slot->ready = false;
+			slot->local_index = local_index;
+			slot->counter = x;
+			fill = true;
+		}
+		k_spin_unlock(&ring->lock, lock_key);
+		if (!fill) {
+			continue;
+		}
+
+		chacha20poly1305_keystream(slot->stream, CONFIG_WIREGUARD_KEYSTREAM_PREFETCH_BLOCKS, x, key);
+
+		// Publish unless the keypairs changed or the sender already passed this counter while we were working
+		lock_key = k_spin_lock(&ring->lock);
+		if ((ring->generation == generation) && (keypair->sending_counter <= x) &&
+			(slot->local_index == local_index) && (slot->counter == x)) {
+			slot->ready = true;
+		} else {
+			crypto_zero(slot, sizeof(struct keystream_slot));
+			valid = false;
+		}
+		k_spin_unlock(&ring->lock, lock_key);
+	}
+
+	crypto_zero(key, sizeof(key));
+}
+
+void wireguard_keystream_encrypt(struct wireguard_device *device, struct wireguard_peer *peer, uint8_t *dst, const uint8_t *src, size_t src_len,
+	struct wireguard_keypair *keypair) {
+	struct keystream_ring *ring = keystream_ring_get(device, peer);
+	struct keystream_slot *slot;
+	k_spinlock_key_t key;
+	uint64_t counter;
+	bool done = false;
+
+	// XOR and MAC happen under the lock, so the stream cannot be replaced or wiped halfway through
+	key = k_spin_lock(&ring->lock);
+	counter = keypair->sending_counter;
+	slot = &ring->slots[counter % CONFIG_WIREGUARD_KEYSTREAM_PREFETCH_DEPTH];
+	if (keystream_slot_matches(slot, keypair->local_index, counter)) {
+		if (src_len <= KEYSTREAM_MAX_TEXT) {
+			chacha20poly1305_encrypt_keystream(dst, src, src_len, NULL, 0, slot->stream);
+			done = true;
+		}
+		// Used keystream XORed with the ciphertext gives back the plaintext, so it must not stay around
+		crypto_zero(slot, sizeof(struct keystream_slot));
+	}
+	// A prefetch still working on this counter sees it is taken and drops its result
+	keypair->sending_counter = counter + 1;
+	k_spin_unlock(&ring->lock, key);
+
+	if (!done) {
+		wireguard_aead_encrypt(dst, src, src_len, NULL, 0, counter, keypair->sending_key);
+	}
+}
+
+size_t wireguard_keystream_held(struct wireguard_device *device, struct wireguard_peer *peer) {
+	struct keystream_ring *ring = keystream_ring_get(device, peer);
+	k_spinlock_key_t key;
+	size_t result = 0;
+	size_t x;
+
+	key = k_spin_lock(&ring->lock);
+	for (x = 0; x < CONFIG_WIREGUARD_KEYSTREAM_PREFETCH_DEPTH; x++) {
+		// Wiping clears the whole slot, local_index included
+		if (ring->slots[x].local_index != 0) {
+			result++;
+		}
+	}
+	k_spin_unlock(&ring->lock, key);
+	return result;
+}
+#endif
+
 bool wireguard_decrypt_packet(uint8_t *dst, const uint8_t *src, size_t src_len, uint64_t counter,
 	struct wireguard_keypair *keypair) {
 	return wireguard_aead_decrypt(dst, src, src_len, NULL, 0, counter, keypair->receiving_key);
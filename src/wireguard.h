@@ -40,6 +40,7 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stddef.h>
 
 // Note: these are only required for definitions in device/peer for netif, udp_pcb, ip_addr_t and u16_t
 #include "lwip_h/arch.h"
@@ -47,6 +48,8 @@
 
 // Platform-specific functions that need to be implemented per-platform
 #include "wireguard-platform.h"
+#include "crypto.h"
+#include "wg_allowedips.h"
 
 // tai64n contains 64-bit seconds and 32-bit nano offset (12 bytes)
 #define WIREGUARD_TAI64N_LEN		(12)
@@ -73,26 +76,35 @@
 #define REKEY_TIMEOUT				(5)
 #define KEEPALIVE_TIMEOUT			(10)
 
+// Receive replay window, kept as a ring of 32 bit words as in RFC 6479 - it slides a word at a time, so one word of
+// the ring is always being refilled and the window guaranteed to be available is one word smaller than the ring
+#define WIREGUARD_REPLAY_WORDS		(CONFIG_WIREGUARD_REPLAY_WINDOW / 32)
+#define WIREGUARD_REPLAY_WINDOW		(CONFIG_WIREGUARD_REPLAY_WINDOW - 32)
+#if (WIREGUARD_REPLAY_WORDS < 2) || ((WIREGUARD_REPLAY_WORDS & (WIREGUARD_REPLAY_WORDS - 1)) != 0)
+#error "CONFIG_WIREGUARD_REPLAY_WINDOW must be a power of two of at least 64"
+#endif
+
+// Fields the timer and the keypair selection read come first and stay within 64 bytes, away from the keys and the replay bitmap
 struct wireguard_keypair {
 	bool valid;
 	bool initiator; // Did we initiate this session (send the initiation packet rather than sending the response packet)
-	uint32_t keypair_millis;
-
-	uint8_t sending_key[WIREGUARD_SESSION_KEY_LEN];
 	bool sending_valid;
-	uint64_t sending_counter;
-
-	uint8_t receiving_key[WIREGUARD_SESSION_KEY_LEN];
 	bool receiving_valid;
+	uint32_t keypair_millis;
 
 	uint32_t last_tx;
 	uint32_t last_rx;
 
-	uint32_t replay_bitmap;
-	uint64_t replay_counter;
-
 	uint32_t local_index; // This is the index we generated for our end
 	uint32_t remote_index; // This is the index on the other end
+
+	uint64_t sending_counter;
+	uint64_t replay_counter; // Highest counter received + 1, 0 before the first packet
+
+	uint8_t sending_key[WIREGUARD_SESSION_KEY_LEN];
+	uint8_t receiving_key[WIREGUARD_SESSION_KEY_LEN];
+
+	uint32_t replay_bitmap[WIREGUARD_REPLAY_WORDS];
 };
 
 struct wireguard_handshake {
@@ -106,26 +118,38 @@ struct wireguard_handshake {
 	uint8_t chaining_key[WIREGUARD_HASH_LEN];
 };
 
-struct wireguard_allowed_ip {
-	bool valid;
-	ip_addr_t ip;
-	ip_addr_t mask;
-};
-
+// Session state of a peer - everything the data path and the timer use. The identity and handshake material lives in
+// a separate struct wireguard_peer_identity, so walking the peers does not drag it through the cache.
 struct wireguard_peer {
 	bool valid; // Is this peer initialised?
 	bool active; // Should we be actively trying to connect?
+	// We set this flag on RX/TX of packets if we think that we should initiate a new handshake
+	bool send_handshake;
+	// keep-alive interval in seconds, 0 is disable
+	uint16_t keepalive_interval;
+
+	// last_tx and last_rx of data packets
+	uint32_t last_tx;
+	uint32_t last_rx;
+	// The last time we sent an initiation message to this peer
+	uint32_t last_initiation_tx;
 
-	// This is the configured IP of the peer (endpoint)
-	ip_addr_t connect_ip;
-	u16_t connect_port;
 	// This is the latest received IP/port
 	ip_addr_t ip;
 	u16_t port;
-	// keep-alive interval in seconds, 0 is disable
-	uint16_t keepalive_interval;
 
-	struct wireguard_allowed_ip allowed_source_ips[WIREGUARD_MAX_SRC_IPS];
+	// Session keypairs
+	struct wireguard_keypair curr_keypair;
+	struct wireguard_keypair prev_keypair;
+	struct wireguard_keypair next_keypair;
+};
+
+// Identity and handshake state of a peer - only used while handshaking. It sits at the same index in
+// wireguard_device.peer_identities as the peer in wireguard_device.peers, see peer_identity().
+struct wireguard_peer_identity {
+	// This is the configured IP of the peer (endpoint)
+	ip_addr_t connect_ip;
+	u16_t connect_port;
 
 	uint8_t public_key[WIREGUARD_PUBLIC_KEY_LEN];
 	uint8_t preshared_key[WIREGUARD_SESSION_KEY_LEN];
@@ -133,13 +157,14 @@ struct wireguard_peer {
 	// Precomputed DH(Sprivi,Spubr) with device private key, and peer public key
 	uint8_t public_key_dh[WIREGUARD_PUBLIC_KEY_LEN];
 
-	// Session keypairs
-	struct wireguard_keypair curr_keypair;
-	struct wireguard_keypair prev_keypair;
-	struct wireguard_keypair next_keypair;
+	// Precomputed keys for use in mac validation
+	uint8_t label_cookie_key[WIREGUARD_SESSION_KEY_LEN];
+	uint8_t label_mac1_key[WIREGUARD_SESSION_KEY_LEN];
 
 	// 5.1 Silence is a Virtue: The responder keeps track of the greatest timestamp received per peer
 	uint8_t greatest_timestamp[WIREGUARD_TAI64N_LEN];
+	// The last time we received a valid initiation message
+	uint32_t last_initiation_rx;
 
 	// The active handshake that is happening
 	struct wireguard_handshake handshake;
@@ -151,22 +176,38 @@ struct wireguard_peer {
 	// The latest mac1 we sent with initiation
 	bool handshake_mac1_valid;
 	uint8_t handshake_mac1[WIREGUARD_COOKIE_LEN];
+};
 
-	// Precomputed keys for use in mac validation
-	uint8_t label_cookie_key[WIREGUARD_SESSION_KEY_LEN];
-	uint8_t label_mac1_key[WIREGUARD_SESSION_KEY_LEN];
-
-	// The last time we received a valid initiation message
-	uint32_t last_initiation_rx;
-	// The last time we sent an initiation message to this peer
-	uint32_t last_initiation_tx;
-
-	// last_tx and last_rx of data packets
-	uint32_t last_tx;
-	uint32_t last_rx;
-
-	// We set this flag on RX/TX of packets if we think that we should initiate a new handshake
-	bool send_handshake;
+// Size budgets - the per-keypair fields checked on every timer tick and the peer's own fields each fit one 64 byte
+// cache line, so the timer state of a peer starting on a line boundary is 4 lines (8 before the split). Packed in
+// wireguard_device.peers, where records straddle lines, the fields wireguardif_tmr() reads when nothing is due average
+// 4.12 lines per peer (5.88 before). Both are distinct-line counts, not measured misses: bench_peer_layout reports them
+// with cold and warm timings in place of hardware counters. A keypair is 104 bytes plus the replay bitmap (232 with the
+// default window, 248 before the split), a session record 48 bytes plus three keypairs (744, was 1176 with the identity
+// in it), and the cold half of a peer stays within six lines.
+#define WIREGUARD_KEYPAIR_BUDGET	(104 + (WIREGUARD_REPLAY_WORDS * 4))
+_Static_assert(offsetof(struct wireguard_keypair, sending_key) <= 64, "keypair header does not fit a cache line");
+_Static_assert(offsetof(struct wireguard_peer, curr_keypair) <= 64, "peer session fields do not fit a cache line");
+_Static_assert(sizeof(struct wireguard_keypair) <= WIREGUARD_KEYPAIR_BUDGET, "keypair over budget");
+_Static_assert(sizeof(struct wireguard_peer) <= 48 + (3 * WIREGUARD_KEYPAIR_BUDGET), "peer session record over budget");
+_Static_assert(sizeof(struct wireguard_peer_identity) <= 384, "peer identity record over budget");
+
+// Index of a peer in wireguard_device.peers, WIREGUARD_INVALID_PEER if there is none
+#define WIREGUARD_INVALID_PEER		(0xFFFF)
+
+// Smallest power of two >= x, for sizing the lookup tables below
+#define WIREGUARD_POW2(x) \
+	((((x) - 1) | (((x) - 1) >> 1) | (((x) - 1) >> 2) | (((x) - 1) >> 4) | (((x) - 1) >> 8) | (((x) - 1) >> 16)) + 1)
+
+// Each peer holds at most four session indexes (handshake and three keypairs) plus one briefly while a handshake index is
+// replaced, so the index table never gets more than 5/8 full and a probe always ends on an empty slot
+#define WIREGUARD_INDEX_TABLE_SIZE	WIREGUARD_POW2(WIREGUARD_MAX_PEERS * 8)
+#define WIREGUARD_PUBKEY_TABLE_SIZE	WIREGUARD_POW2(WIREGUARD_MAX_PEERS * 2)
+
+// Open-addressing (linear probing) table entry mapping a 32 bit key to a peer
+struct wireguard_peer_slot {
+	uint32_t key; // Session index, or the first 4 bytes of the public key
+	uint16_t peer; // Index into peers[] + 1, 0 while the slot is empty
 };
 
 struct wireguard_device {
@@ -183,8 +224,18 @@ struct wireguard_device {
  	uint8_t label_cookie_key[WIREGUARD_SESSION_KEY_LEN];
 	uint8_t label_mac1_key[WIREGUARD_SESSION_KEY_LEN];
 
-	// List of peers associated with this device
+	// List of peers associated with this device - session state, and identity/handshake state at the same index
  	struct wireguard_peer peers[WIREGUARD_MAX_PEERS];
+	struct wireguard_peer_identity peer_identities[WIREGUARD_MAX_PEERS];
+
+	// Lookup tables over peers - an entry is only a hint, the peer itself is checked before it is returned.
+	// The index table holds exactly the session indexes in use: they are reserved there and released by their owner.
+	uint32_t table_seed;
+	struct wireguard_peer_slot index_table[WIREGUARD_INDEX_TABLE_SIZE];
+	struct wireguard_peer_slot pubkey_table[WIREGUARD_PUBKEY_TABLE_SIZE];
+
+	// Allowed IPs of all peers, for routing outbound packets and checking the source of inbound ones
+	struct wg_allowedips allowed_ips;
 
 	bool valid;
 };
@@ -245,19 +296,25 @@ bool wireguard_device_init(struct wireguard_device *device, const uint8_t *priva
 bool wireguard_peer_init(struct wireguard_device *device, struct wireguard_peer *peer, const uint8_t *public_key, const uint8_t *preshared_key);
 
 struct wireguard_peer *peer_alloc(struct wireguard_device *device);
-uint8_t wireguard_peer_index(struct wireguard_device *device, struct wireguard_peer *peer);
+// Wipe a peer and take it out of the lookup tables
+void peer_free(struct wireguard_device *device, struct wireguard_peer *peer);
+struct wireguard_peer_identity *peer_identity(struct wireguard_device *device, struct wireguard_peer *peer);
+uint16_t wireguard_peer_index(struct wireguard_device *device, struct wireguard_peer *peer);
 struct wireguard_peer *peer_lookup_by_pubkey(struct wireguard_device *device, uint8_t *public_key);
-struct wireguard_peer *peer_lookup_by_peer_index(struct wireguard_device *device, uint8_t peer_index);
+struct wireguard_peer *peer_lookup_by_peer_index(struct wireguard_device *device, uint16_t peer_index);
 struct wireguard_peer *peer_lookup_by_receiver(struct wireguard_device *device, uint32_t receiver);
 struct wireguard_peer *peer_lookup_by_handshake(struct wireguard_device *device, uint32_t receiver);
 
-void wireguard_start_session(struct wireguard_peer *peer, bool initiator);
+void wireguard_start_session(struct wireguard_device *device, struct wireguard_peer *peer, bool initiator);
 
-void keypair_update(struct wireguard_peer *peer, struct wireguard_keypair *received_keypair);
-void keypair_destroy(struct wireguard_keypair *keypair);
+void keypair_update(struct wireguard_device *device, struct wireguard_peer *peer, struct wireguard_keypair *received_keypair);
+void keypair_destroy(struct wireguard_device *device, struct wireguard_keypair *keypair);
 
 struct wireguard_keypair *get_peer_keypair_for_idx(struct wireguard_peer *peer, uint32_t idx);
-bool wireguard_check_replay(struct wireguard_keypair *keypair, uint64_t seq);
+// Replay window in two halves: the read-only check is cheap enough to run before a packet is authenticated or decrypted,
+// the commit marks the counter as seen once it has been - false if another packet with the same counter got there first
+bool wireguard_replay_would_accept(const struct wireguard_keypair *keypair, uint64_t seq);
+bool wireguard_replay_commit(struct wireguard_keypair *keypair, uint64_t seq);
 
 uint8_t wireguard_get_message_type(const uint8_t *data, size_t len);
 
@@ -267,7 +324,8 @@ bool wireguard_process_cookie_message(struct wireguard_device *device, struct wi
 
 bool wireguard_create_handshake_initiation(struct wireguard_device *device, struct wireguard_peer *peer, struct message_handshake_initiation *dst);
 bool wireguard_create_handshake_response(struct wireguard_device *device, struct wireguard_peer *peer, struct message_handshake_response *dst);
-void wireguard_create_cookie_reply(struct wireguard_device *device, struct message_cookie_reply *dst, const uint8_t *mac1, uint32_t index, uint8_t *source_addr_port, size_t source_length);
+// false if no random nonce could be had - nothing may be sent then
+bool wireguard_create_cookie_reply(struct wireguard_device *device, struct message_cookie_reply *dst, const uint8_t *mac1, uint32_t index, uint8_t *source_addr_port, size_t source_length);
 
 
 bool wireguard_check_mac1(struct wireguard_device *device, const uint8_t *data, size_t len, const uint8_t *mac1);
@@ -278,6 +336,23 @@ bool wireguard_expired(uint32_t created_millis, uint32_t valid_seconds);
 void wireguard_encrypt_packet(uint8_t *dst, const uint8_t *src, size_t src_len, struct wireguard_keypair *keypair);
 bool wireguard_decrypt_packet(uint8_t *dst, const uint8_t *src, size_t src_len, uint64_t counter, struct wireguard_keypair *keypair);
 
+// The HKDF of the Noise protocol: tau1..tau3 := KDF_n(chaining_key, data)
+void wireguard_kdf1(uint8_t *tau1, const uint8_t *chaining_key, const uint8_t *data, size_t data_len);
+void wireguard_kdf2(uint8_t *tau1, uint8_t *tau2, const uint8_t *chaining_key, const uint8_t *data, size_t data_len);
+void wireguard_kdf3(uint8_t *tau1, uint8_t *tau2, uint8_t *tau3, const uint8_t *chaining_key, const uint8_t *data, size_t data_len);
+
+
+#if defined(CONFIG_WIREGUARD_KEYSTREAM_PREFETCH)
+// Generate the keystream for the next sending counters of one of the peer's keypairs ahead of time, into a ring kept per peer.
+// Safe to run at low priority while the keypair is in use for sending: nothing is published if the peer's keypairs changed meanwhile.
+void wireguard_keystream_prefetch(struct wireguard_device *device, struct wireguard_peer *peer, struct wireguard_keypair *keypair);
+// wireguard_encrypt_packet() that only has to XOR and MAC when the keystream for the sending counter was prefetched
+void wireguard_keystream_encrypt(struct wireguard_device *device, struct wireguard_peer *peer, uint8_t *dst, const uint8_t *src, size_t src_len,
+	struct wireguard_keypair *keypair);
+// Slots of the peer's ring that hold keystream (ready or being generated) - 0 once every keypair it was for is gone
+size_t wireguard_keystream_held(struct wireguard_device *device, struct wireguard_peer *peer);
+#endif
+
 bool wireguard_base64_decode(const char *str, uint8_t *out, size_t *outlen);
 bool wireguard_base64_encode(const uint8_t *in, size_t inlen, char *out, size_t *outlen);
 
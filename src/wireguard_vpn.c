@@ -47,7 +47,7 @@
 #endif
 
 extern struct netif *wg_netif;
-static uint8_t wireguard_peer_index_local = WIREGUARDIF_INVALID_INDEX;
+static uint16_t wireguard_peer_index_local = WIREGUARDIF_INVALID_INDEX;
 
 int wireguard_setup(void) {
 	struct wireguardif_init_data wg;
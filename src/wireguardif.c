@@ -46,6 +46,7 @@ LOG_MODULE_DECLARE(wg, LOG_LEVEL_DBG);
 
 #include <string.h>
 #include <stdlib.h>
+#include <errno.h>
 
 #include <sys/time.h>
 #include <sys/types.h>
@@ -54,6 +55,7 @@ LOG_MODULE_DECLARE(wg, LOG_LEVEL_DBG);
 #include <assert.h>
 
 #include "wg_timer.h"
+#include "wg_trace.h"
 #include "lwip_h/arch.h"
 #include "lwip_h/ip4_addr.h"
 #include "lwip_h/ip_addr.h"
@@ -62,11 +64,14 @@ LOG_MODULE_DECLARE(wg, LOG_LEVEL_DBG);
 #include "crypto.h"
 
 #define WIREGUARDIF_TIMER_MSECS 4000
-#define pbuf_free(x) \
-	{\
-		free(x->payload); \
-		free(x); \
-	}
+
+// Transmit buffers: 16 byte message header + plaintext padded to 16 bytes + 16 byte auth tag
+#define WIREGUARDIF_TX_HEADER_LEN 16
+#define WIREGUARDIF_TX_BUF_SIZE \
+	(WIREGUARDIF_TX_HEADER_LEN + ROUND_UP(CONFIG_WIREGUARD_TX_MAX_PAYLOAD, 16) + WIREGUARD_AUTHTAG_LEN)
+
+K_MEM_SLAB_DEFINE_STATIC(wireguardif_tx_slab, WIREGUARDIF_TX_BUF_SIZE, CONFIG_WIREGUARD_TX_POOL_COUNT, 4);
+static atomic_t tx_pool_exhausted;
 
 enum net_verdict net_ipv4_input(struct net_pkt *pkt, bool is_loopback); /* from subsys/net/ip/ipv4.c */
 extern struct netif *wg_netif;
@@ -101,75 +106,140 @@ static void update_peer_addr(struct wireguard_peer *peer, const ip_addr_t *addr,
 	peer->port = port;
 }
 
-static struct wireguard_peer *peer_lookup_by_allowed_ip(struct wireguard_device *device, const ip_addr_t *ipaddr) {
-	struct wireguard_peer *result = NULL;
-	struct wireguard_peer *tmp;
+// The allowed IPs trie (and the route cache in front of it) is changed from the API while the data path reads it
+static struct k_spinlock allowed_ips_lock;
+
+#if defined(CONFIG_WIREGUARD_ROUTE_CACHE)
+#if (CONFIG_WIREGUARD_ROUTE_CACHE_SETS & (CONFIG_WIREGUARD_ROUTE_CACHE_SETS - 1)) != 0
+#error "CONFIG_WIREGUARD_ROUTE_CACHE_SETS must be a power of two"
+#endif
+
+// 2-way set associative cache of trie lookups, keyed by IPv4 address
+// An entry is only valid while its generation is the current one, so any change to the allowed IPs drops them all at once
+struct wireguardif_route_entry {
+	uint32_t generation;
+	uint32_t addr;
+	uint16_t peer_index;
+};
+
+struct wireguardif_route_set {
+	struct wireguardif_route_entry ways[2];
+	uint8_t victim; // Way to replace on the next miss - the one not used last
+};
+
+static struct wireguardif_route_set route_cache[CONFIG_WIREGUARD_ROUTE_CACHE_SETS];
+static uint32_t route_generation = 1;
+static atomic_t route_cache_hits;
+static atomic_t route_cache_misses;
+
+static struct wireguardif_route_set *route_cache_set(uint32_t addr) {
+	uint32_t h = addr * 0x9E3779B1;
+	return &route_cache[(h ^ (h >> 16)) & (CONFIG_WIREGUARD_ROUTE_CACHE_SETS - 1)];
+}
+
+// Called with allowed_ips_lock held
+static bool route_cache_get(uint32_t addr, uint16_t *peer_index) {
+	struct wireguardif_route_set *set = route_cache_set(addr);
 	int x;
-	int y;
-
-	for (x=0; (!result) && (x < WIREGUARD_MAX_PEERS); x++) {
-		tmp = &device->peers[x];
-		if (tmp->valid) {
-			for (y=0; y < WIREGUARD_MAX_SRC_IPS; y++) {
-				if ((tmp->allowed_source_ips[y].valid) &&
-					ip_addr_netcmp(ipaddr, &tmp->allowed_source_ips[y].ip,
-							ip_2_ip4(&tmp->allowed_source_ips[y].mask))) {
-					result = tmp;
-					break;
-				}
-			}
+
+	for (x=0; x < 2; x++) {
+		if ((set->ways[x].generation == route_generation) && (set->ways[x].addr == addr)) {
+			*peer_index = set->ways[x].peer_index;
+			set->victim = !x;
+			atomic_inc(&route_cache_hits);
+			return true;
 		}
 	}
+	atomic_inc(&route_cache_misses);
+	return false;
+}
+
+static void route_cache_put(uint32_t addr, uint16_t peer_index) {
+	struct wireguardif_route_set *set = route_cache_set(addr);
+	struct wireguardif_route_entry *entry = &set->ways[set->victim];
+
+	entry->addr = addr;
+	entry->peer_index = peer_index;
+	entry->generation = route_generation;
+	set->victim = !set->victim;
+}
+
+static void route_cache_invalidate(void) {
+	route_generation++;
+	if (route_generation == 0) {
+		// Wrapped - old entries could look current again
+		memset(route_cache, 0, sizeof(route_cache));
+		route_generation = 1;
+	}
+}
+#endif
+
+static struct wireguard_peer *peer_lookup_by_allowed_ip(struct wireguard_device *device, const ip_addr_t *ipaddr) {
+	struct wireguard_peer *result = NULL;
+	uint32_t addr = ntohl(ip_2_ip4(ipaddr)->addr);
+	k_spinlock_key_t key;
+	uint16_t peer_index;
+
+	key = k_spin_lock(&allowed_ips_lock);
+#if defined(CONFIG_WIREGUARD_ROUTE_CACHE)
+	if (!route_cache_get(addr, &peer_index)) {
+		peer_index = wg_allowedips_lookup(&device->allowed_ips, addr);
+		route_cache_put(addr, peer_index);
+	}
+#else
+	peer_index = wg_allowedips_lookup(&device->allowed_ips, addr);
+#endif
+	k_spin_unlock(&allowed_ips_lock, key);
+
+	if (peer_index != WG_ALLOWEDIPS_NONE) {
+		result = peer_lookup_by_peer_index(device, peer_index);
+	}
 	return result;
 }
 
+// Does ipaddr route to this peer - i.e. is the longest matching allowed IPs prefix one of the peer's
+static bool peer_allows_ip(struct wireguard_device *device, struct wireguard_peer *peer, const ip_addr_t *ipaddr) {
+	return peer_lookup_by_allowed_ip(device, ipaddr) == peer;
+}
+
 static bool wireguardif_can_send_initiation(struct wireguard_peer *peer) {
 	return ((peer->last_initiation_tx == 0) || (wireguard_expired(peer->last_initiation_tx, REKEY_TIMEOUT)));
 }
 
-static err_t wireguardif_peer_output(struct netif *netif, struct pbuf *q, struct wireguard_peer *peer) {
-	//struct wireguard_device *device = (struct wireguard_device *)netif->state;
-	// Send to last known port, not the connect port
-	//TODO: Support DSCP and ECN - lwip requires this set on PCB globally, not per packet
-
+static err_t wireguardif_sendto(struct netif *netif, struct pbuf *q, const ip_addr_t *ipaddr, u16_t port) {
 	struct sockaddr_in peeraddr;
 
 	memset(&peeraddr, 0, sizeof(peeraddr));
 	peeraddr.sin_family = AF_INET;
-	peeraddr.sin_addr.s_addr = peer->ip.u_addr.ip4.addr;
-	peeraddr.sin_port = htons(peer->port);
+	peeraddr.sin_addr.s_addr = ipaddr->u_addr.ip4.addr;
+	peeraddr.sin_port = htons(port);
 
-	return sendto(netif->sockfd, q->payload, q->len, 0, (struct sockaddr *)&peeraddr, sizeof(struct sockaddr_in));
+	if (sendto(netif->sockfd, q->payload, q->len, 0, (struct sockaddr *)&peeraddr, sizeof(struct sockaddr_in)) < 0) {
+		return ERR_IF;
+	}
+	return ERR_OK;
+}
+
+static err_t wireguardif_peer_output(struct netif *netif, struct pbuf *q, struct wireguard_peer *peer) {
+	//struct wireguard_device *device = (struct wireguard_device *)netif->state;
+	// Send to last known port, not the connect port
+	//TODO: Support DSCP and ECN - lwip requires this set on PCB globally, not per packet
+	return wireguardif_sendto(netif, q, &peer->ip, peer->port);
 }
 
 static err_t wireguardif_device_output(struct wireguard_device *device, struct pbuf *q,
 	const ip_addr_t *ipaddr, u16_t port) {
 	if (device->netif) {
-		struct sockaddr_in peeraddr;
-
-		memset(&peeraddr, 0, sizeof(peeraddr));
-		peeraddr.sin_family = AF_INET;
-		peeraddr.sin_addr.s_addr = ipaddr->u_addr.ip4.addr;
-		peeraddr.sin_port = htons(port);
-
-		return sendto(device->netif->sockfd, q->payload, q->len, 0, (struct sockaddr *)&peeraddr, sizeof(struct sockaddr_in));
+		return wireguardif_sendto(device->netif, q, ipaddr, port);
 	}
 	else
-		return 0;
+		return ERR_IF;
 }
 
-static err_t wireguardif_output_to_peer(struct netif *netif, struct pbuf *q,
-	const ip_addr_t *ipaddr __attribute__((unused)), struct wireguard_peer *peer) {
-	// The LWIP IP layer wants to send an IP packet out over the interface - we need to encrypt and send it to the peer
-	struct message_transport_data *hdr;
-	struct pbuf *pbuf;
-	err_t result;
-	size_t unpadded_len;
-	size_t padded_len;
-	size_t header_len = 16;
-	uint8_t *dst;
-	uint32_t now;
+// Pick the keypair to send with - ERR_CONN if there is no usable session
+static err_t wireguardif_select_tx_keypair(struct wireguard_device *device, struct wireguard_peer *peer, struct wireguard_keypair **out) {
 	struct wireguard_keypair *keypair = &peer->curr_keypair;
+	err_t result;
 
 	// Note: We may not be able to use the current keypair if we haven't received data, may need to resort to using previous keypair
 	if (keypair->valid && (!keypair->initiator) && (keypair->last_rx == 0)) {
@@ -180,97 +250,192 @@ static err_t wireguardif_output_to_peer(struct netif *netif, struct pbuf *q,
 
 		if (!wireguard_expired(keypair->keypair_millis, REJECT_AFTER_TIME) &&
 			(keypair->sending_counter < REJECT_AFTER_MESSAGES)) {
+			result = ERR_OK;
+		} else {
+			// key has expired...
+			keypair_destroy(device, keypair);
+			WG_TRACE_DBG("(%s) result = ERR_CONN(\"key has expired\")", __func__);
+			result = ERR_CONN;
+		}
+	} else {
+		// No valid keys!
+		WG_TRACE_DBG("(%s) result = ERR_CONN(\"No valid keys!\")\n", __func__);
+		result = ERR_CONN;
+	}
+	*out = keypair;
+	return result;
+}
 
-			// Calculate the outgoing packet size - round up to next 16 bytes, add 16 bytes for header
-			if (q) {
-				if (q->tot_len > 4096) {
-					LOG_DBG("Hmm, too big message(q->tot_len: %d) received. I'll be ignored.", q->tot_len);
-					return ERR_RTE;
-				}
-				// This is actual transport data
-				unpadded_len = q->tot_len;
+#if defined(CONFIG_WIREGUARD_KEYSTREAM_PREFETCH)
+// Keystream for the next sending counters is generated here, below every other application thread, so it only runs while the TX path is idle
+K_THREAD_STACK_DEFINE(wireguardif_prefetch_stack, CONFIG_WIREGUARD_KEYSTREAM_PREFETCH_STACK_SIZE);
+static struct k_work_q wireguardif_prefetch_q;
+static struct k_work wireguardif_prefetch_work;
+
+static void wireguardif_prefetch_handler(struct k_work *work) {
+	struct wireguard_device *device = (struct wireguard_device *)(wg_netif->state);
+	struct wireguard_peer *peer;
+	int x;
+	ARG_UNUSED(work);
+
+	// Reading the peers without a lock is fine here: wireguard_keystream_prefetch() drops its result if the peer was freed
+	// or its keypairs changed while it was working
+	for (x=0; x < WIREGUARD_MAX_PEERS; x++) {
+		peer = &device->peers[x];
+		if (peer->valid) {
+			// Same choice as wireguardif_select_tx_keypair() - the current keypair, unless we are the responder and have not heard back yet
+			if (peer->curr_keypair.valid && (!peer->curr_keypair.initiator) && (peer->curr_keypair.last_rx == 0)) {
+				wireguard_keystream_prefetch(device, peer, &peer->prev_keypair);
 			} else {
-				// This is a keep-alive
-				unpadded_len = 0;
+				wireguard_keystream_prefetch(device, peer, &peer->curr_keypair);
 			}
-			padded_len = (unpadded_len + 15) & 0xFFFFFFF0; // Round up to next 16 byte boundary
-
-			// The buffer needs to be allocated from "transport" pool to leave room for LwIP generated IP headers
-			// The IP packet consists of 16 byte header (struct message_transport_data), data padded upto 16 byte boundary + encrypted auth tag (16 bytes)
-			pbuf = (struct pbuf *)malloc(sizeof(struct pbuf));
-			if (pbuf) {
-				pbuf->payload = (void *)malloc(header_len + padded_len + WIREGUARD_AUTHTAG_LEN);
-				if (pbuf->payload == NULL) {
-					free(pbuf);
-					LOG_ERR("Cannot allocate an area for payload.");
-					result = ERR_MEM;
-					return result;
-				}
-				pbuf->len = header_len + padded_len + WIREGUARD_AUTHTAG_LEN;
-				pbuf->tot_len = pbuf->len;
-
-				// Note: allocating pbuf from RAM above guarantees that the pbuf is in one section and not chained
-				// - i.e payload points to the contiguous memory region
-				memset(pbuf->payload, 0, pbuf->tot_len);
+		}
+	}
+}
 
-				hdr = (struct message_transport_data *)pbuf->payload;
+// Top the rings up again - a no-op while a refill is already pending, and safe from the timer
+static void wireguardif_prefetch_kick(void) {
+	k_work_submit_to_queue(&wireguardif_prefetch_q, &wireguardif_prefetch_work);
+}
+#endif
 
-				hdr->type = MESSAGE_TRANSPORT_DATA;
-				hdr->receiver = keypair->remote_index;
-				// Alignment required... pbuf_alloc has probably aligned data, but want to be sure
-				U64TO8_LITTLE(hdr->counter, keypair->sending_counter);
+// Bookkeeping after a transport data message has been handed to the network
+static void wireguardif_tx_complete(struct wireguard_peer *peer, struct wireguard_keypair *keypair, err_t result) {
+	uint32_t now;
 
-				// Copy the encrypted (padded) data to the output packet - chacha20poly1305_encrypt() can encrypt data in-place which avoids call to mem_malloc
-				dst = &hdr->enc_packet[0];
-				if ((padded_len > 0) && q) {
-					// Note: before copying make sure we have inserted the IP header checksum
-					// The IP header checksum (and other checksums in the IP packet - e.g. ICMP) need to be calculated by LWIP before calling
-					// The Wireguard interface always needs checksums to be generated in software but the base netif may have some checksums generated by hardware
+	if (result == ERR_OK) {
+		now = wireguard_sys_now();
+		peer->last_tx = now;
+		keypair->last_tx = now;
+	}
 
-					// Copy pbuf to memory - handles case where pbuf is chained
-					memcpy(dst, q->payload, unpadded_len);
-				}
+	// Check to see if we should rekey
+	if (keypair->sending_counter >= REKEY_AFTER_MESSAGES) {
+		peer->send_handshake = true;
+	} else if (keypair->initiator && wireguard_expired(keypair->keypair_millis, REKEY_AFTER_TIME)) {
+		peer->send_handshake = true;
+	}
+#if defined(CONFIG_WIREGUARD_KEYSTREAM_PREFETCH)
+	wireguardif_prefetch_kick();
+#endif
+}
 
-				if (unpadded_len == 32) {  /* Oops! net ping 10.1.1.200 */
-					k_sleep(K_MSEC(100));
-				}
+static err_t wireguardif_output_to_peer(struct netif *netif, struct pbuf *q,
+	const ip_addr_t *ipaddr __attribute__((unused)), struct wireguard_peer *peer) {
+	// The LWIP IP layer wants to send an IP packet out over the interface - we need to encrypt and send it to the peer
+	struct wireguard_device *device = (struct wireguard_device *)netif->state;
+	struct message_transport_data *hdr;
+	struct pbuf pbuf;
+	void *buf;
+	err_t result;
+	size_t unpadded_len;
+	size_t padded_len;
+	uint8_t *dst;
+	struct wireguard_keypair *keypair;
+	struct pbuf *p;
+	size_t copied;
+	size_t len;
+	int alloc;
+
+	result = wireguardif_select_tx_keypair(device, peer, &keypair);
+	if (result != ERR_OK) {
+		return result;
+	}
 
-				// Then encrypt
-				wireguard_encrypt_packet(dst, dst, padded_len, keypair);
+	// Calculate the outgoing packet size - round up to next 16 bytes, add 16 bytes for header
+	if (q) {
+		if (q->tot_len > CONFIG_WIREGUARD_TX_MAX_PAYLOAD) {
+			WG_TRACE_DBG("Hmm, too big message(q->tot_len: %d) received. I'll be ignored.", q->tot_len);
+			return ERR_RTE;
+		}
+		// This is actual transport data
+		unpadded_len = q->tot_len;
+	} else {
+		// This is a keep-alive
+		unpadded_len = 0;
+	}
+	padded_len = (unpadded_len + 15) & 0xFFFFFFF0; // Round up to next 16 byte boundary
+
+	// The buffer comes from a fixed pool sized for the largest packet, so there is no heap traffic per packet
+	// The IP packet consists of 16 byte header (struct message_transport_data), data padded upto 16 byte boundary + encrypted auth tag (16 bytes)
+	alloc = k_mem_slab_alloc(&wireguardif_tx_slab, &buf, K_NO_WAIT);
+	if (alloc == 0) {
+		pbuf.payload = buf;
+		pbuf.len = WIREGUARDIF_TX_HEADER_LEN + padded_len + WIREGUARD_AUTHTAG_LEN;
+		pbuf.tot_len = pbuf.len;
+
+		hdr = (struct message_transport_data *)pbuf.payload;
+
+		hdr->type = MESSAGE_TRANSPORT_DATA;
+		memset(hdr->reserved, 0, sizeof(hdr->reserved));
+		hdr->receiver = keypair->remote_index;
+		// Alignment required... slab blocks are word aligned, but want to be sure
+		U64TO8_LITTLE(hdr->counter, keypair->sending_counter);
+
+		// Copy the encrypted (padded) data to the output packet - chacha20poly1305_encrypt() can encrypt data in-place which avoids call to mem_malloc
+		dst = &hdr->enc_packet[0];
+		if ((padded_len > 0) && q) {
+			// Note: before copying make sure we have inserted the IP header checksum
+			// The IP header checksum (and other checksums in the IP packet - e.g. ICMP) need to be calculated by LWIP before calling
+			// The Wireguard interface always needs checksums to be generated in software but the base netif may have some checksums generated by hardware
+
+			// Copy pbuf to memory - handles case where pbuf is chained
+			for (p = q, copied = 0; p && (copied < unpadded_len); p = p->next) {
+				len = MIN(p->len, unpadded_len - copied);
+				memcpy(dst + copied, p->payload, len);
+				copied += len;
+			}
+		}
+		// Only the padding has to be cleared, the rest is overwritten
+		memset(dst + unpadded_len, 0, padded_len - unpadded_len);
+
+		// Then encrypt
+#if defined(CONFIG_WIREGUARD_KEYSTREAM_PREFETCH)
+		wireguard_keystream_encrypt(device, peer, dst, dst, padded_len, keypair);
+#else
+		wireguard_encrypt_packet(dst, dst, padded_len, keypair);
+#endif
 
-				result = wireguardif_peer_output(netif, pbuf, peer);
+		result = wireguardif_peer_output(netif, &pbuf, peer);
 
-				if (result == ERR_OK) {
-					now = wireguard_sys_now();
-					peer->last_tx = now;
-					keypair->last_tx = now;
-				}
+		k_mem_slab_free(&wireguardif_tx_slab, buf);
 
-				pbuf_free(pbuf);
+		wireguardif_tx_complete(peer, keypair, result);
+	} else {
+		// Transmit pool is exhausted - drop the packet
+		atomic_inc(&tx_pool_exhausted);
+		result = ERR_MEM;
+	}
+	return result;
+}
 
-				// Check to see if we should rekey
-				if (keypair->sending_counter >= REKEY_AFTER_MESSAGES) {
-					peer->send_handshake = true;
-				} else if (keypair->initiator && wireguard_expired(keypair->keypair_millis, REKEY_AFTER_TIME)) {
-					peer->send_handshake = true;
-				}
+size_t wireguardif_pkt_to_pbuf(struct net_pkt *pkt, struct pbuf *chain, size_t max) {
+	struct net_buf *frag;
+	size_t count = 0;
+	size_t x;
 
-			} else {
-				// Failed to allocate memory
-				result = ERR_MEM;
-			}
-		} else {
-			// key has expired...
-			keypair_destroy(keypair);
-			LOG_DBG("(%s) result = ERR_CONN(\"key has expired\")", __func__);
-			result = ERR_CONN;
+	for (frag = pkt->buffer; frag; frag = frag->frags) {
+		if (frag->len == 0) {
+			continue;
 		}
-	} else {
-		// No valid keys!
-		LOG_DBG("(%s) result = ERR_CONN(\"No valid keys!\")\n", __func__);
-		result = ERR_CONN;
+		if (count == max) {
+			return 0;
+		}
+		chain[count].payload = frag->data;
+		chain[count].len = frag->len;
+		chain[count].next = NULL;
+		if (count > 0) {
+			chain[count - 1].next = &chain[count];
+		}
+		count++;
 	}
-	return result;
+	if (count > 0) {
+		chain[0].tot_len = net_pkt_get_len(pkt);
+		for (x=1; x < count; x++) {
+			chain[x].tot_len = chain[x - 1].tot_len - chain[x - 1].len;
+		}
+	}
+	return count;
 }
 
 // This is used as the output function for the Wireguard netif
@@ -293,6 +458,111 @@ err_t wireguardif_output(struct netif *netif, struct pbuf *q, const ip_addr_t *i
 	}
 }
 
+#if defined(CONFIG_WIREGUARD_TX_STAGING)
+// Plaintext packets waiting for a session with one peer
+struct wireguardif_staged_queue {
+	struct k_fifo fifo;
+	atomic_t count;
+	struct k_work handshake_work;
+	struct netif *netif;
+	struct wireguard_peer *peer;
+};
+
+static struct wireguardif_staged_queue wireguardif_staged_queues[WIREGUARD_MAX_PEERS];
+static atomic_t tx_staged;
+static atomic_t tx_staged_dropped;
+
+static err_t wireguard_start_handshake(struct netif *netif, struct wireguard_peer *peer);
+
+static struct wireguardif_staged_queue *wireguardif_staged_get(struct netif *netif, struct wireguard_peer *peer) {
+	struct wireguard_device *device = (struct wireguard_device *)netif->state;
+	return &wireguardif_staged_queues[peer - device->peers];
+}
+
+// Handshake requested by outbound data - runs on the system work queue, not in the caller's TX path
+static void wireguardif_staged_handshake_work(struct k_work *work) {
+	struct wireguardif_staged_queue *staged = CONTAINER_OF(work, struct wireguardif_staged_queue, handshake_work);
+
+	if (staged->peer->valid && wireguardif_can_send_initiation(staged->peer)) {
+		wireguard_start_handshake(staged->netif, staged->peer);
+	}
+}
+
+// Encrypt and send one staged packet, which is freed here unless the network stack took it
+static void wireguardif_staged_send(struct netif *netif, struct net_pkt *pkt, struct wireguard_peer *peer) {
+	struct pbuf q[WIREGUARDIF_MAX_PBUFS];
+
+	if (wireguardif_pkt_to_pbuf(pkt, q, ARRAY_SIZE(q))) {
+		wireguardif_output_to_peer(netif, q, NULL, peer);
+	}
+	net_pkt_unref(pkt);
+}
+
+// Send everything staged for the peer now that it has a keypair we can send with
+static void wireguardif_staged_flush(struct netif *netif, struct wireguard_peer *peer) {
+	struct wireguard_device *device = (struct wireguard_device *)netif->state;
+	struct wireguardif_staged_queue *staged = wireguardif_staged_get(netif, peer);
+	struct wireguard_keypair *keypair;
+	struct net_pkt *pkt;
+
+	if (k_fifo_is_empty(&staged->fifo) || (wireguardif_select_tx_keypair(device, peer, &keypair) != ERR_OK)) {
+		return;
+	}
+	while ((pkt = k_fifo_get(&staged->fifo, K_NO_WAIT)) != NULL) {
+		atomic_dec(&staged->count);
+		wireguardif_staged_send(netif, pkt, peer);
+	}
+}
+
+static void wireguardif_staged_discard(struct wireguardif_staged_queue *staged) {
+	struct net_pkt *pkt;
+
+	k_work_cancel(&staged->handshake_work);
+	while ((pkt = k_fifo_get(&staged->fifo, K_NO_WAIT)) != NULL) {
+		atomic_dec(&staged->count);
+		net_pkt_unref(pkt);
+	}
+}
+
+err_t wireguardif_stage_pkt(struct netif *netif, struct net_pkt *pkt, const ip_addr_t *ipaddr) {
+	struct wireguard_device *device = (struct wireguard_device *)netif->state;
+	struct wireguardif_staged_queue *staged;
+	struct wireguard_peer *peer;
+	struct net_pkt *oldest;
+
+	peer = peer_lookup_by_allowed_ip(device, ipaddr);
+	if (!peer) {
+		return ERR_RTE;
+	}
+	staged = wireguardif_staged_get(netif, peer);
+
+	// Like the Linux staged queue, make room by dropping the oldest packet
+	if (atomic_inc(&staged->count) >= CONFIG_WIREGUARD_TX_STAGING_DEPTH) {
+		oldest = k_fifo_get(&staged->fifo, K_NO_WAIT);
+		if (oldest) {
+			atomic_dec(&staged->count);
+			net_pkt_unref(oldest);
+			atomic_inc(&tx_staged_dropped);
+		}
+	}
+	k_fifo_put(&staged->fifo, pkt);
+	atomic_inc(&tx_staged);
+
+	// The session may have come up after the caller found no keypair, and the flush that came with it already ran
+	wireguardif_staged_flush(netif, peer);
+	if (k_fifo_is_empty(&staged->fifo)) {
+		return ERR_OK;
+	}
+
+	// Don't wait for the next timer tick to start the handshake
+	peer->send_handshake = true;
+	if (wireguardif_can_send_initiation(peer)) {
+		k_work_submit(&staged->handshake_work);
+	}
+	return ERR_OK;
+}
+#endif /* CONFIG_WIREGUARD_TX_STAGING */
+
 static void wireguardif_send_keepalive(struct wireguard_device *device, struct wireguard_peer *peer) {
 	// Send a NULL packet as a keep-alive
 	wireguardif_output_to_peer(device->netif, NULL, NULL, peer);
@@ -305,7 +575,11 @@ static void wireguardif_process_response_message(struct wireguard_device *device
 		// Update the peer location
 		update_peer_addr(peer, addr, port);
 
-		wireguard_start_session(peer, true);
+		wireguard_start_session(device, peer, true);
+#if defined(CONFIG_WIREGUARD_TX_STAGING)
+		// The staged packets go out first, the keepalive is sent right behind them
+		wireguardif_staged_flush(device->netif, peer);
+#endif
 		wireguardif_send_keepalive(device, peer);
 
 #ifdef TBD_ZEPHYR_PORTING
@@ -319,31 +593,46 @@ static void wireguardif_process_response_message(struct wireguard_device *device
 	}
 }
 
-static bool peer_add_ip(struct wireguard_peer *peer, ip_addr_t ip, ip_addr_t mask) {
+// Prefix length of a netmask, -1 if the mask is not contiguous
+static int mask_to_cidr(const ip_addr_t *mask) {
+	uint32_t bits = ntohl(ip_2_ip4(mask)->addr);
+	int cidr = 0;
+
+	while (bits & 0x80000000) {
+		bits <<= 1;
+		cidr++;
+	}
+	return bits ? -1 : cidr;
+}
+
+static bool peer_add_ip(struct wireguard_device *device, struct wireguard_peer *peer, ip_addr_t ip, ip_addr_t mask) {
+	k_spinlock_key_t key;
 	bool result = false;
-	struct wireguard_allowed_ip *allowed;
-	int x;
+	int cidr = mask_to_cidr(&mask);
 
-	// Look for existing match first
-	for (x=0; x < WIREGUARD_MAX_SRC_IPS; x++) {
-		allowed = &peer->allowed_source_ips[x];
-		if ((allowed->valid) && ip_addr_cmp(&allowed->ip, &ip) && ip_addr_cmp(&allowed->mask, &mask)) {
-			result = true;
-			break;
-		}
+	if (cidr >= 0) {
+		key = k_spin_lock(&allowed_ips_lock);
+		result = wg_allowedips_insert(&device->allowed_ips, ntohl(ip_2_ip4(&ip)->addr), (uint8_t)cidr, wireguard_peer_index(device, peer));
+#if defined(CONFIG_WIREGUARD_ROUTE_CACHE)
+		route_cache_invalidate();
+#endif
+		k_spin_unlock(&allowed_ips_lock, key);
 	}
-	if (!result) {
-		// Look for a free slot
-		for (x=0; x < WIREGUARD_MAX_SRC_IPS; x++) {
-			allowed = &peer->allowed_source_ips[x];
-			if (!allowed->valid) {
-				allowed->valid = true;
-				allowed->ip = ip;
-				allowed->mask = mask;
-				result = true;
-				break;
-			}
-		}
+	return result;
+}
+
+static bool peer_remove_ip(struct wireguard_device *device, struct wireguard_peer *peer, ip_addr_t ip, ip_addr_t mask) {
+	k_spinlock_key_t key;
+	bool result = false;
+	int cidr = mask_to_cidr(&mask);
+
+	if (cidr >= 0) {
+		key = k_spin_lock(&allowed_ips_lock);
+		result = wg_allowedips_remove(&device->allowed_ips, ntohl(ip_2_ip4(&ip)->addr), (uint8_t)cidr, wireguard_peer_index(device, peer));
+#if defined(CONFIG_WIREGUARD_ROUTE_CACHE)
+		route_cache_invalidate();
+#endif
+		k_spin_unlock(&allowed_ips_lock, key);
 	}
 	return result;
 }
@@ -358,9 +647,8 @@ static void wireguardif_process_data_message(struct wireguard_device *device, st
 	u16_t tot_len;
 	uint8_t *payload;
 	struct ip_hdr *iphdr;
-	ip_addr_t dest;
-	bool dest_ok = false;
-	int x;
+	ip_addr_t source;
+	bool source_ok = false;
 	uint32_t now;
 	uint16_t header_len = 0xFFFF;
 	uint32_t idx = data_hdr->receiver;
@@ -378,94 +666,100 @@ static void wireguardif_process_data_message(struct wireguard_device *device, st
 
 			// We don't know the unpadded size until we have decrypted the packet and validated/inspected the IP header
 			tot_len = src_len - WIREGUARD_AUTHTAG_LEN;
-			pkt = net_pkt_alloc_with_buffer(wg_netif->tun_if, tot_len, AF_INET, IPPROTO_IP, K_NO_WAIT);
-			if (pkt) {
-				payload = pkt->frags->data;
-
-				// Decrypt the packet
-				memset(payload, 0, tot_len);
-				if (wireguard_decrypt_packet(payload, src, src_len, nonce, keypair)) {
-
-					// 3. Since the packet has authenticated correctly, the source IP of the outer UDP/IP packet is used to update the endpoint for peer TrMv...WXX0.
-					// Update the peer location
-					update_peer_addr(peer, addr, port);
-
-					now = wireguard_sys_now();
-					keypair->last_rx = now;
-					peer->last_rx = now;
-
-					// Might need to shuffle next key --> current keypair
-					keypair_update(peer, keypair);
+			// Decrypt in the receive buffer and only copy packets that survive the checks below into a net_pkt.
+			// This is not verify-then-decrypt: the built-in AEAD decrypts while it computes the tag and wipes the
+			// buffer on a mismatch (PSA clears it too), so a forged packet leaves no plaintext behind but still costs
+			// a full decryption
+			payload = src;
+			if ((tot_len > 0) && !wireguard_replay_would_accept(keypair, nonce)) {
+				// Duplicates (e.g. Wi-Fi retransmits) are dropped before spending anything on them
+				WG_TRACE_DBG("(%s) This is a duplicate packet / replayed / too far out of order !", __func__);
+			} else if (wireguard_decrypt_packet(payload, src, src_len, nonce, keypair)) {
+
+				// 3. Since the packet has authenticated correctly, the source IP of the outer UDP/IP packet is used to update the endpoint for peer TrMv...WXX0.
+				// Update the peer location
+				update_peer_addr(peer, addr, port);
+
+				now = wireguard_sys_now();
+				keypair->last_rx = now;
+				peer->last_rx = now;
+
+				// Might need to shuffle next key --> current keypair
+				keypair_update(device, peer, keypair);
+#if defined(CONFIG_WIREGUARD_TX_STAGING)
+				// As responder this is the first moment we may send with the new keypair
+				wireguardif_staged_flush(device->netif, peer);
+#endif
 
-					// Check to see if we should rekey
-					if (keypair->initiator && wireguard_expired(keypair->keypair_millis, REJECT_AFTER_TIME - peer->keepalive_interval - REKEY_TIMEOUT)) {
-						peer->send_handshake = true;
-					}
+				// Check to see if we should rekey
+				if (keypair->initiator && wireguard_expired(keypair->keypair_millis, REJECT_AFTER_TIME - peer->keepalive_interval - REKEY_TIMEOUT)) {
+					peer->send_handshake = true;
+				}
 
-					// Make sure that link is reported as up
-					if (!net_if_is_up(wg_netif->tun_if)) {
-						net_if_up(wg_netif->tun_if);
-					}
+				// Make sure that link is reported as up
+				if (!net_if_is_up(wg_netif->tun_if)) {
+					net_if_up(wg_netif->tun_if);
+				}
 
-					if (tot_len > 0) {
-						//4a. Once the packet payload is decrypted, the interface has a plaintext packet. If this is not an IP packet, it is dropped.
-						iphdr = (struct ip_hdr *)payload;
-						// Check for packet replay / dupes
-						if (wireguard_check_replay(keypair, nonce)) {
-
-							// 4b. Otherwise, WireGuard checks to see if the source IP address of the plaintext inner-packet routes correspondingly in the cryptokey routing table
-							// Also check packet length!
-							if (IPH_V(iphdr) == 4) {
-								ip_addr_copy_from_ip4(dest, iphdr->dest);
-								for (x=0; x < WIREGUARD_MAX_SRC_IPS; x++) {
-									if (peer->allowed_source_ips[x].valid) {
-										if (ip_addr_netcmp(&dest, &peer->allowed_source_ips[x].ip,
-												ip_2_ip4(&peer->allowed_source_ips[x].mask))) {
-											dest_ok = true;
-											header_len = ntohs(IPH_LEN(iphdr));  // PP_NTOHS -> ntohs
-											break;
+				if (tot_len > 0) {
+					//4a. Once the packet payload is decrypted, the interface has a plaintext packet. If this is not an IP packet, it is dropped.
+					iphdr = (struct ip_hdr *)payload;
+					// Now that the packet is authentic, mark the counter as seen
+					if (wireguard_replay_commit(keypair, nonce)) {
+
+						// 4b. Otherwise, WireGuard checks to see if the source IP address of the plaintext inner-packet routes correspondingly in the cryptokey routing table
+						// Also check packet length!
+						if (IPH_V(iphdr) == 4) {
+							ip_addr_copy_from_ip4(source, iphdr->src);
+							if (peer_allows_ip(device, peer, &source)) {
+								source_ok = true;
+								header_len = ntohs(IPH_LEN(iphdr));  // PP_NTOHS -> ntohs
+							}
+						}
+						if (header_len <= tot_len) {
+
+							// 5. If the plaintext packet has not been dropped, it is inserted into the receive queue of the wg0 interface.
+							if (source_ok) {
+								// Send packet to be processed by application
+								WG_TRACE_INF(">> Received a VPN message: size %d from SRC = %"PRIu32".%"PRIu32".%"PRIu32".%"PRIu32" to DST = %"PRIu32".%"PRIu32".%"PRIu32".%"PRIu32"",
+										header_len,
+										(ntohl(iphdr->src.addr)  >> 24) & 0xFF,
+										(ntohl(iphdr->src.addr)  >> 16) & 0xFF,
+										(ntohl(iphdr->src.addr)  >>  8) & 0xFF,
+										(ntohl(iphdr->src.addr)  >>  0) & 0xFF,
+										(ntohl(iphdr->dest.addr) >> 24) & 0xFF,
+										(ntohl(iphdr->dest.addr) >> 16) & 0xFF,
+										(ntohl(iphdr->dest.addr) >>  8) & 0xFF,
+										(ntohl(iphdr->dest.addr) >>  0) & 0xFF);
+								WG_TRACE_PKT(WG_TRACE_TUN_RX, (uint16_t)(peer - device->peers),
+										iphdr->src.addr, iphdr->dest.addr, header_len);
+
+								// The buffers of the tunnel interface are not necessarily one contiguous block,
+								// and the padding after the IP packet is not passed up
+								pkt = net_pkt_alloc_with_buffer(wg_netif->tun_if, header_len, AF_INET, IPPROTO_IP, K_NO_WAIT);
+								if (pkt) {
+									if (net_pkt_write(pkt, payload, header_len) == 0) {
+										net_pkt_cursor_init(pkt);
+										// The IP stack owns the packet from here on unless it drops it
+										if (net_ipv4_input(pkt, false) != NET_DROP) { /* go to the zephyr ip stack */
+											pkt = NULL;
 										}
 									}
-								}
-							}
-							if (header_len <= tot_len) {
-
-								// 5. If the plaintext packet has not been dropped, it is inserted into the receive queue of the wg0 interface.
-								if (dest_ok) {
-									// Send packet to be processed by application
-									{
-										struct ip_hdr *tip;
-										tip = (struct ip_hdr *)payload;
-										LOG_INF(">> Received a VPN message: size %d from SRC = %"PRIu32".%"PRIu32".%"PRIu32".%"PRIu32" to DST = %"PRIu32".%"PRIu32".%"PRIu32".%"PRIu32"",
-												tot_len,
-												(ntohl(tip->src.addr)  >> 24) & 0xFF,
-												(ntohl(tip->src.addr)  >> 16) & 0xFF,
-												(ntohl(tip->src.addr)  >>  8) & 0xFF,
-												(ntohl(tip->src.addr)  >>  0) & 0xFF,
-												(ntohl(tip->dest.addr) >> 24) & 0xFF,
-												(ntohl(tip->dest.addr) >> 16) & 0xFF,
-												(ntohl(tip->dest.addr) >>  8) & 0xFF,
-												(ntohl(tip->dest.addr) >>  0) & 0xFF);
+									if (pkt) {
+										net_pkt_unref(pkt);
 									}
-
-									pkt->frags->len = tot_len;
-									net_ipv4_input(pkt, false); /* go to the zephyr ip stack */
 								}
-							} else {
-								// IP header is corrupt or lied about packet size
-								LOG_DBG("(%s) IP header is corrupt or lied about packet size !", __func__);
 							}
 						} else {
-							// This is a duplicate packet / replayed / too far out of order
-							LOG_DBG("(%s) This is a duplicate packet / replayed / too far out of order !", __func__);
+							// IP header is corrupt or lied about packet size
+							WG_TRACE_DBG("(%s) IP header is corrupt or lied about packet size !", __func__);
 						}
 					} else {
-						// This was a keep-alive packet
+						// This is a duplicate packet / replayed / too far out of order
+						WG_TRACE_DBG("(%s) This is a duplicate packet / replayed / too far out of order !", __func__);
 					}
-				}
-
-				if (pkt) {
-					net_pkt_unref(pkt);
+				} else {
+					// This was a keep-alive packet
 				}
 			}
 
@@ -473,7 +767,7 @@ static void wireguardif_process_data_message(struct wireguard_device *device, st
 			//After Reject-After-Messages transport data messages or after the current secure session is Reject- After-Time seconds old,
 			// whichever comes first, WireGuard will refuse to send or receive any more transport data messages using the current secure session,
 			// until a new secure session is created through the 1-RTT handshake
-			keypair_destroy(keypair);
+			keypair_destroy(device, keypair);
 		}
 
 	} else {
@@ -481,66 +775,19 @@ static void wireguardif_process_data_message(struct wireguard_device *device, st
 	}
 }
 
-static struct pbuf *wireguardif_initiate_handshake(struct wireguard_device *device, struct wireguard_peer *peer,
-	struct message_handshake_initiation *msg, err_t *error) {
-	struct pbuf *pbuf = NULL;
-	err_t err = ERR_OK;
-
-	if (wireguard_create_handshake_initiation(device, peer, msg)) {
-		// Send this packet out!
-		pbuf = (struct pbuf *)malloc(sizeof(struct pbuf));
-		if (pbuf) {
-			pbuf->payload = (void *)malloc(sizeof(struct message_handshake_initiation));
-			if (pbuf->payload == NULL) {
-				free(pbuf);
-				return NULL;
-			}
-			pbuf->len = sizeof(struct message_handshake_initiation);
-			pbuf->tot_len = pbuf->len;
-
-			if (memcpy(pbuf->payload, msg, sizeof(struct message_handshake_initiation))) {  //ERR_OK
-				// OK!
-			} else {
-				pbuf_free(pbuf);
-				pbuf = NULL;
-			}
-		} else {
-			err = ERR_MEM;
-		}
-	} else {
-		err = ERR_ARG;
-	}
-	if (error) {
-		*error = err;
-	}
-	return pbuf;
-}
-
 static void wireguardif_send_handshake_response(struct wireguard_device *device, struct wireguard_peer *peer) {
 	struct message_handshake_response packet;
-	struct pbuf *pbuf = NULL;
+	struct pbuf pbuf;
 
 	if (wireguard_create_handshake_response(device, peer, &packet)) {
 
-		wireguard_start_session(peer, false);
+		wireguard_start_session(device, peer, false);
 
 		// Send this packet out!
-		pbuf = (struct pbuf *)malloc(sizeof(struct pbuf));
-		if (pbuf) {
-			pbuf->payload = (void *)malloc(sizeof(struct message_handshake_response));
-			if (pbuf->payload == NULL) {
-				free(pbuf);
-				return;
-			}
-			pbuf->len = sizeof(struct message_handshake_response);
-			pbuf->tot_len = pbuf->len;
-
-			if (memcpy(pbuf->payload, &packet, sizeof(struct message_handshake_response))) {
-				// OK!
-				wireguardif_peer_output(device->netif, pbuf, peer);
-			}
-			pbuf_free(pbuf);
-		}
+		pbuf.payload = &packet;
+		pbuf.len = sizeof(struct message_handshake_response);
+		pbuf.tot_len = pbuf.len;
+		wireguardif_peer_output(device->netif, &pbuf, peer);
 	}
 }
 
@@ -562,28 +809,19 @@ static size_t get_source_addr_port(const ip_addr_t *addr, u16_t port, uint8_t *b
 static void wireguardif_send_handshake_cookie(struct wireguard_device *device, const uint8_t *mac1,
 	uint32_t index, const ip_addr_t *addr, u16_t port) {
 	struct message_cookie_reply packet;
-	struct pbuf *pbuf = NULL;
+	struct pbuf pbuf;
 	uint8_t source_buf[18];
 	size_t source_len = get_source_addr_port(addr, port, source_buf, sizeof(source_buf));
 
-	wireguard_create_cookie_reply(device, &packet, mac1, index, source_buf, source_len);
+	if (!wireguard_create_cookie_reply(device, &packet, mac1, index, source_buf, source_len)) {
+		return;
+	}
 
 	// Send this packet out!
-	pbuf = (struct pbuf *)malloc(sizeof(struct pbuf));
-	if (pbuf) {
-		pbuf->payload = (void *)malloc(sizeof(struct message_cookie_reply));
-		if (pbuf->payload == NULL) {
-			free(pbuf);
-			return;
-		}
-		pbuf->len = sizeof(struct message_cookie_reply);
-		pbuf->tot_len = pbuf->len;
-
-		if (memcpy(pbuf->payload, &packet, sizeof(struct message_cookie_reply))) {
-			wireguardif_device_output(device, pbuf, addr, port);
-		}
-		pbuf_free(pbuf);
-	}
+	pbuf.payload = &packet;
+	pbuf.len = sizeof(struct message_cookie_reply);
+	pbuf.tot_len = pbuf.len;
+	wireguardif_device_output(device, &pbuf, addr, port);
 }
 
 static bool wireguardif_check_initiation_message(struct wireguard_device *device,
@@ -737,23 +975,27 @@ void wireguardif_network_rx(void *arg, struct pbuf *p, const ip_addr_t *addr, u1
 
 static err_t wireguard_start_handshake(struct netif *netif, struct wireguard_peer *peer) {
 	struct wireguard_device *device = (struct wireguard_device *)netif->state;
-	err_t result;
-	struct pbuf *pbuf;
+	struct wireguard_peer_identity *identity;
+	err_t result = ERR_ARG;
+	struct pbuf pbuf;
 	struct message_handshake_initiation msg;
 
-	pbuf = wireguardif_initiate_handshake(device, peer, &msg, &result);
-	if (pbuf) {
-		result = wireguardif_peer_output(netif, pbuf, peer);
-		pbuf_free(pbuf);
+	if (wireguard_create_handshake_initiation(device, peer, &msg)) {
+		// Send this packet out!
+		pbuf.payload = &msg;
+		pbuf.len = sizeof(struct message_handshake_initiation);
+		pbuf.tot_len = pbuf.len;
+		result = wireguardif_peer_output(netif, &pbuf, peer);
 		peer->send_handshake = false;
 		peer->last_initiation_tx = wireguard_sys_now();
-		memcpy(peer->handshake_mac1, msg.mac1, WIREGUARD_COOKIE_LEN);
-		peer->handshake_mac1_valid = true;
+		identity = peer_identity(device, peer);
+		memcpy(identity->handshake_mac1, msg.mac1, WIREGUARD_COOKIE_LEN);
+		identity->handshake_mac1_valid = true;
 	}
 	return result;
 }
 
-static err_t wireguardif_lookup_peer(struct netif *netif, u8_t peer_index, struct wireguard_peer **out) {
+static err_t wireguardif_lookup_peer(struct netif *netif, u16_t peer_index, struct wireguard_peer **out) {
 	assert(netif != NULL);
 	assert(netif->state != NULL);
 	struct wireguard_device *device = (struct wireguard_device *)netif->state;
@@ -774,16 +1016,19 @@ static err_t wireguardif_lookup_peer(struct netif *netif, u8_t peer_index, struc
 	return result;
 }
 
-err_t wireguardif_connect(struct netif *netif, u8_t peer_index) {
+err_t wireguardif_connect(struct netif *netif, u16_t peer_index) {
+	struct wireguard_device *device = (struct wireguard_device *)netif->state;
+	struct wireguard_peer_identity *identity;
 	struct wireguard_peer *peer;
 	err_t result = wireguardif_lookup_peer(netif, peer_index, &peer);
 	if (result == ERR_OK) {
+		identity = peer_identity(device, peer);
 		// Check that a valid connect ip and port have been set
-		if (!ip_addr_isany(&peer->connect_ip) && (peer->connect_port > 0)) {
+		if (!ip_addr_isany(&identity->connect_ip) && (identity->connect_port > 0)) {
 			// Set the flag that we want to try connecting
 			peer->active = true;
-			peer->ip = peer->connect_ip;
-			peer->port = peer->connect_port;
+			peer->ip = identity->connect_ip;
+			peer->port = identity->connect_port;
 			result = ERR_OK;
 		} else {
 			result = ERR_ARG;
@@ -792,22 +1037,23 @@ err_t wireguardif_connect(struct netif *netif, u8_t peer_index) {
 	return result;
 }
 
-err_t wireguardif_disconnect(struct netif *netif, u8_t peer_index) {
+err_t wireguardif_disconnect(struct netif *netif, u16_t peer_index) {
+	struct wireguard_device *device = (struct wireguard_device *)netif->state;
 	struct wireguard_peer *peer;
 	err_t result = wireguardif_lookup_peer(netif, peer_index, &peer);
 	if (result == ERR_OK) {
 		// Set the flag that we want to try connecting
 		peer->active = false;
 		// Wipe out current keys
-		keypair_destroy(&peer->next_keypair);
-		keypair_destroy(&peer->curr_keypair);
-		keypair_destroy(&peer->prev_keypair);
+		keypair_destroy(device, &peer->next_keypair);
+		keypair_destroy(device, &peer->curr_keypair);
+		keypair_destroy(device, &peer->prev_keypair);
 		result = ERR_OK;
 	}
 	return result;
 }
 
-err_t wireguardif_peer_is_up(struct netif *netif, u8_t peer_index, ip_addr_t *current_ip, u16_t *current_port) {
+err_t wireguardif_peer_is_up(struct netif *netif, u16_t peer_index, ip_addr_t *current_ip, u16_t *current_port) {
 	struct wireguard_peer *peer;
 	err_t result = wireguardif_lookup_peer(netif, peer_index, &peer);
 	if (result == ERR_OK) {
@@ -826,29 +1072,64 @@ err_t wireguardif_peer_is_up(struct netif *netif, u8_t peer_index, ip_addr_t *cu
 	return result;
 }
 
-err_t wireguardif_remove_peer(struct netif *netif, u8_t peer_index) {
+err_t wireguardif_remove_peer(struct netif *netif, u16_t peer_index) {
+	struct wireguard_device *device = (struct wireguard_device *)netif->state;
 	struct wireguard_peer *peer;
+	k_spinlock_key_t key;
 	err_t result = wireguardif_lookup_peer(netif, peer_index, &peer);
 	if (result == ERR_OK) {
-		crypto_zero(peer, sizeof(struct wireguard_peer));
-		peer->valid = false;
+#if defined(CONFIG_WIREGUARD_TX_STAGING)
+		wireguardif_staged_discard(wireguardif_staged_get(netif, peer));
+#endif
+		key = k_spin_lock(&allowed_ips_lock);
+		wg_allowedips_remove_peer(&device->allowed_ips, peer_index);
+#if defined(CONFIG_WIREGUARD_ROUTE_CACHE)
+		route_cache_invalidate();
+#endif
+		k_spin_unlock(&allowed_ips_lock, key);
+		peer_free(device, peer);
 		result = ERR_OK;
 	}
 	return result;
 }
 
-err_t wireguardif_update_endpoint(struct netif *netif, u8_t peer_index, const ip_addr_t *ip, u16_t port) {
+err_t wireguardif_add_allowed_ip(struct netif *netif, u16_t peer_index, const ip_addr_t *ip, const ip_addr_t *mask) {
+	struct wireguard_peer *peer;
+	err_t result = wireguardif_lookup_peer(netif, peer_index, &peer);
+	if (result == ERR_OK) {
+		if (!peer_add_ip((struct wireguard_device *)netif->state, peer, *ip, *mask)) {
+			// Mask is not contiguous or the allowed IPs table is full
+			result = ERR_MEM;
+		}
+	}
+	return result;
+}
+
+err_t wireguardif_remove_allowed_ip(struct netif *netif, u16_t peer_index, const ip_addr_t *ip, const ip_addr_t *mask) {
+	struct wireguard_peer *peer;
+	err_t result = wireguardif_lookup_peer(netif, peer_index, &peer);
+	if (result == ERR_OK) {
+		if (!peer_remove_ip((struct wireguard_device *)netif->state, peer, *ip, *mask)) {
+			result = ERR_ARG;
+		}
+	}
+	return result;
+}
+
+err_t wireguardif_update_endpoint(struct netif *netif, u16_t peer_index, const ip_addr_t *ip, u16_t port) {
+	struct wireguard_peer_identity *identity;
 	struct wireguard_peer *peer;
 	err_t result = wireguardif_lookup_peer(netif, peer_index, &peer);
 	if (result == ERR_OK) {
-		peer->connect_ip = *ip;
-		peer->connect_port = port;
+		identity = peer_identity((struct wireguard_device *)netif->state, peer);
+		identity->connect_ip = *ip;
+		identity->connect_port = port;
 		result = ERR_OK;
 	}
 	return result;
 }
 
-err_t wireguardif_add_peer(struct netif *netif, struct wireguardif_peer *p, u8_t *peer_index) {
+err_t wireguardif_add_peer(struct netif *netif, struct wireguardif_peer *p, u16_t *peer_index) {
 	assert(netif != NULL);
 	assert(netif->state != NULL);
 	assert(p != NULL);
@@ -857,6 +1138,7 @@ err_t wireguardif_add_peer(struct netif *netif, struct wireguardif_peer *p, u8_t
 	uint8_t public_key[WIREGUARD_PUBLIC_KEY_LEN];
 	size_t public_key_len = sizeof(public_key);
 	struct wireguard_peer *peer = NULL;
+	struct wireguard_peer_identity *identity;
 
 	uint32_t t1 = wireguard_sys_now();
 
@@ -870,18 +1152,19 @@ err_t wireguardif_add_peer(struct netif *netif, struct wireguardif_peer *p, u8_t
 			peer = peer_alloc(device);
 			if (peer) {
 				if (wireguard_peer_init(device, peer, public_key, p->preshared_key)) {
+					identity = peer_identity(device, peer);
 
-					peer->connect_ip = p->endpoint_ip;
-					peer->connect_port = p->endport_port;
-					peer->ip = peer->connect_ip;
-					peer->port = peer->connect_port;
+					identity->connect_ip = p->endpoint_ip;
+					identity->connect_port = p->endport_port;
+					peer->ip = identity->connect_ip;
+					peer->port = identity->connect_port;
 					if (p->keep_alive == WIREGUARDIF_KEEPALIVE_DEFAULT) {
 						peer->keepalive_interval = KEEPALIVE_TIMEOUT;
 					} else {
 						peer->keepalive_interval = p->keep_alive;
 					}
-					peer_add_ip(peer, p->allowed_ip, p->allowed_mask);
-					memcpy(peer->greatest_timestamp, p->greatest_timestamp, sizeof(peer->greatest_timestamp));
+					peer_add_ip(device, peer, p->allowed_ip, p->allowed_mask);
+					memcpy(identity->greatest_timestamp, p->greatest_timestamp, sizeof(identity->greatest_timestamp));
 
 					result = ERR_OK;
 				} else {
@@ -968,18 +1251,18 @@ void wireguardif_tmr(struct k_timer *timer) {
 			// Do we need to rekey / send a handshake?
 			if (should_reset_peer(peer)) {
 				// Nothing back for too long - we should wipe out all crypto state
-				keypair_destroy(&peer->next_keypair);
-				keypair_destroy(&peer->curr_keypair);
-				keypair_destroy(&peer->prev_keypair);
+				keypair_destroy(device, &peer->next_keypair);
+				keypair_destroy(device, &peer->curr_keypair);
+				keypair_destroy(device, &peer->prev_keypair);
 				// TODO: Also destroy handshake?
 
 				// Revert back to default IP/port if these were altered
-				peer->ip = peer->connect_ip;
-				peer->port = peer->connect_port;
+				peer->ip = peer_identity(device, peer)->connect_ip;
+				peer->port = peer_identity(device, peer)->connect_port;
 			}
 			if (should_destroy_current_keypair(peer)) {
 				// Destroy current keypair
-				keypair_destroy(&peer->curr_keypair);
+				keypair_destroy(device, &peer->curr_keypair);
 			}
 			if (should_send_keepalive(peer)) {
 				wireguardif_send_keepalive(device, peer);
@@ -993,6 +1276,12 @@ void wireguardif_tmr(struct k_timer *timer) {
 			}
 		}
 	}
+#if defined(CONFIG_WIREGUARD_KEYSTREAM_PREFETCH)
+	// Picks up sessions that were just established and have not sent anything yet
+	if (link_up) {
+		wireguardif_prefetch_kick();
+	}
+#endif
 
 	if (!link_up) {
 #ifdef TBD_ZEPHYR_PORTING
@@ -1009,6 +1298,9 @@ err_t wireguardif_init(struct netif *netif) {
 	struct wireguard_device *device;
 	uint8_t private_key[WIREGUARD_PRIVATE_KEY_LEN];
 	size_t private_key_len = sizeof(private_key);
+#if defined(CONFIG_WIREGUARD_TX_STAGING)
+	int x;
+#endif
 
 	assert(netif != NULL);
 	assert(netif->state != NULL);
@@ -1035,6 +1327,22 @@ err_t wireguardif_init(struct netif *netif) {
 				if (wireguard_device_init(device, private_key)) {
 					netif->state = device;
 
+#if defined(CONFIG_WIREGUARD_TX_STAGING)
+					for (x=0; x < WIREGUARD_MAX_PEERS; x++) {
+						k_fifo_init(&wireguardif_staged_queues[x].fifo);
+						atomic_set(&wireguardif_staged_queues[x].count, 0);
+						wireguardif_staged_queues[x].netif = netif;
+						wireguardif_staged_queues[x].peer = &device->peers[x];
+						k_work_init(&wireguardif_staged_queues[x].handshake_work, wireguardif_staged_handshake_work);
+					}
+#endif
+
+#if defined(CONFIG_WIREGUARD_KEYSTREAM_PREFETCH)
+					k_work_init(&wireguardif_prefetch_work, wireguardif_prefetch_handler);
+					k_work_queue_start(&wireguardif_prefetch_q, wireguardif_prefetch_stack,
+						K_THREAD_STACK_SIZEOF(wireguardif_prefetch_stack), K_LOWEST_APPLICATION_THREAD_PRIO, NULL);
+#endif
+
 					// Start a periodic timer for this wireguard device
 					start_wg_timer(WIREGUARDIF_TIMER_MSECS);
 
@@ -1061,3 +1369,21 @@ void wireguardif_peer_init(struct wireguardif_peer *peer) {
 	memset(peer->greatest_timestamp, 0, sizeof(peer->greatest_timestamp));
 	peer->preshared_key = NULL;
 }
+
+void wireguardif_get_stats(struct netif *netif, struct wireguardif_stats *stats) {
+	ARG_UNUSED(netif);
+	assert(stats != NULL);
+
+	memset(stats, 0, sizeof(struct wireguardif_stats));
+	stats->tx_pool_size = CONFIG_WIREGUARD_TX_POOL_COUNT;
+	stats->tx_pool_used = k_mem_slab_num_used_get(&wireguardif_tx_slab);
+	stats->tx_pool_exhausted = atomic_get(&tx_pool_exhausted);
+#if defined(CONFIG_WIREGUARD_TX_STAGING)
+	stats->tx_staged = atomic_get(&tx_staged);
+	stats->tx_staged_dropped = atomic_get(&tx_staged_dropped);
+#endif
+#if defined(CONFIG_WIREGUARD_ROUTE_CACHE)
+	stats->route_cache_hits = atomic_get(&route_cache_hits);
+	stats->route_cache_misses = atomic_get(&route_cache_misses);
+#endif
+}
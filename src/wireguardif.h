@@ -57,7 +57,7 @@ struct netif {
 
 struct pbuf {
 	/** next pbuf in singly linked pbuf chain */
-	//struct pbuf *next;
+	struct pbuf *next;
 
 	/** pointer to the actual data in the buffer */
 	void *payload;
@@ -99,7 +99,20 @@ struct wireguardif_peer {
 	u16_t keep_alive;
 };
 
-#define WIREGUARDIF_INVALID_INDEX (0xFF)
+#define WIREGUARDIF_INVALID_INDEX (0xFFFF)
+
+struct wireguardif_stats {
+	// Transmit buffer pool
+	uint32_t tx_pool_size;
+	uint32_t tx_pool_used;
+	uint32_t tx_pool_exhausted;
+	// Packets held back until a session was up, and how many of them had to be dropped
+	uint32_t tx_staged;
+	uint32_t tx_staged_dropped;
+	// Allowed IPs lookups answered by the route cache, and the ones that had to walk the trie
+	uint32_t route_cache_hits;
+	uint32_t route_cache_misses;
+};
 
 // Initialise a new WireGuard network interface (netif)
 err_t wireguardif_init(struct netif *netif);
@@ -110,26 +123,49 @@ void wireguardif_network_rx(void *arg, struct pbuf *p, const ip_addr_t *addr, u1
 // tx(-> wlan0)
 err_t wireguardif_output(struct netif *netif, struct pbuf *q, const ip_addr_t *ipaddr);
 
+struct net_pkt;
+
+// Most fragments a packet sent on the tunnel may consist of
+#define WIREGUARDIF_MAX_PBUFS	(16)
+
+// Describe the data of pkt as a pbuf chain in chain[] without copying it
+// Returns the number of pbufs used, or 0 if the packet has more than max fragments
+size_t wireguardif_pkt_to_pbuf(struct net_pkt *pkt, struct pbuf *chain, size_t max);
+
+#if defined(CONFIG_WIREGUARD_TX_STAGING)
+// Hold a plaintext IP packet that could not be sent (ERR_CONN) until the peer has a session, and start the handshake
+// On ERR_OK the packet belongs to the interface, otherwise it is still owned by the caller
+err_t wireguardif_stage_pkt(struct netif *netif, struct net_pkt *pkt, const ip_addr_t *ipaddr);
+#endif
+
 // Helper to initialise the peer struct with defaults
 void wireguardif_peer_init(struct wireguardif_peer *peer);
 
 // Add a new peer to the specified interface - see wireguard.h for maximum number of peers allowed
 // On success the peer_index can be used to reference this peer in future function calls
-err_t wireguardif_add_peer(struct netif *netif, struct wireguardif_peer *peer, u8_t *peer_index);
+err_t wireguardif_add_peer(struct netif *netif, struct wireguardif_peer *peer, u16_t *peer_index);
 
 // Remove the given peer from the network interface
-err_t wireguardif_remove_peer(struct netif *netif, u8_t peer_index);
+err_t wireguardif_remove_peer(struct netif *netif, u16_t peer_index);
+
+// Add or remove an allowed IPs prefix of the given peer at runtime - the most specific prefix wins when routing
+// Adding a prefix that belongs to another peer moves it to this one
+err_t wireguardif_add_allowed_ip(struct netif *netif, u16_t peer_index, const ip_addr_t *ip, const ip_addr_t *mask);
+err_t wireguardif_remove_allowed_ip(struct netif *netif, u16_t peer_index, const ip_addr_t *ip, const ip_addr_t *mask);
 
 // Update the "connect" IP of the given peer
-err_t wireguardif_update_endpoint(struct netif *netif, u8_t peer_index, const ip_addr_t *ip, u16_t port);
+err_t wireguardif_update_endpoint(struct netif *netif, u16_t peer_index, const ip_addr_t *ip, u16_t port);
 
 // Try and connect to the given peer
-err_t wireguardif_connect(struct netif *netif, u8_t peer_index);
+err_t wireguardif_connect(struct netif *netif, u16_t peer_index);
 
 // Stop trying to connect to the given peer
-err_t wireguardif_disconnect(struct netif *netif, u8_t peer_index);
+err_t wireguardif_disconnect(struct netif *netif, u16_t peer_index);
 
 // Is the given peer "up"? A peer is up if it has a valid session key it can communicate with
-err_t wireguardif_peer_is_up(struct netif *netif, u8_t peer_index, ip_addr_t *current_ip, u16_t *current_port);
+err_t wireguardif_peer_is_up(struct netif *netif, u16_t peer_index, ip_addr_t *current_ip, u16_t *current_port);
+
+// Take a snapshot of the interface data path counters
+void wireguardif_get_stats(struct netif *netif, struct wireguardif_stats *stats);
 
 #endif /* _WIREGUARDIF_H_ */
@@ -0,0 +1,211 @@
+/*
+ * Copyright (c) 2024 Chunghan Yi <chunghan.yi@gmail.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*
+ * Allowed IPs trie (src/wg_allowedips.c) with the largest table Kconfig
+ * allows, on two prefix sets:
+ *
+ *   random     - prefixes of random length (mostly /24 to /32) and address
+ *   worst case - chains of nested prefixes, one per length from /1 to /32,
+ *                so a lookup under the deepest visits a node for every bit
+ *
+ * Every lookup result is checked against a longest match scan over all the
+ * prefixes, which is also timed: it is what the per-peer scan in
+ * wireguardif.c did, except that one took the first match. Inserting and
+ * removing one prefix at a time is timed too.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <zephyr/kernel.h>
+
+#include "host_test.h"
+#include "wg_allowedips.h"
+
+#define PREFIXES	CONFIG_WIREGUARD_ALLOWED_IPS
+#define PEERS		(1000)
+#define LOOKUPS		(4096)
+
+struct prefix {
+	uint32_t ip;
+	uint8_t cidr;
+	uint16_t peer;
+};
+
+static struct wg_allowedips table;
+static struct prefix prefixes[PREFIXES];
+static size_t prefix_count;
+static uint32_t addresses[LOOKUPS];
+
+static uint32_t prefix_mask(uint8_t cidr)
+{
+	return cidr ? (0xFFFFFFFFu << (32 - cidr)) : 0;
+}
+
+static uint32_t random_ip(void)
+{
+	return ((uint32_t)rand() << 16) ^ (uint32_t)rand();
+}
+
+static uint16_t scan_lookup(uint32_t ip)
+{
+	uint16_t result = WG_ALLOWEDIPS_NONE;
+	int best = -1;
+	size_t x;
+
+	for (x = 0; x < prefix_count; x++) {
+		if (((ip & prefix_mask(prefixes[x].cidr)) == prefixes[x].ip) && (prefixes[x].cidr > best)) {
+			best = prefixes[x].cidr;
+			result = prefixes[x].peer;
+		}
+	}
+	return result;
+}
+
+static bool add_prefix(uint32_t ip, uint8_t cidr)
+{
+	size_t x;
+
+	ip &= prefix_mask(cidr);
+	for (x = 0; x < prefix_count; x++) {
+		if ((prefixes[x].ip == ip) && (prefixes[x].cidr == cidr)) {
+			return false;
+		}
+	}
+	prefixes[prefix_count].ip = ip;
+	prefixes[prefix_count].cidr = cidr;
+	prefixes[prefix_count].peer = (uint16_t)((size_t)rand() % PEERS);
+	prefix_count++;
+	return true;
+}
+
+static void make_random_set(void)
+{
+	static const uint8_t lengths[] = { 8, 12, 16, 20, 22, 24, 24, 24, 28, 32, 32, 32 };
+	size_t x;
+
+	prefix_count = 0;
+	while (prefix_count < PREFIXES) {
+		add_prefix(random_ip(), lengths[(size_t)rand() % ARRAY_SIZE(lengths)]);
+	}
+	// Half the lookups hit a prefix, half are anywhere
+	for (x = 0; x < LOOKUPS; x++) {
+		addresses[x] = (x & 1) ? random_ip() : (prefixes[(size_t)rand() % prefix_count].ip | (random_ip() & 0xFF));
+	}
+}
+
+static void make_worst_set(void)
+{
+	static uint32_t chains[PREFIXES / 32];
+	uint32_t base;
+	uint8_t cidr;
+	size_t x;
+
+	// The short prefixes of the chains soon repeat, so there end up more chains than PREFIXES / 32
+	prefix_count = 0;
+	for (x = 0; prefix_count < PREFIXES; x++) {
+		base = random_ip();
+		chains[x % ARRAY_SIZE(chains)] = base;
+		for (cidr = 1; (cidr <= 32) && (prefix_count < PREFIXES); cidr++) {
+			add_prefix(base, cidr);
+		}
+	}
+	// At the end of a chain, or one bit off it at a random depth
+	for (x = 0; x < LOOKUPS; x++) {
+		base = chains[(size_t)rand() % ARRAY_SIZE(chains)];
+		addresses[x] = (x & 1) ? base : (base ^ (1u << (rand() % 32)));
+	}
+}
+
+static void run_insert(void *arg)
+{
+	size_t x;
+
+	ARG_UNUSED(arg);
+	wg_allowedips_init(&table);
+	for (x = 0; x < prefix_count; x++) {
+		if (!wg_allowedips_insert(&table, prefixes[x].ip, prefixes[x].cidr, prefixes[x].peer)) {
+			abort();
+		}
+	}
+}
+
+static void run_remove(void *arg)
+{
+	size_t x;
+
+	ARG_UNUSED(arg);
+	run_insert(NULL);
+	for (x = 0; x < prefix_count; x++) {
+		if (!wg_allowedips_remove(&table, prefixes[x].ip, prefixes[x].cidr, prefixes[x].peer)) {
+			abort();
+		}
+	}
+}
+
+static void run_lookup(void *arg)
+{
+	size_t x;
+
+	ARG_UNUSED(arg);
+	for (x = 0; x < LOOKUPS; x++) {
+		host_consume((void *)(uintptr_t)wg_allowedips_lookup(&table, addresses[x]));
+	}
+}
+
+static void run_scan(void *arg)
+{
+	size_t x;
+
+	ARG_UNUSED(arg);
+	for (x = 0; x < LOOKUPS; x++) {
+		host_consume((void *)(uintptr_t)scan_lookup(addresses[x]));
+	}
+}
+
+static void run_set(const char *name, uint64_t budget_ns)
+{
+	double insert_ns;
+	double remove_ns;
+	double lookup_ns;
+	double scan_ns;
+	size_t x;
+
+	run_insert(NULL);
+	for (x = 0; x < LOOKUPS; x++) {
+		CHECK(wg_allowedips_lookup(&table, addresses[x]) == scan_lookup(addresses[x]));
+	}
+	for (x = 0; x < prefix_count; x++) {
+		CHECK(wg_allowedips_lookup(&table, prefixes[x].ip) == scan_lookup(prefixes[x].ip));
+	}
+
+	insert_ns = host_bench(run_insert, NULL, budget_ns).ns / (double)prefix_count;
+	// Removing includes inserting again first
+	remove_ns = (host_bench(run_remove, NULL, budget_ns).ns / (double)prefix_count) - insert_ns;
+	CHECK(table.root == 0);
+	CHECK(table.free_count == WG_ALLOWEDIPS_NODES);
+
+	run_insert(NULL);
+	lookup_ns = host_bench(run_lookup, NULL, budget_ns).ns / LOOKUPS;
+	scan_ns = host_bench(run_scan, NULL, budget_ns).ns / LOOKUPS;
+	printf("%-10s %6zu prefixes: lookup %6.1f ns (scan %8.1f ns), insert %6.1f ns, remove %6.1f ns\n",
+		name, prefix_count, lookup_ns, scan_ns, insert_ns, remove_ns);
+	CHECK(lookup_ns * 10 < scan_ns);
+}
+
+int main(int argc, char **argv)
+{
+	uint64_t budget_ns = host_full_run(argc, argv) ? 500000000ULL : 20000000ULL;
+
+	srand(22);
+	make_random_set();
+	run_set("random", budget_ns);
+	make_worst_set();
+	run_set("worst case", budget_ns);
+
+	return host_test_result("bench_allowedips");
+}
@@ -0,0 +1,203 @@
+/*
+ * Copyright (c) 2024 Chunghan Yi <chunghan.yi@gmail.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*
+ * BLAKE2s cycles per handshake: the compression with the sigma table on the
+ * stack and a loop over m[sigma[i][j]] (baseline/blake2s.c), the unrolled
+ * scalar compression, and blake2s() with the SSSE3 compression a host build
+ * gets. The number of compressions a handshake needs is counted on real
+ * handshakes by wrapping the blake2s_* calls (-Wl,--wrap), so
+ *
+ *   cycles saved per handshake = compressions x (baseline - current)
+ *
+ * The whole handshake is timed too, to show what share of it that is.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <zephyr/kernel.h>
+
+#include "host_test.h"
+#include "handshake.h"
+#include "blake2s.h"
+
+// Best of this many runs, to keep other load on the host out of the ratios
+#define RUNS		(3)
+#define HANDSHAKES	(20)
+#define HASH_BLOCKS	(64)
+
+int blake2s_base(void *out, size_t outlen, const void *key, size_t keylen, const void *in, size_t inlen);
+int blake2s_scalar(void *out, size_t outlen, const void *key, size_t keylen, const void *in, size_t inlen);
+
+typedef int (*blake2s_fn)(void *out, size_t outlen, const void *key, size_t keylen, const void *in, size_t inlen);
+
+static const struct {
+	const char *name;
+	blake2s_fn fn;
+} impls[] = {
+	{ "looped (baseline)", blake2s_base },
+	{ "unrolled scalar", blake2s_scalar },
+	{ "blake2s()", blake2s },
+};
+
+/* Compressions done through the blake2s_* API, counted from the lengths passed in */
+static uint64_t compressions;
+
+int __real_blake2s_init(blake2s_ctx *ctx, size_t outlen, const void *key, size_t keylen);
+void __real_blake2s_update(blake2s_ctx *ctx, const void *in, size_t inlen);
+void __real_blake2s_flush(blake2s_ctx *ctx);
+void __real_blake2s_final(blake2s_ctx *ctx, void *out);
+int __real_blake2s(void *out, size_t outlen, const void *key, size_t keylen, const void *in, size_t inlen);
+
+int __wrap_blake2s_init(blake2s_ctx *ctx, size_t outlen, const void *key, size_t keylen)
+{
+	// A key is buffered as a full block, compressed by whatever comes next
+	return __real_blake2s_init(ctx, outlen, key, keylen);
+}
+
+void __wrap_blake2s_update(blake2s_ctx *ctx, const void *in, size_t inlen)
+{
+	// A full buffer is only compressed once more input arrives
+	if (inlen > 0) {
+		compressions += (ctx->c + inlen - 1) / BLAKE2S_BLOCK_SIZE;
+	}
+	__real_blake2s_update(ctx, in, inlen);
+}
+
+void __wrap_blake2s_flush(blake2s_ctx *ctx)
+{
+	if (ctx->c == BLAKE2S_BLOCK_SIZE) {
+		compressions++;
+	}
+	__real_blake2s_flush(ctx);
+}
+
+void __wrap_blake2s_final(blake2s_ctx *ctx, void *out)
+{
+	compressions++;
+	__real_blake2s_final(ctx, out);
+}
+
+int __wrap_blake2s(void *out, size_t outlen, const void *key, size_t keylen, const void *in, size_t inlen)
+{
+	size_t bytes = (keylen ? BLAKE2S_BLOCK_SIZE : 0) + inlen;
+
+	compressions += bytes ? (bytes + BLAKE2S_BLOCK_SIZE - 1) / BLAKE2S_BLOCK_SIZE : 1;
+	return __real_blake2s(out, outlen, key, keylen, in, inlen);
+}
+
+static uint8_t message[HASH_BLOCKS * BLAKE2S_BLOCK_SIZE];
+
+static void check_equivalence(void)
+{
+	// RFC 7693 Appendix B
+	static const char *abc_digest = "508c5e8c327c14e2e1a72ba34eeb452f37458b209ed63a294d999b4c86675982";
+	uint8_t expected[32];
+	uint8_t digest[ARRAY_SIZE(impls)][32];
+	uint8_t key[32];
+	size_t keylen;
+	size_t len;
+	size_t x;
+	int trial;
+
+	host_hex(expected, abc_digest);
+	for (x = 0; x < ARRAY_SIZE(impls); x++) {
+		impls[x].fn(digest[x], 32, NULL, 0, "abc", 3);
+		CHECK_MEM(digest[x], expected, 32);
+	}
+
+	for (trial = 0; trial < 3000; trial++) {
+		len = (size_t)rand() % (sizeof(message) + 1);
+		keylen = (size_t)rand() % (sizeof(key) + 1);
+		for (x = 0; x < len; x++) {
+			message[x] = (uint8_t)rand();
+		}
+		for (x = 0; x < keylen; x++) {
+			key[x] = (uint8_t)rand();
+		}
+		for (x = 0; x < ARRAY_SIZE(impls); x++) {
+			impls[x].fn(digest[x], 32, key, keylen, message, len);
+			if (x > 0) {
+				CHECK_MEM(digest[x], digest[0], 32);
+			}
+		}
+	}
+}
+
+static blake2s_fn timed_fn;
+
+static void run_hash(void *arg)
+{
+	uint8_t digest[32];
+
+	ARG_UNUSED(arg);
+	// HASH_BLOCKS - 1 compressions in update, the last one in final
+	timed_fn(digest, sizeof(digest), NULL, 0, message, sizeof(message));
+	host_consume(digest);
+}
+
+static double cycles_per_compression(blake2s_fn fn, uint64_t budget_ns)
+{
+	struct host_bench_result result;
+	double best = 1e30;
+	int run;
+
+	timed_fn = fn;
+	for (run = 0; run < RUNS; run++) {
+		result = host_bench(run_hash, NULL, budget_ns);
+		best = MIN(best, result.cycles / HASH_BLOCKS);
+	}
+	return best;
+}
+
+static void run_handshake(void *arg)
+{
+	if (!host_handshake_run(arg)) {
+		abort();
+	}
+}
+
+int main(int argc, char **argv)
+{
+	static struct host_handshake_pair pair;
+	uint64_t budget_ns = host_full_run(argc, argv) ? 2000000000ULL : 100000000ULL;
+	struct host_bench_result handshake;
+	double per_handshake;
+	double cycles[ARRAY_SIZE(impls)];
+	double saved;
+	size_t x;
+	int n;
+
+	srand(13);
+	check_equivalence();
+
+	CHECK(host_handshake_pair_init(&pair));
+	compressions = 0;
+	for (n = 0; n < HANDSHAKES; n++) {
+		CHECK(host_handshake_run(&pair));
+		CHECK(host_handshake_keys_match(&pair));
+	}
+	per_handshake = (double)compressions / HANDSHAKES;
+	printf("compressions per handshake: %.1f\n", per_handshake);
+	// Every step of the handshake hashes, so a count this low means the wrapping missed calls
+	CHECK(per_handshake >= 30);
+
+	for (x = 0; x < ARRAY_SIZE(impls); x++) {
+		cycles[x] = cycles_per_compression(impls[x].fn, budget_ns / ARRAY_SIZE(impls));
+		printf("%-18s %6.1f cycles per compression, %8.0f per handshake\n",
+			impls[x].name, cycles[x], cycles[x] * per_handshake);
+	}
+	CHECK(cycles[1] < cycles[0]);
+	CHECK(cycles[2] < cycles[0]);
+
+	handshake = host_bench(run_handshake, &pair, budget_ns);
+	saved = (cycles[0] - cycles[2]) * per_handshake;
+	printf("handshake: %.1f us, %.0f cycles; BLAKE2s saves %.0f cycles per handshake (%.2f%%)\n",
+		handshake.ns / 1e3, handshake.cycles, saved, 100.0 * saved / (handshake.cycles + saved));
+
+	return host_test_result("bench_blake2s");
+}
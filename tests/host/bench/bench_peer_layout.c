@@ -0,0 +1,277 @@
+/*
+ * Copyright (c) 2024 Chunghan Yi <chunghan.yi@gmail.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*
+ * Footprint and cache misses of the peer records before and after the split
+ * into a session record (wireguard_device.peers) and an identity record
+ * (wireguard_device.peer_identities). The layout before the split is kept
+ * here as struct legacy_peer.
+ *
+ * Neither the target nor this host harness has hardware cache counters to
+ * read, so misses are modelled as distinct 64 byte lines touched, and the
+ * cold and warm timings are there to show the model is not contradicted by
+ * the machine. Two line counts are reported, which answer different
+ * questions:
+ *
+ * - lines per aligned peer: one peer record starting on a line boundary,
+ *   with the timer state of the peer and the header of each of its three
+ *   keypairs (including the keypair's last_tx/last_rx). This is the budget
+ *   the _Static_asserts in wireguard.h guard: 8 lines before the split, 4
+ *   after.
+ * - lines per peer in the sweep: what wireguardif_tmr() actually reads for
+ *   every peer when nothing is due, over all CONFIG_WIREGUARD_MAX_PEERS
+ *   (1024) peers packed in the array, where records straddle line
+ *   boundaries. The total is the misses of one sweep from a cold cache, and
+ *   the average is lower than the aligned figure because fewer fields are
+ *   read (5.88 before, 4.12 after with the host's replay window).
+ *
+ * The sweep is also timed per peer with a cold and a warm cache.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <zephyr/kernel.h>
+
+#include "host_test.h"
+#include "wireguard.h"
+
+#define CACHE_LINE	(64)
+// Larger than the last level cache of the host, walked between cold sweeps
+#define EVICT_SIZE	(64 * 1024 * 1024)
+
+// struct wireguard_keypair and struct wireguard_peer before the split
+struct legacy_keypair {
+	bool valid;
+	bool initiator;
+	uint32_t keypair_millis;
+
+	uint8_t sending_key[WIREGUARD_SESSION_KEY_LEN];
+	bool sending_valid;
+	uint64_t sending_counter;
+
+	uint8_t receiving_key[WIREGUARD_SESSION_KEY_LEN];
+	bool receiving_valid;
+
+	uint32_t last_tx;
+	uint32_t last_rx;
+
+	uint32_t replay_bitmap[WIREGUARD_REPLAY_WORDS];
+	uint64_t replay_counter;
+
+	uint32_t local_index;
+	uint32_t remote_index;
+};
+
+struct legacy_peer {
+	bool valid;
+	bool active;
+
+	ip_addr_t connect_ip;
+	u16_t connect_port;
+	ip_addr_t ip;
+	u16_t port;
+	uint16_t keepalive_interval;
+
+	uint8_t public_key[WIREGUARD_PUBLIC_KEY_LEN];
+	uint8_t preshared_key[WIREGUARD_SESSION_KEY_LEN];
+	uint8_t public_key_dh[WIREGUARD_PUBLIC_KEY_LEN];
+
+	struct legacy_keypair curr_keypair;
+	struct legacy_keypair prev_keypair;
+	struct legacy_keypair next_keypair;
+
+	uint8_t greatest_timestamp[WIREGUARD_TAI64N_LEN];
+
+	struct wireguard_handshake handshake;
+
+	uint32_t cookie_millis;
+	uint8_t cookie[WIREGUARD_COOKIE_LEN];
+
+	bool handshake_mac1_valid;
+	uint8_t handshake_mac1[WIREGUARD_COOKIE_LEN];
+
+	uint8_t label_cookie_key[WIREGUARD_SESSION_KEY_LEN];
+	uint8_t label_mac1_key[WIREGUARD_SESSION_KEY_LEN];
+
+	uint32_t last_initiation_rx;
+	uint32_t last_initiation_tx;
+
+	uint32_t last_tx;
+	uint32_t last_rx;
+
+	bool send_handshake;
+};
+
+// What wireguardif_tmr() reads of a peer when nothing is due; both layouts use the same names
+#define TIMER_FIELDS(X) \
+	X(valid) X(active) X(send_handshake) X(keepalive_interval) X(last_tx) X(last_initiation_tx) \
+	X(curr_keypair.valid) X(curr_keypair.initiator) X(curr_keypair.keypair_millis) \
+	X(curr_keypair.sending_counter) X(prev_keypair.valid) X(next_keypair.valid)
+
+// The timer state of one peer: its own fields and the header of each keypair
+#define KEYPAIR_HEADER(X, keypair) \
+	X(keypair.valid) X(keypair.initiator) X(keypair.keypair_millis) X(keypair.sending_counter) \
+	X(keypair.last_tx) X(keypair.last_rx)
+#define PEER_FIELDS(X) \
+	X(valid) X(active) X(send_handshake) X(keepalive_interval) X(last_tx) X(last_rx) X(last_initiation_tx) \
+	KEYPAIR_HEADER(X, curr_keypair) KEYPAIR_HEADER(X, prev_keypair) KEYPAIR_HEADER(X, next_keypair)
+
+#define LEGACY_OFFSET(field)	offsetof(struct legacy_peer, field),
+#define SPLIT_OFFSET(field)	offsetof(struct wireguard_peer, field),
+#define READ_FIELD(field)	sum += (uint64_t)peer->field;
+
+static const size_t legacy_offsets[] = { TIMER_FIELDS(LEGACY_OFFSET) };
+static const size_t split_offsets[] = { TIMER_FIELDS(SPLIT_OFFSET) };
+static const size_t legacy_peer_offsets[] = { PEER_FIELDS(LEGACY_OFFSET) };
+static const size_t split_peer_offsets[] = { PEER_FIELDS(SPLIT_OFFSET) };
+
+static struct legacy_peer legacy_peers[WIREGUARD_MAX_PEERS] __attribute__((aligned(CACHE_LINE)));
+static struct wireguard_peer split_peers[WIREGUARD_MAX_PEERS] __attribute__((aligned(CACHE_LINE)));
+static uint8_t *evict;
+
+static void sweep_legacy(void *arg)
+{
+	const struct legacy_peer *peer;
+	uint64_t sum = 0;
+	size_t x;
+
+	ARG_UNUSED(arg);
+	for (x = 0; x < WIREGUARD_MAX_PEERS; x++) {
+		peer = &legacy_peers[x];
+		TIMER_FIELDS(READ_FIELD)
+	}
+	host_consume((void *)(uintptr_t)sum);
+}
+
+static void sweep_split(void *arg)
+{
+	const struct wireguard_peer *peer;
+	uint64_t sum = 0;
+	size_t x;
+
+	ARG_UNUSED(arg);
+	for (x = 0; x < WIREGUARD_MAX_PEERS; x++) {
+		peer = &split_peers[x];
+		TIMER_FIELDS(READ_FIELD)
+	}
+	host_consume((void *)(uintptr_t)sum);
+}
+
+// Distinct cache lines touched reading the fields of the first peers of the array, which starts on a line boundary
+static size_t sweep_lines(size_t peer_size, const size_t *offsets, size_t count, size_t peers)
+{
+	static uint8_t seen[(WIREGUARD_MAX_PEERS * sizeof(struct legacy_peer) / CACHE_LINE) + 1];
+	size_t lines = 0;
+	size_t line;
+	size_t x;
+	size_t f;
+
+	memset(seen, 0, sizeof(seen));
+	for (x = 0; x < peers; x++) {
+		for (f = 0; f < count; f++) {
+			line = ((x * peer_size) + offsets[f]) / CACHE_LINE;
+			if (!seen[line]) {
+				seen[line] = 1;
+				lines++;
+			}
+		}
+	}
+	return lines;
+}
+
+// Best of the runs, with the caches flushed by walking a larger buffer before each
+static double cold_ns(void (*sweep)(void *arg), int runs)
+{
+	uint64_t best = UINT64_MAX;
+	uint64_t start;
+	uint64_t ns;
+	size_t x;
+	int r;
+
+	for (r = 0; r < runs; r++) {
+		for (x = 0; x < EVICT_SIZE; x += CACHE_LINE) {
+			evict[x]++;
+		}
+		start = host_now_ns();
+		sweep(NULL);
+		ns = host_now_ns() - start;
+		if (ns < best) {
+			best = ns;
+		}
+	}
+	return (double)best / WIREGUARD_MAX_PEERS;
+}
+
+static void fill(void)
+{
+	size_t x;
+
+	// Every peer valid with established sessions, so no field read is skipped
+	for (x = 0; x < WIREGUARD_MAX_PEERS; x++) {
+		legacy_peers[x].valid = split_peers[x].valid = true;
+		legacy_peers[x].active = split_peers[x].active = true;
+		legacy_peers[x].keepalive_interval = split_peers[x].keepalive_interval = 25;
+		legacy_peers[x].last_tx = split_peers[x].last_tx = (uint32_t)x;
+		legacy_peers[x].curr_keypair.valid = split_peers[x].curr_keypair.valid = true;
+		legacy_peers[x].curr_keypair.sending_counter = split_peers[x].curr_keypair.sending_counter = x;
+		legacy_peers[x].prev_keypair.valid = split_peers[x].prev_keypair.valid = true;
+	}
+}
+
+int main(int argc, char **argv)
+{
+	bool full = host_full_run(argc, argv);
+	uint64_t budget_ns = full ? 200000000ULL : 10000000ULL;
+	int runs = full ? 50 : 5;
+	size_t legacy_aligned;
+	size_t split_aligned;
+	size_t legacy_lines;
+	size_t split_lines;
+	double legacy_cold;
+	double split_cold;
+
+	evict = malloc(EVICT_SIZE);
+	CHECK(evict != NULL);
+	if (!evict) {
+		return host_test_result("bench_peer_layout");
+	}
+	memset(evict, 0, EVICT_SIZE);
+	fill();
+
+	legacy_aligned = sweep_lines(sizeof(struct legacy_peer), legacy_peer_offsets, ARRAY_SIZE(legacy_peer_offsets), 1);
+	split_aligned = sweep_lines(sizeof(struct wireguard_peer), split_peer_offsets, ARRAY_SIZE(split_peer_offsets), 1);
+	legacy_lines = sweep_lines(sizeof(struct legacy_peer), legacy_offsets, ARRAY_SIZE(legacy_offsets), WIREGUARD_MAX_PEERS);
+	split_lines = sweep_lines(sizeof(struct wireguard_peer), split_offsets, ARRAY_SIZE(split_offsets), WIREGUARD_MAX_PEERS);
+	legacy_cold = cold_ns(sweep_legacy, runs);
+	split_cold = cold_ns(sweep_split, runs);
+
+	printf("%d peers, %d packet replay window\n", WIREGUARD_MAX_PEERS, WIREGUARD_REPLAY_WINDOW);
+	printf("              keypair   peer  identity   all peers     lines per     sweep lines  misses per   ns per peer\n");
+	printf("                                                    aligned peer        per peer      sweep   cold   warm\n");
+	printf("before split  %7zu  %5zu  %8s  %10zu  %12zu  %14.2f  %10zu  %5.1f  %5.1f\n",
+		sizeof(struct legacy_keypair), sizeof(struct legacy_peer), "-",
+		WIREGUARD_MAX_PEERS * sizeof(struct legacy_peer), legacy_aligned, (double)legacy_lines / WIREGUARD_MAX_PEERS,
+		legacy_lines, legacy_cold, host_bench(sweep_legacy, NULL, budget_ns).ns / WIREGUARD_MAX_PEERS);
+	printf("after split   %7zu  %5zu  %8zu  %10zu  %12zu  %14.2f  %10zu  %5.1f  %5.1f\n",
+		sizeof(struct wireguard_keypair), sizeof(struct wireguard_peer), sizeof(struct wireguard_peer_identity),
+		WIREGUARD_MAX_PEERS * (sizeof(struct wireguard_peer) + sizeof(struct wireguard_peer_identity)),
+		split_aligned, (double)split_lines / WIREGUARD_MAX_PEERS, split_lines, split_cold,
+		host_bench(sweep_split, NULL, budget_ns).ns / WIREGUARD_MAX_PEERS);
+
+	// The split must not grow the peers, and both the aligned peer and the sweep must touch fewer lines than before.
+	// The aligned peer is what the budgets in wireguard.h promise: the peer's own line and one per keypair
+	CHECK((sizeof(struct wireguard_peer) + sizeof(struct wireguard_peer_identity)) <= sizeof(struct legacy_peer));
+	CHECK(sizeof(struct wireguard_keypair) <= sizeof(struct legacy_keypair));
+	CHECK(split_aligned <= 4);
+	CHECK(split_aligned < legacy_aligned);
+	CHECK(split_lines < legacy_lines);
+	// The hardware prefetcher hides much of the difference in time, so this only catches a regression
+	CHECK(split_cold < legacy_cold * 1.25);
+
+	free(evict);
+	return host_test_result("bench_peer_layout");
+}
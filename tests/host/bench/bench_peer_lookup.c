@@ -0,0 +1,199 @@
+/*
+ * Copyright (c) 2024 Chunghan Yi <chunghan.yi@gmail.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*
+ * Peer lookup cost from 1 to CONFIG_WIREGUARD_MAX_PEERS (1024) peers: by
+ * public key (initiations), by receiver index (transport data) and by
+ * handshake index (responses and cookie replies). Every peer has a session
+ * and a handshake in progress. The linear scans the hash tables replaced
+ * run on the same device for comparison. The hashed lookups must stay flat
+ * as the device fills up.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <zephyr/kernel.h>
+
+#include "host_test.h"
+#include "wireguard.h"
+#include "wireguard-platform.h"
+
+// Lookups per timed call, spread over all the peers
+#define BATCH		(1024)
+// The hashed lookups may cost at most this much more with every peer in use than with one
+#define MAX_GROWTH	(3.0)
+
+static struct wireguard_device device;
+static uint8_t public_keys[WIREGUARD_MAX_PEERS][WIREGUARD_PUBLIC_KEY_LEN];
+static uint8_t missing_keys[BATCH][WIREGUARD_PUBLIC_KEY_LEN];
+static uint32_t receivers[WIREGUARD_MAX_PEERS];
+static uint32_t handshakes[WIREGUARD_MAX_PEERS];
+static uint16_t picks[BATCH];
+
+// peer_lookup_by_pubkey() and peer_lookup_by_receiver() as they were before the tables
+static struct wireguard_peer *scan_by_pubkey(struct wireguard_device *device, const uint8_t *public_key)
+{
+	struct wireguard_peer *tmp;
+	size_t x;
+
+	for (x = 0; x < WIREGUARD_MAX_PEERS; x++) {
+		tmp = &device->peers[x];
+		if (tmp->valid && (memcmp(peer_identity(device, tmp)->public_key, public_key, WIREGUARD_PUBLIC_KEY_LEN) == 0)) {
+			return tmp;
+		}
+	}
+	return NULL;
+}
+
+static struct wireguard_peer *scan_by_receiver(struct wireguard_device *device, uint32_t receiver)
+{
+	struct wireguard_peer *tmp;
+	size_t x;
+
+	for (x = 0; x < WIREGUARD_MAX_PEERS; x++) {
+		tmp = &device->peers[x];
+		if (tmp->valid && get_peer_keypair_for_idx(tmp, receiver)) {
+			return tmp;
+		}
+	}
+	return NULL;
+}
+
+static void run_pubkey(void *arg)
+{
+	size_t x;
+
+	ARG_UNUSED(arg);
+	for (x = 0; x < BATCH; x++) {
+		host_consume(peer_lookup_by_pubkey(&device, public_keys[picks[x]]));
+	}
+}
+
+static void run_pubkey_missing(void *arg)
+{
+	size_t x;
+
+	ARG_UNUSED(arg);
+	for (x = 0; x < BATCH; x++) {
+		host_consume(peer_lookup_by_pubkey(&device, missing_keys[x]));
+	}
+}
+
+static void run_receiver(void *arg)
+{
+	size_t x;
+
+	ARG_UNUSED(arg);
+	for (x = 0; x < BATCH; x++) {
+		host_consume(peer_lookup_by_receiver(&device, receivers[picks[x]]));
+	}
+}
+
+static void run_handshake(void *arg)
+{
+	size_t x;
+
+	ARG_UNUSED(arg);
+	for (x = 0; x < BATCH; x++) {
+		host_consume(peer_lookup_by_handshake(&device, handshakes[picks[x]]));
+	}
+}
+
+static void run_scan_pubkey(void *arg)
+{
+	size_t x;
+
+	ARG_UNUSED(arg);
+	for (x = 0; x < BATCH; x++) {
+		host_consume(scan_by_pubkey(&device, public_keys[picks[x]]));
+	}
+}
+
+static void run_scan_receiver(void *arg)
+{
+	size_t x;
+
+	ARG_UNUSED(arg);
+	for (x = 0; x < BATCH; x++) {
+		host_consume(scan_by_receiver(&device, receivers[picks[x]]));
+	}
+}
+
+// Give the peer a session (receiver index) and start another handshake (handshake index)
+static bool add_peer(size_t n)
+{
+	struct message_handshake_initiation initiation;
+	struct wireguard_peer *peer = peer_alloc(&device);
+
+	wireguard_random_bytes(public_keys[n], WIREGUARD_PUBLIC_KEY_LEN);
+	if (!peer || (peer != &device.peers[n]) || !wireguard_peer_init(&device, peer, public_keys[n], NULL) ||
+		!wireguard_create_handshake_initiation(&device, peer, &initiation)) {
+		return false;
+	}
+	wireguard_start_session(&device, peer, true);
+	receivers[n] = peer->curr_keypair.local_index;
+	if (!wireguard_create_handshake_initiation(&device, peer, &initiation)) {
+		return false;
+	}
+	handshakes[n] = initiation.sender;
+	return true;
+}
+
+static double ns_per_lookup(void (*fn)(void *arg), uint64_t budget_ns)
+{
+	return host_bench(fn, NULL, budget_ns).ns / BATCH;
+}
+
+int main(int argc, char **argv)
+{
+	uint64_t budget_ns = host_full_run(argc, argv) ? 200000000ULL : 10000000ULL;
+	uint8_t private_key[WIREGUARD_PRIVATE_KEY_LEN];
+	double first[2] = { 0, 0 };
+	double pubkey;
+	double receiver;
+	size_t peers = 0;
+	size_t level;
+	size_t x;
+
+	srand(21);
+	wireguard_random_bytes(private_key, sizeof(private_key));
+	wireguard_init();
+	CHECK(wireguard_device_init(&device, private_key));
+	for (x = 0; x < BATCH; x++) {
+		wireguard_random_bytes(missing_keys[x], WIREGUARD_PUBLIC_KEY_LEN);
+	}
+
+	printf("  peers   ns per lookup: pubkey  (missing)  receiver  handshake   linear scan: pubkey  receiver\n");
+	for (level = 1; level <= WIREGUARD_MAX_PEERS; level *= 4) {
+		for (; peers < level; peers++) {
+			CHECK(add_peer(peers));
+		}
+		for (x = 0; x < BATCH; x++) {
+			picks[x] = (uint16_t)((size_t)rand() % peers);
+			CHECK(peer_lookup_by_pubkey(&device, public_keys[picks[x]]) == &device.peers[picks[x]]);
+			CHECK(peer_lookup_by_receiver(&device, receivers[picks[x]]) == &device.peers[picks[x]]);
+			CHECK(peer_lookup_by_handshake(&device, handshakes[picks[x]]) == &device.peers[picks[x]]);
+		}
+
+		pubkey = ns_per_lookup(run_pubkey, budget_ns);
+		receiver = ns_per_lookup(run_receiver, budget_ns);
+		printf("%7zu   %21.1f  %9.1f  %8.1f  %9.1f   %19.1f  %8.1f\n", peers, pubkey,
+			ns_per_lookup(run_pubkey_missing, budget_ns), receiver, ns_per_lookup(run_handshake, budget_ns),
+			ns_per_lookup(run_scan_pubkey, budget_ns), ns_per_lookup(run_scan_receiver, budget_ns));
+		if (peers == 1) {
+			first[0] = pubkey;
+			first[1] = receiver;
+		}
+		if (level * 4 > WIREGUARD_MAX_PEERS) {
+			break;
+		}
+	}
+
+	CHECK(pubkey < MAX_GROWTH * first[0]);
+	CHECK(receiver < MAX_GROWTH * first[1]);
+	return host_test_result("bench_peer_lookup");
+}
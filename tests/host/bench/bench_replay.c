@@ -0,0 +1,145 @@
+/*
+ * Copyright (c) 2024 Chunghan Yi <chunghan.yi@gmail.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*
+ * Goodput of the replay window under synthetic reordering: the share of
+ * packets that arrive out of order (as Wi-Fi A-MPDU reordering or parallel
+ * decryption delivers them) and are still accepted. Each packet is delayed
+ * by a random number of packet slots below the reordering depth, so depth 1
+ * is in order delivery. The RFC 6479 ring is compared with the 4 packet
+ * RFC 2401 window it replaced, and the time per check is reported too.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <zephyr/kernel.h>
+
+#include "host_test.h"
+#include "wireguard.h"
+
+// wireguard_check_replay() before the ring: the window size was sizeof(replay_bitmap), so 4 packets
+struct rfc2401_window {
+	uint64_t replay_counter;
+	uint32_t replay_bitmap;
+};
+
+static bool rfc2401_check_replay(struct rfc2401_window *keypair, uint64_t seq)
+{
+	uint64_t diff;
+	bool result = false;
+	size_t ReplayWindowSize = sizeof(keypair->replay_bitmap); // 32 bits
+
+	if (seq != 0) {
+		if (seq > keypair->replay_counter) {
+			// new larger sequence number
+			diff = seq - keypair->replay_counter;
+			if (diff < ReplayWindowSize) {
+				// In window
+				keypair->replay_bitmap <<= diff;
+				// set bit for this packet
+				keypair->replay_bitmap |= 1;
+			} else {
+				// This packet has a "way larger"
+				keypair->replay_bitmap = 1;
+			}
+			keypair->replay_counter = seq;
+			result = true;
+		} else {
+			diff = keypair->replay_counter - seq;
+			if ((diff < ReplayWindowSize) && !(keypair->replay_bitmap & ((uint32_t)1 << diff))) {
+				// mark as seen
+				keypair->replay_bitmap |= ((uint32_t)1 << diff);
+				result = true;
+			}
+		}
+	}
+	return result;
+}
+
+struct arrival {
+	uint64_t slot;
+	uint64_t seq;
+};
+
+static int arrival_compare(const void *a, const void *b)
+{
+	const struct arrival *x = a;
+	const struct arrival *y = b;
+
+	if (x->slot != y->slot) {
+		return (x->slot < y->slot) ? -1 : 1;
+	}
+	return (x->seq < y->seq) ? -1 : (x->seq > y->seq);
+}
+
+// Counter i is sent in slot i and arrives in slot i + [0, depth); counters start at 1, which both windows take
+static void reorder(struct arrival *packets, size_t count, uint32_t depth)
+{
+	size_t x;
+
+	for (x = 0; x < count; x++) {
+		packets[x].seq = x + 1;
+		packets[x].slot = x + ((uint32_t)rand() % depth);
+	}
+	qsort(packets, count, sizeof(packets[0]), arrival_compare);
+}
+
+int main(int argc, char **argv)
+{
+	static const uint32_t depths[] = { 1, 4, 16, 64, 256, WIREGUARD_REPLAY_WINDOW };
+	size_t count = host_full_run(argc, argv) ? 20000000 : 1000000;
+	struct arrival *packets = malloc(count * sizeof(*packets));
+	static struct wireguard_keypair keypair;
+	struct rfc2401_window old;
+	size_t accepted_old;
+	size_t accepted_ring;
+	uint64_t ns_old;
+	uint64_t ns_ring;
+	uint64_t start;
+	size_t d;
+	size_t x;
+
+	CHECK(packets != NULL);
+	if (!packets) {
+		return host_test_result("bench_replay");
+	}
+	srand(20);
+	printf("reordering depth   accepted: 4 packet window, %d packet ring   ns per check\n",
+		WIREGUARD_REPLAY_WINDOW);
+	for (d = 0; d < ARRAY_SIZE(depths); d++) {
+		reorder(packets, count, depths[d]);
+
+		memset(&old, 0, sizeof(old));
+		accepted_old = 0;
+		start = host_now_ns();
+		for (x = 0; x < count; x++) {
+			accepted_old += rfc2401_check_replay(&old, packets[x].seq);
+		}
+		ns_old = host_now_ns() - start;
+
+		memset(&keypair, 0, sizeof(keypair));
+		accepted_ring = 0;
+		start = host_now_ns();
+		for (x = 0; x < count; x++) {
+			accepted_ring += wireguard_replay_commit(&keypair, packets[x].seq);
+		}
+		ns_ring = host_now_ns() - start;
+
+		printf("%16u   %27.2f%%, %15.2f%%   %5.2f, %5.2f\n", depths[d],
+			100.0 * (double)accepted_old / (double)count, 100.0 * (double)accepted_ring / (double)count,
+			(double)ns_old / (double)count, (double)ns_ring / (double)count);
+
+		// Nothing is ever delayed by a full window, so the ring must take every packet
+		CHECK(accepted_ring == count);
+		if (depths[d] >= 16) {
+			CHECK(accepted_old < accepted_ring);
+		}
+	}
+
+	free(packets);
+	return host_test_result("bench_replay");
+}
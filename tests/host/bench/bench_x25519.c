@@ -0,0 +1,187 @@
+/*
+ * Copyright (c) 2024 Chunghan Yi <chunghan.yi@gmail.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*
+ * Handshake latency per X25519 backend. The core calls x25519() through the
+ * builtin provider; wrapping it (-Wl,--wrap) lets the same handshake run on
+ * either build of src/crypto/x25519.c:
+ *
+ *   32 bit limbs - what every Cortex-M build gets
+ *   64 bit limbs - picked automatically where the compiler has __int128
+ *
+ * Both must pass the RFC 7748 vectors and agree on random inputs.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <zephyr/kernel.h>
+
+#include "host_test.h"
+#include "handshake.h"
+#include "x25519.h"
+
+// Best of this many runs, to keep other load on the host out of the ratios
+#define RUNS		(3)
+#define HANDSHAKES	(10)
+
+int x25519_w32(uint8_t *out, const uint8_t *scalar, const uint8_t *point, int clamp);
+int __real_x25519(uint8_t *out, const uint8_t *scalar, const uint8_t *point, int clamp);
+
+typedef int (*x25519_fn)(uint8_t *out, const uint8_t *scalar, const uint8_t *point, int clamp);
+
+static const struct {
+	const char *name;
+	x25519_fn fn;
+} backends[] = {
+	{ "32 bit limbs", x25519_w32 },
+	{ "64 bit limbs", __real_x25519 },
+};
+
+static x25519_fn backend = __real_x25519;
+static uint64_t calls;
+
+int __wrap_x25519(uint8_t *out, const uint8_t *scalar, const uint8_t *point, int clamp)
+{
+	calls++;
+	return backend(out, scalar, point, clamp);
+}
+
+static void check_vectors(x25519_fn fn)
+{
+	// RFC 7748 5.2 and 6.1
+	static const char *vectors[][3] = {
+		{ "a546e36bf0527c9d3b16154b82465edd62144c0ac1fc5a18506a2244ba449ac4",
+		  "e6db6867583030db3594c1a424b15f7c726624ec26b3353b10a903a6d0ab1c4c",
+		  "c3da55379de9c6908e94ea4df28d084f32eccf03491c71f754b4075577a28552" },
+		{ "4b66e9d4d1b4673c5ad22691957d6af5c11b6421e0ea01d42ca4169e7918ba0d",
+		  "e5210f12786811d3f4b7959d0538ae2c31dbe7106fc03c3efc4cd549c715a493",
+		  "95cbde9476e8907d7aade45cb4b873f88b595a68799fa152e6f8f7647aac7957" },
+		{ "77076d0a7318a57d3c16c17251b26645df4c2f87ebc0992ab177fba51db92c2a",
+		  "0900000000000000000000000000000000000000000000000000000000000000",
+		  "8520f0098930a754748b7ddcb43ef75a0dbf3a0d26381af4eba4a98eaa9b4e6a" },
+		{ "5dab087e624a8a4b79e17f8b83800ee66f3bb1292618b6fd1c2f8b27ff88e0eb",
+		  "0900000000000000000000000000000000000000000000000000000000000000",
+		  "de9edb7d7b7dc1b4d35b61c2ece435373f8343c85b78674dadfc7e146f882b4f" },
+		{ "77076d0a7318a57d3c16c17251b26645df4c2f87ebc0992ab177fba51db92c2a",
+		  "de9edb7d7b7dc1b4d35b61c2ece435373f8343c85b78674dadfc7e146f882b4f",
+		  "4a5d9d5ba4ce2de1728e3bf480350f25e07e21c947d19e3376f09b3c1e161742" },
+	};
+	uint8_t scalar[32];
+	uint8_t point[32];
+	uint8_t expected[32];
+	uint8_t out[32];
+	size_t x;
+
+	for (x = 0; x < ARRAY_SIZE(vectors); x++) {
+		host_hex(scalar, vectors[x][0]);
+		host_hex(point, vectors[x][1]);
+		host_hex(expected, vectors[x][2]);
+		// RFC 7748 ignores the top bit of u, this implementation does not
+		point[31] &= 0x7f;
+		CHECK(fn(out, scalar, point, 1) == 0);
+		CHECK_MEM(out, expected, 32);
+	}
+}
+
+static void check_equivalence(void)
+{
+	uint8_t scalar[32];
+	uint8_t point[32];
+	uint8_t out[ARRAY_SIZE(backends)][32];
+	int ret[ARRAY_SIZE(backends)];
+	size_t x;
+	int trial;
+
+	for (trial = 0; trial < 500; trial++) {
+		for (x = 0; x < 32; x++) {
+			scalar[x] = (uint8_t)rand();
+			point[x] = (uint8_t)rand();
+		}
+		point[31] &= 0x7f;
+		for (x = 0; x < ARRAY_SIZE(backends); x++) {
+			ret[x] = backends[x].fn(out[x], scalar, point, 1);
+		}
+		CHECK(ret[1] == ret[0]);
+		CHECK_MEM(out[1], out[0], 32);
+	}
+}
+
+static uint8_t bench_scalar[32];
+static uint8_t bench_point[32] = { 9 };
+
+static void run_x25519(void *arg)
+{
+	uint8_t out[32];
+
+	ARG_UNUSED(arg);
+	backend(out, bench_scalar, bench_point, 1);
+	host_consume(out);
+}
+
+static void run_handshake(void *arg)
+{
+	if (!host_handshake_run(arg)) {
+		abort();
+	}
+}
+
+static struct host_bench_result best_of(void (*fn)(void *arg), void *arg, uint64_t budget_ns)
+{
+	struct host_bench_result best = { 1e30, 1e30 };
+	struct host_bench_result result;
+	int run;
+
+	for (run = 0; run < RUNS; run++) {
+		result = host_bench(fn, arg, budget_ns);
+		if (result.ns < best.ns) {
+			best = result;
+		}
+	}
+	return best;
+}
+
+int main(int argc, char **argv)
+{
+	static struct host_handshake_pair pair;
+	uint64_t budget_ns = host_full_run(argc, argv) ? 2000000000ULL : 100000000ULL;
+	struct host_bench_result mult[ARRAY_SIZE(backends)];
+	struct host_bench_result handshake[ARRAY_SIZE(backends)];
+	double per_handshake;
+	size_t x;
+	int n;
+
+	srand(15);
+	for (x = 0; x < ARRAY_SIZE(backends); x++) {
+		check_vectors(backends[x].fn);
+	}
+	check_equivalence();
+	for (x = 0; x < sizeof(bench_scalar); x++) {
+		bench_scalar[x] = (uint8_t)rand();
+	}
+
+	CHECK(host_handshake_pair_init(&pair));
+	for (x = 0; x < ARRAY_SIZE(backends); x++) {
+		backend = backends[x].fn;
+		calls = 0;
+		for (n = 0; n < HANDSHAKES; n++) {
+			CHECK(host_handshake_run(&pair));
+			CHECK(host_handshake_keys_match(&pair));
+		}
+		per_handshake = (double)calls / HANDSHAKES;
+
+		mult[x] = best_of(run_x25519, NULL, budget_ns / 4);
+		handshake[x] = best_of(run_handshake, &pair, budget_ns / 2);
+		printf("%-13s %7.1f us (%8.0f cycles) per scalar multiplication, %.1f per handshake;"
+			" handshake %7.1f us (%8.0f cycles)\n",
+			backends[x].name, mult[x].ns / 1e3, mult[x].cycles, per_handshake,
+			handshake[x].ns / 1e3, handshake[x].cycles);
+	}
+	printf("64 bit limbs: handshake x%.2f faster\n", handshake[0].ns / handshake[1].ns);
+	CHECK(handshake[1].ns < handshake[0].ns);
+
+	return host_test_result("bench_x25519");
+}
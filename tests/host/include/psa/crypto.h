@@ -0,0 +1,100 @@
+/*
+ * Copyright (c) 2024 Chunghan Yi <chunghan.yi@gmail.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*
+ * The part of the PSA Crypto API src/crypto-psa.c uses, for building the
+ * PSA provider against the host's mbedTLS 2.28 library when its headers
+ * are not installed. Types, values and psa_key_attributes_t are laid out
+ * as in mbedTLS 2.28 built without MBEDTLS_PSA_CRYPTO_SE_C and without
+ * MBEDTLS_PSA_CRYPTO_KEY_ID_ENCODES_OWNER, the distribution default.
+ */
+
+#ifndef HOST_PSA_CRYPTO_H_
+#define HOST_PSA_CRYPTO_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+typedef int32_t psa_status_t;
+typedef uint16_t psa_key_type_t;
+typedef uint16_t psa_key_bits_t;
+typedef uint32_t psa_key_lifetime_t;
+typedef uint32_t psa_key_id_t;
+typedef uint32_t psa_key_usage_t;
+typedef uint32_t psa_algorithm_t;
+typedef uint8_t psa_ecc_family_t;
+
+#define PSA_SUCCESS ((psa_status_t)0)
+
+#define PSA_KEY_TYPE_CHACHA20 ((psa_key_type_t)0x2004)
+#define PSA_ECC_FAMILY_MONTGOMERY ((psa_ecc_family_t)0x41)
+#define PSA_KEY_TYPE_ECC_KEY_PAIR(curve) ((psa_key_type_t)(0x7100 | (curve)))
+
+#define PSA_KEY_USAGE_ENCRYPT ((psa_key_usage_t)0x00000100)
+#define PSA_KEY_USAGE_DECRYPT ((psa_key_usage_t)0x00000200)
+#define PSA_KEY_USAGE_DERIVE ((psa_key_usage_t)0x00004000)
+
+#define PSA_ALG_CHACHA20_POLY1305 ((psa_algorithm_t)0x05100500)
+#define PSA_ALG_ECDH ((psa_algorithm_t)0x09020000)
+
+typedef struct {
+	psa_key_type_t type;
+	psa_key_bits_t bits;
+	psa_key_lifetime_t lifetime;
+	psa_key_id_t id;
+	struct {
+		psa_key_usage_t usage;
+		psa_algorithm_t alg;
+		psa_algorithm_t alg2;
+	} policy;
+	uint16_t flags;
+} psa_core_key_attributes_t;
+
+typedef struct psa_key_attributes_s {
+	psa_core_key_attributes_t core;
+	void *domain_parameters;
+	size_t domain_parameters_size;
+} psa_key_attributes_t;
+
+#define PSA_KEY_ATTRIBUTES_INIT ((psa_key_attributes_t){ 0 })
+
+/* Inline in the mbedTLS headers, so they have to be here too */
+static inline void psa_set_key_type(psa_key_attributes_t *attributes, psa_key_type_t type)
+{
+	attributes->core.type = type;
+}
+
+static inline void psa_set_key_bits(psa_key_attributes_t *attributes, size_t bits)
+{
+	attributes->core.bits = (psa_key_bits_t)bits;
+}
+
+static inline void psa_set_key_usage_flags(psa_key_attributes_t *attributes, psa_key_usage_t usage)
+{
+	attributes->core.policy.usage = usage;
+}
+
+static inline void psa_set_key_algorithm(psa_key_attributes_t *attributes, psa_algorithm_t alg)
+{
+	attributes->core.policy.alg = alg;
+}
+
+psa_status_t psa_crypto_init(void);
+void psa_reset_key_attributes(psa_key_attributes_t *attributes);
+psa_status_t psa_import_key(const psa_key_attributes_t *attributes, const uint8_t *data, size_t data_length,
+	psa_key_id_t *key);
+psa_status_t psa_destroy_key(psa_key_id_t key);
+psa_status_t psa_aead_encrypt(psa_key_id_t key, psa_algorithm_t alg, const uint8_t *nonce, size_t nonce_length,
+	const uint8_t *additional_data, size_t additional_data_length, const uint8_t *plaintext,
+	size_t plaintext_length, uint8_t *ciphertext, size_t ciphertext_size, size_t *ciphertext_length);
+psa_status_t psa_aead_decrypt(psa_key_id_t key, psa_algorithm_t alg, const uint8_t *nonce, size_t nonce_length,
+	const uint8_t *additional_data, size_t additional_data_length, const uint8_t *ciphertext,
+	size_t ciphertext_length, uint8_t *plaintext, size_t plaintext_size, size_t *plaintext_length);
+psa_status_t psa_raw_key_agreement(psa_algorithm_t alg, psa_key_id_t private_key, const uint8_t *peer_key,
+	size_t peer_key_length, uint8_t *output, size_t output_size, size_t *output_length);
+psa_status_t psa_generate_random(uint8_t *output, size_t output_size);
+
+#endif /* HOST_PSA_CRYPTO_H_ */
@@ -0,0 +1,160 @@
+/*
+ * Copyright (c) 2024 Chunghan Yi <chunghan.yi@gmail.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*
+ * The parts of the Zephyr kernel API the WireGuard sources use, for host
+ * test programs. The tests are single threaded: spinlocks only count
+ * nesting, work items run when they are submitted, and there is no ISR.
+ */
+
+#ifndef HOST_ZEPHYR_KERNEL_H_
+#define HOST_ZEPHYR_KERNEL_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#define ARG_UNUSED(x) (void)(x)
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
+#define ROUND_UP(x, align) ((((x) + ((align) - 1)) / (align)) * (align))
+#define CONTAINER_OF(ptr, type, field) ((type *)(((char *)(ptr)) - offsetof(type, field)))
+#ifndef MIN
+#define MIN(a, b) (((a) < (b)) ? (a) : (b))
+#endif
+#ifndef MAX
+#define MAX(a, b) (((a) > (b)) ? (a) : (b))
+#endif
+#define IS_ENABLED(option) 0
+#define BUILD_ASSERT(cond, ...) _Static_assert(cond, "" __VA_ARGS__)
+
+/* Atomics */
+typedef long atomic_t;
+typedef long atomic_val_t;
+#define ATOMIC_INIT(x) (x)
+
+static inline atomic_val_t atomic_inc(atomic_t *a) { return __atomic_fetch_add(a, 1, __ATOMIC_SEQ_CST); }
+static inline atomic_val_t atomic_dec(atomic_t *a) { return __atomic_fetch_sub(a, 1, __ATOMIC_SEQ_CST); }
+static inline atomic_val_t atomic_add(atomic_t *a, atomic_val_t v) { return __atomic_fetch_add(a, v, __ATOMIC_SEQ_CST); }
+static inline atomic_val_t atomic_get(const atomic_t *a) { return __atomic_load_n(a, __ATOMIC_SEQ_CST); }
+static inline atomic_val_t atomic_set(atomic_t *a, atomic_val_t v) { return __atomic_exchange_n(a, v, __ATOMIC_SEQ_CST); }
+static inline atomic_val_t atomic_clear(atomic_t *a) { return atomic_set(a, 0); }
+
+/* Timeouts */
+typedef struct {
+	int64_t ms;
+} k_timeout_t;
+
+#define K_NO_WAIT ((k_timeout_t){ 0 })
+#define K_FOREVER ((k_timeout_t){ -1 })
+#define K_MSEC(x) ((k_timeout_t){ (x) })
+#define K_USEC(x) ((k_timeout_t){ ((x) + 999) / 1000 })
+#define K_SECONDS(x) ((k_timeout_t){ (x) * 1000 })
+
+/* Spinlocks - only the nesting depth is kept, for tests that check a lock is held */
+struct k_spinlock {
+	int depth;
+};
+
+typedef struct {
+	int key;
+} k_spinlock_key_t;
+
+static inline k_spinlock_key_t k_spin_lock(struct k_spinlock *l)
+{
+	k_spinlock_key_t key = { l->depth++ };
+	return key;
+}
+
+static inline void k_spin_unlock(struct k_spinlock *l, k_spinlock_key_t key)
+{
+	l->depth = key.key;
+}
+
+/* Context */
+bool k_is_in_isr(void);
+uint32_t k_cycle_get_32(void);
+uint32_t k_cyc_to_us_floor32(uint32_t cycles);
+int64_t k_uptime_get(void);
+int32_t k_sleep(k_timeout_t timeout);
+#define k_panic() abort()
+
+/* Memory slabs */
+struct k_mem_slab {
+	size_t block_size;
+	uint32_t num_blocks;
+	uint32_t num_used;
+	uint32_t num_carved;
+	char *buffer;
+	void *free_list;
+};
+
+#define K_MEM_SLAB_DEFINE_STATIC(name, size, count, align)				\
+	static char __attribute__((aligned(align))) _k_mem_slab_buf_##name[(size) * (count)];	\
+	static struct k_mem_slab name = { (size), (count), 0, 0, _k_mem_slab_buf_##name, NULL }
+
+int k_mem_slab_alloc(struct k_mem_slab *slab, void **mem, k_timeout_t timeout);
+void k_mem_slab_free(struct k_mem_slab *slab, void *mem);
+uint32_t k_mem_slab_num_used_get(struct k_mem_slab *slab);
+
+/* Work items - run synchronously on submit, delayed ones by k_host_run_delayed() */
+struct k_work;
+typedef void (*k_work_handler_t)(struct k_work *work);
+
+struct k_work {
+	k_work_handler_t handler;
+};
+
+struct k_work_delayable {
+	struct k_work work;
+	bool pending;
+};
+
+struct k_work_q {
+	int unused;
+};
+
+#define K_THREAD_STACK_DEFINE(name, size) char name[size]
+#define K_THREAD_STACK_SIZEOF(name) sizeof(name)
+#define K_LOWEST_APPLICATION_THREAD_PRIO 14
+
+void k_work_init(struct k_work *work, k_work_handler_t handler);
+int k_work_submit(struct k_work *work);
+int k_work_submit_to_queue(struct k_work_q *queue, struct k_work *work);
+int k_work_cancel(struct k_work *work);
+void k_work_queue_start(struct k_work_q *queue, void *stack, size_t size, int prio, const void *cfg);
+void k_work_init_delayable(struct k_work_delayable *dwork, k_work_handler_t handler);
+int k_work_schedule(struct k_work_delayable *dwork, k_timeout_t delay);
+int k_work_reschedule(struct k_work_delayable *dwork, k_timeout_t delay);
+int k_work_cancel_delayable(struct k_work_delayable *dwork);
+struct k_work_delayable *k_work_delayable_from_work(struct k_work *work);
+
+/* Run every delayed work item that is pending, returns how many ran */
+int k_host_run_delayed(void);
+/* Pretend the caller is (or stops being) an interrupt handler */
+void k_host_set_isr(bool in_isr);
+
+/* FIFOs */
+struct k_fifo {
+	void *head;
+	void *tail;
+};
+
+#define K_FIFO_DEFINE(name) struct k_fifo name
+
+void k_fifo_init(struct k_fifo *fifo);
+void k_fifo_put(struct k_fifo *fifo, void *data);
+void *k_fifo_get(struct k_fifo *fifo, k_timeout_t timeout);
+int k_fifo_is_empty(struct k_fifo *fifo);
+
+/* Timers are driven by the tests calling the expiry function themselves */
+struct k_timer {
+	int unused;
+};
+
+#endif /* HOST_ZEPHYR_KERNEL_H_ */
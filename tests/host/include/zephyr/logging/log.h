@@ -0,0 +1,36 @@
+/*
+ * Copyright (c) 2024 Chunghan Yi <chunghan.yi@gmail.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/* Logging compiles to nothing on the host, but the arguments are still type checked */
+
+#ifndef HOST_ZEPHYR_LOGGING_LOG_H_
+#define HOST_ZEPHYR_LOGGING_LOG_H_
+
+#include <stdio.h>
+
+#define LOG_LEVEL_NONE 0
+#define LOG_LEVEL_ERR 1
+#define LOG_LEVEL_WRN 2
+#define LOG_LEVEL_INF 3
+#define LOG_LEVEL_DBG 4
+
+#define LOG_MODULE_REGISTER(name, ...) extern int log_module_##name
+#define LOG_MODULE_DECLARE(name, ...) extern int log_module_##name
+
+#define HOST_LOG_DISCARD(...)				\
+	do {						\
+		if (0) {				\
+			printf(__VA_ARGS__);		\
+		}					\
+	} while (0)
+
+#define LOG_ERR(...) HOST_LOG_DISCARD(__VA_ARGS__)
+#define LOG_WRN(...) HOST_LOG_DISCARD(__VA_ARGS__)
+#define LOG_INF(...) HOST_LOG_DISCARD(__VA_ARGS__)
+#define LOG_DBG(...) HOST_LOG_DISCARD(__VA_ARGS__)
+#define LOG_HEXDUMP_DBG(data, len, str) HOST_LOG_DISCARD("%p %zu %s", (const void *)(data), (size_t)(len), str)
+
+#endif /* HOST_ZEPHYR_LOGGING_LOG_H_ */
@@ -0,0 +1,41 @@
+/*
+ * Copyright (c) 2024 Chunghan Yi <chunghan.yi@gmail.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/* Network interface stand-ins; the UDP socket API is the host's own */
+
+#ifndef HOST_ZEPHYR_NET_NET_CORE_H_
+#define HOST_ZEPHYR_NET_NET_CORE_H_
+
+#include <stdbool.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+enum net_verdict {
+	NET_OK,
+	NET_CONTINUE,
+	NET_DROP,
+};
+
+struct net_if {
+	bool up;
+};
+
+static inline bool net_if_is_up(struct net_if *iface)
+{
+	return iface && iface->up;
+}
+
+static inline int net_if_up(struct net_if *iface)
+{
+	if (iface) {
+		iface->up = true;
+	}
+	return 0;
+}
+
+#endif /* HOST_ZEPHYR_NET_NET_CORE_H_ */
@@ -0,0 +1,43 @@
+/*
+ * Copyright (c) 2024 Chunghan Yi <chunghan.yi@gmail.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*
+ * Single fragment net_pkt for the host tests. Only the calls made by the
+ * receive and transmit paths are provided.
+ */
+
+#ifndef HOST_ZEPHYR_NET_NET_PKT_H_
+#define HOST_ZEPHYR_NET_NET_PKT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <zephyr/kernel.h>
+#include <zephyr/net/net_core.h>
+
+struct net_buf {
+	struct net_buf *frags;
+	uint8_t *data;
+	uint16_t len;
+	uint16_t size;
+};
+
+struct net_pkt {
+	// Used by k_fifo, as in Zephyr
+	void *fifo;
+	struct net_buf *buffer;
+	struct net_if *iface;
+	size_t cursor;
+};
+
+struct net_pkt *net_pkt_alloc_with_buffer(struct net_if *iface, size_t size, sa_family_t family,
+	int proto, k_timeout_t timeout);
+void net_pkt_unref(struct net_pkt *pkt);
+int net_pkt_write(struct net_pkt *pkt, const void *data, size_t length);
+int net_pkt_read(struct net_pkt *pkt, void *data, size_t length);
+void net_pkt_cursor_init(struct net_pkt *pkt);
+size_t net_pkt_get_len(struct net_pkt *pkt);
+
+#endif /* HOST_ZEPHYR_NET_NET_PKT_H_ */
@@ -0,0 +1,75 @@
+/*
+ * Copyright (c) 2024 Chunghan Yi <chunghan.yi@gmail.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <string.h>
+
+#include "handshake.h"
+#include "host_test.h"
+#include "wireguard-platform.h"
+
+bool host_handshake_pair_init(struct host_handshake_pair *pair)
+{
+	uint8_t initiator_key[WIREGUARD_PRIVATE_KEY_LEN];
+	uint8_t responder_key[WIREGUARD_PRIVATE_KEY_LEN];
+
+	memset(pair, 0, sizeof(*pair));
+	wireguard_random_bytes(initiator_key, sizeof(initiator_key));
+	wireguard_random_bytes(responder_key, sizeof(responder_key));
+
+	wireguard_init();
+	if (!wireguard_device_init(&pair->initiator, initiator_key) ||
+		!wireguard_device_init(&pair->responder, responder_key)) {
+		return false;
+	}
+	pair->initiator_peer = peer_alloc(&pair->initiator);
+	pair->responder_peer = peer_alloc(&pair->responder);
+	return pair->initiator_peer && pair->responder_peer &&
+		wireguard_peer_init(&pair->initiator, pair->initiator_peer, pair->responder.public_key, NULL) &&
+		wireguard_peer_init(&pair->responder, pair->responder_peer, pair->initiator.public_key, NULL);
+}
+
+bool host_handshake_run(struct host_handshake_pair *pair)
+{
+	struct message_handshake_initiation initiation;
+	struct message_handshake_response response;
+	struct wireguard_peer *peer;
+
+	// Initiations from one peer are rate limited, make it look like time has passed
+	host_advance_time(1000);
+
+	if (!wireguard_create_handshake_initiation(&pair->initiator, pair->initiator_peer, &initiation) ||
+		!wireguard_check_mac1(&pair->responder, (const uint8_t *)&initiation,
+			sizeof(initiation) - (2 * WIREGUARD_COOKIE_LEN), initiation.mac1)) {
+		return false;
+	}
+	peer = wireguard_process_initiation_message(&pair->responder, &initiation);
+	if ((peer != pair->responder_peer) ||
+		!wireguard_create_handshake_response(&pair->responder, peer, &response)) {
+		return false;
+	}
+	wireguard_start_session(&pair->responder, peer, false);
+
+	peer = peer_lookup_by_handshake(&pair->initiator, response.receiver);
+	if ((peer != pair->initiator_peer) ||
+		!wireguard_check_mac1(&pair->initiator, (const uint8_t *)&response,
+			sizeof(response) - (2 * WIREGUARD_COOKIE_LEN), response.mac1) ||
+		!wireguard_process_handshake_response(&pair->initiator, peer, &response)) {
+		return false;
+	}
+	wireguard_start_session(&pair->initiator, peer, true);
+	return true;
+}
+
+bool host_handshake_keys_match(struct host_handshake_pair *pair)
+{
+	const struct wireguard_keypair *sent = &pair->initiator_peer->curr_keypair;
+	const struct wireguard_keypair *received = &pair->responder_peer->next_keypair;
+
+	return sent->valid && received->valid &&
+		(sent->remote_index == received->local_index) &&
+		(memcmp(sent->sending_key, received->receiving_key, WIREGUARD_SESSION_KEY_LEN) == 0) &&
+		(memcmp(sent->receiving_key, received->sending_key, WIREGUARD_SESSION_KEY_LEN) == 0);
+}
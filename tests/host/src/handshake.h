@@ -0,0 +1,36 @@
+/*
+ * Copyright (c) 2024 Chunghan Yi <chunghan.yi@gmail.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*
+ * Two protocol core devices that know each other as peers, for tests that
+ * run handshakes without the network interface. A handshake here is what
+ * both ends compute for one session: initiation, mac1 check, response,
+ * mac1 check and both session key derivations.
+ */
+
+#ifndef HOST_HANDSHAKE_H_
+#define HOST_HANDSHAKE_H_
+
+#include <stdbool.h>
+
+#include "wireguard.h"
+
+struct host_handshake_pair {
+	struct wireguard_device initiator;
+	struct wireguard_device responder;
+	struct wireguard_peer *initiator_peer;
+	struct wireguard_peer *responder_peer;
+};
+
+bool host_handshake_pair_init(struct host_handshake_pair *pair);
+
+// Run one complete handshake, returns false if any step failed
+bool host_handshake_run(struct host_handshake_pair *pair);
+
+// The session keys the last handshake gave both ends match
+bool host_handshake_keys_match(struct host_handshake_pair *pair);
+
+#endif /* HOST_HANDSHAKE_H_ */
@@ -0,0 +1,125 @@
+/*
+ * Copyright (c) 2024 Chunghan Yi <chunghan.yi@gmail.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*
+ * Helpers shared by the host tests and benchmarks. Every program is a plain
+ * executable that returns non-zero when a check failed, so that ctest picks
+ * it up without a test framework. Benchmarks run a short pass by default and
+ * the full one when given --full.
+ */
+
+#ifndef HOST_TEST_H_
+#define HOST_TEST_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+extern bool host_under_load;
+
+/* Move wireguard_sys_now() forward, to expire timers without sleeping */
+void host_advance_time(uint32_t millis);
+
+static int host_failures;
+
+#define CHECK(cond)									\
+	do {										\
+		if (!(cond)) {								\
+			fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond);	\
+			host_failures++;						\
+		}									\
+	} while (0)
+
+#define CHECK_MEM(a, b, len)								\
+	do {										\
+		if (memcmp((a), (b), (len)) != 0) {					\
+			fprintf(stderr, "%s:%d: %s differs from %s\n", __FILE__, __LINE__, #a, #b);	\
+			host_failures++;						\
+		}									\
+	} while (0)
+
+static inline int host_test_result(const char *name)
+{
+	if (host_failures) {
+		printf("%s: %d check(s) failed\n", name, host_failures);
+		return 1;
+	}
+	printf("%s: ok\n", name);
+	return 0;
+}
+
+static inline bool host_full_run(int argc, char **argv)
+{
+	return (argc > 1) && (strcmp(argv[1], "--full") == 0);
+}
+
+static inline uint64_t host_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/* Cycle counter where the host has one, nanoseconds otherwise */
+static inline uint64_t host_cycles(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	return __builtin_ia32_rdtsc();
+#else
+	return host_now_ns();
+#endif
+}
+
+/* Cost of one call of fn(arg), measured by calling it for about budget_ns */
+struct host_bench_result {
+	double ns;
+	double cycles;
+};
+
+static inline struct host_bench_result host_bench(void (*fn)(void *arg), void *arg, uint64_t budget_ns)
+{
+	struct host_bench_result result;
+	uint64_t runs = 0;
+	uint64_t ns0 = host_now_ns();
+	uint64_t cycles0 = host_cycles();
+	uint64_t ns;
+
+	do {
+		fn(arg);
+		runs++;
+		ns = host_now_ns() - ns0;
+	} while (ns < budget_ns);
+	result.cycles = (double)(host_cycles() - cycles0) / (double)runs;
+	result.ns = (double)ns / (double)runs;
+	return result;
+}
+
+/* Decode a hex string into out, returns the number of bytes written */
+static inline size_t host_hex(uint8_t *out, const char *hex)
+{
+	size_t len = 0;
+	unsigned int byte;
+
+	while (hex[0] && hex[1]) {
+		if (sscanf(hex, "%2x", &byte) != 1) {
+			break;
+		}
+		out[len++] = (uint8_t)byte;
+		hex += 2;
+	}
+	return len;
+}
+
+/* Keep the compiler from optimising a benchmarked result away */
+static inline void host_consume(const void *p)
+{
+	__asm__ volatile("" : : "r"(p) : "memory");
+}
+
+#endif /* HOST_TEST_H_ */
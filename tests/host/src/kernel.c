@@ -0,0 +1,217 @@
+/*
+ * Copyright (c) 2024 Chunghan Yi <chunghan.yi@gmail.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/* Single threaded stand-ins for the Zephyr kernel objects declared in include/zephyr/kernel.h */
+
+#include <zephyr/kernel.h>
+#include <time.h>
+
+#include "host_test.h"
+
+#define HOST_MAX_DELAYED 64
+
+bool host_under_load;
+
+static bool in_isr;
+static struct k_work_delayable *delayed[HOST_MAX_DELAYED];
+
+bool k_is_in_isr(void)
+{
+	return in_isr;
+}
+
+void k_host_set_isr(bool isr)
+{
+	in_isr = isr;
+}
+
+uint32_t k_cycle_get_32(void)
+{
+	return (uint32_t)(host_now_ns() / 1000);
+}
+
+uint32_t k_cyc_to_us_floor32(uint32_t cycles)
+{
+	return cycles;
+}
+
+int64_t k_uptime_get(void)
+{
+	return (int64_t)(host_now_ns() / 1000000);
+}
+
+int32_t k_sleep(k_timeout_t timeout)
+{
+	struct timespec ts = { timeout.ms / 1000, (timeout.ms % 1000) * 1000000 };
+
+	if (timeout.ms > 0) {
+		nanosleep(&ts, NULL);
+	}
+	return 0;
+}
+
+int k_mem_slab_alloc(struct k_mem_slab *slab, void **mem, k_timeout_t timeout)
+{
+	ARG_UNUSED(timeout);
+
+	if (slab->free_list) {
+		*mem = slab->free_list;
+		slab->free_list = *(void **)slab->free_list;
+	} else if (slab->num_carved < slab->num_blocks) {
+		*mem = slab->buffer + (slab->num_carved++ * slab->block_size);
+	} else {
+		*mem = NULL;
+		return -12; /* -ENOMEM */
+	}
+	slab->num_used++;
+	return 0;
+}
+
+void k_mem_slab_free(struct k_mem_slab *slab, void *mem)
+{
+	*(void **)mem = slab->free_list;
+	slab->free_list = mem;
+	slab->num_used--;
+}
+
+uint32_t k_mem_slab_num_used_get(struct k_mem_slab *slab)
+{
+	return slab->num_used;
+}
+
+void k_work_init(struct k_work *work, k_work_handler_t handler)
+{
+	work->handler = handler;
+}
+
+int k_work_submit(struct k_work *work)
+{
+	work->handler(work);
+	return 1;
+}
+
+int k_work_submit_to_queue(struct k_work_q *queue, struct k_work *work)
+{
+	ARG_UNUSED(queue);
+	return k_work_submit(work);
+}
+
+int k_work_cancel(struct k_work *work)
+{
+	ARG_UNUSED(work);
+	return 0;
+}
+
+void k_work_queue_start(struct k_work_q *queue, void *stack, size_t size, int prio, const void *cfg)
+{
+	ARG_UNUSED(queue);
+	ARG_UNUSED(stack);
+	ARG_UNUSED(size);
+	ARG_UNUSED(prio);
+	ARG_UNUSED(cfg);
+}
+
+void k_work_init_delayable(struct k_work_delayable *dwork, k_work_handler_t handler)
+{
+	dwork->work.handler = handler;
+	dwork->pending = false;
+}
+
+int k_work_schedule(struct k_work_delayable *dwork, k_timeout_t delay)
+{
+	size_t x;
+
+	ARG_UNUSED(delay);
+	if (dwork->pending) {
+		return 0;
+	}
+	for (x = 0; x < ARRAY_SIZE(delayed); x++) {
+		if (!delayed[x]) {
+			delayed[x] = dwork;
+			dwork->pending = true;
+			return 1;
+		}
+	}
+	return -12; /* -ENOMEM */
+}
+
+int k_work_reschedule(struct k_work_delayable *dwork, k_timeout_t delay)
+{
+	return k_work_schedule(dwork, delay);
+}
+
+int k_work_cancel_delayable(struct k_work_delayable *dwork)
+{
+	size_t x;
+
+	for (x = 0; x < ARRAY_SIZE(delayed); x++) {
+		if (delayed[x] == dwork) {
+			delayed[x] = NULL;
+		}
+	}
+	dwork->pending = false;
+	return 0;
+}
+
+struct k_work_delayable *k_work_delayable_from_work(struct k_work *work)
+{
+	return CONTAINER_OF(work, struct k_work_delayable, work);
+}
+
+int k_host_run_delayed(void)
+{
+	struct k_work_delayable *dwork;
+	int ran = 0;
+	size_t x;
+
+	for (x = 0; x < ARRAY_SIZE(delayed); x++) {
+		dwork = delayed[x];
+		if (dwork) {
+			delayed[x] = NULL;
+			dwork->pending = false;
+			dwork->work.handler(&dwork->work);
+			ran++;
+		}
+	}
+	return ran;
+}
+
+/* Items are queued through their first word, like the Zephyr FIFO reserves it */
+void k_fifo_init(struct k_fifo *fifo)
+{
+	fifo->head = NULL;
+	fifo->tail = NULL;
+}
+
+void k_fifo_put(struct k_fifo *fifo, void *data)
+{
+	*(void **)data = NULL;
+	if (fifo->tail) {
+		*(void **)fifo->tail = data;
+	} else {
+		fifo->head = data;
+	}
+	fifo->tail = data;
+}
+
+void *k_fifo_get(struct k_fifo *fifo, k_timeout_t timeout)
+{
+	void *data = fifo->head;
+
+	ARG_UNUSED(timeout);
+	if (data) {
+		fifo->head = *(void **)data;
+		if (!fifo->head) {
+			fifo->tail = NULL;
+		}
+	}
+	return data;
+}
+
+int k_fifo_is_empty(struct k_fifo *fifo)
+{
+	return fifo->head == NULL;
+}
@@ -0,0 +1,71 @@
+/*
+ * Copyright (c) 2024 Chunghan Yi <chunghan.yi@gmail.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/* Heap backed net_pkt stand-ins, see include/zephyr/net/net_pkt.h */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <zephyr/net/net_pkt.h>
+
+struct net_pkt *net_pkt_alloc_with_buffer(struct net_if *iface, size_t size, sa_family_t family,
+	int proto, k_timeout_t timeout)
+{
+	struct net_pkt *pkt;
+
+	ARG_UNUSED(family);
+	ARG_UNUSED(proto);
+	ARG_UNUSED(timeout);
+
+	pkt = calloc(1, sizeof(*pkt) + sizeof(struct net_buf) + size);
+	if (pkt) {
+		pkt->iface = iface;
+		pkt->buffer = (struct net_buf *)(pkt + 1);
+		pkt->buffer->data = (uint8_t *)(pkt->buffer + 1);
+		pkt->buffer->size = (uint16_t)size;
+	}
+	return pkt;
+}
+
+void net_pkt_unref(struct net_pkt *pkt)
+{
+	free(pkt);
+}
+
+int net_pkt_write(struct net_pkt *pkt, const void *data, size_t length)
+{
+	struct net_buf *buf = pkt->buffer;
+
+	if (pkt->cursor + length > buf->size) {
+		return -1;
+	}
+	memcpy(buf->data + pkt->cursor, data, length);
+	pkt->cursor += length;
+	if (pkt->cursor > buf->len) {
+		buf->len = (uint16_t)pkt->cursor;
+	}
+	return 0;
+}
+
+int net_pkt_read(struct net_pkt *pkt, void *data, size_t length)
+{
+	if (pkt->cursor + length > pkt->buffer->len) {
+		return -1;
+	}
+	memcpy(data, pkt->buffer->data + pkt->cursor, length);
+	pkt->cursor += length;
+	return 0;
+}
+
+void net_pkt_cursor_init(struct net_pkt *pkt)
+{
+	pkt->cursor = 0;
+}
+
+size_t net_pkt_get_len(struct net_pkt *pkt)
+{
+	return pkt->buffer->len;
+}
@@ -0,0 +1,68 @@
+/*
+ * Copyright (c) 2024 Chunghan Yi <chunghan.yi@gmail.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*
+ * WireGuard platform integration for the host tests: monotonic milliseconds,
+ * /dev/urandom and a TAI64N stamp that increases on every call so that
+ * back-to-back handshakes are not rejected as replays.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "wireguard-platform.h"
+#include "crypto.h"
+#include "host_test.h"
+
+static uint32_t sys_now_offset;
+
+void wireguard_random_bytes(void *bytes, size_t size)
+{
+	static FILE *urandom;
+
+	if (!urandom) {
+		urandom = fopen("/dev/urandom", "rb");
+	}
+	if (!urandom || fread(bytes, 1, size, urandom) != size) {
+		fprintf(stderr, "cannot read /dev/urandom\n");
+		abort();
+	}
+}
+
+uint32_t wireguard_sys_now()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint32_t)(ts.tv_sec * 1000 + ts.tv_nsec / 1000000) + sys_now_offset;
+}
+
+void host_advance_time(uint32_t millis)
+{
+	sys_now_offset += millis;
+}
+
+void wireguard_tai64n_now(uint8_t *output)
+{
+	static uint64_t last;
+	struct timespec ts;
+	uint64_t stamp;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	stamp = ((0x400000000000000aULL + ts.tv_sec) << 32) | (uint32_t)ts.tv_nsec;
+	if (stamp <= last) {
+		stamp = last + 1;
+	}
+	last = stamp;
+	U64TO8_BIG(output + 0, stamp >> 32);
+	U32TO8_BIG(output + 8, (uint32_t)stamp);
+}
+
+bool wireguard_is_under_load()
+{
+	return host_under_load;
+}
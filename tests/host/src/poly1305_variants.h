@@ -0,0 +1,40 @@
+/*
+ * Copyright (c) 2024 Chunghan Yi <chunghan.yi@gmail.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/* Every Poly1305 build the Kconfig options allow, see poly1305_variant() in CMakeLists.txt */
+
+#ifndef HOST_POLY1305_VARIANTS_H_
+#define HOST_POLY1305_VARIANTS_H_
+
+#include "poly1305-donna.h"
+
+#define POLY1305_VARIANT_DECLARE(name)								\
+	void poly1305_##name##_init(poly1305_context *ctx, const unsigned char key[32]);		\
+	void poly1305_##name##_update(poly1305_context *ctx, const unsigned char *m, size_t bytes);	\
+	void poly1305_##name##_finish(poly1305_context *ctx, unsigned char mac[16])
+
+POLY1305_VARIANT_DECLARE(donna32);
+POLY1305_VARIANT_DECLARE(donna64);
+POLY1305_VARIANT_DECLARE(donna32_avx2);
+POLY1305_VARIANT_DECLARE(donna64_avx2);
+
+struct poly1305_variant {
+	const char *name;
+	void (*init)(poly1305_context *ctx, const unsigned char key[32]);
+	void (*update)(poly1305_context *ctx, const unsigned char *m, size_t bytes);
+	void (*finish)(poly1305_context *ctx, unsigned char mac[16]);
+};
+
+#define POLY1305_VARIANT(name) { #name, poly1305_##name##_init, poly1305_##name##_update, poly1305_##name##_finish }
+
+static const struct poly1305_variant poly1305_variants[] = {
+	POLY1305_VARIANT(donna32),
+	POLY1305_VARIANT(donna64),
+	POLY1305_VARIANT(donna32_avx2),
+	POLY1305_VARIANT(donna64_avx2),
+};
+
+#endif /* HOST_POLY1305_VARIANTS_H_ */
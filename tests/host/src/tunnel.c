@@ -0,0 +1,199 @@
+/*
+ * Copyright (c) 2024 Chunghan Yi <chunghan.yi@gmail.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <string.h>
+
+#include <zephyr/kernel.h>
+#include <zephyr/net/net_core.h>
+#include <zephyr/net/net_pkt.h>
+
+#include "tunnel.h"
+#include "wg_timer.h"
+#include "wireguard-platform.h"
+#include "crypto.h"
+#include "wireguard_vpn.h"
+
+// Symbols wireguardif.c expects from the rest of the application
+struct netif *wg_netif;
+
+void wireguardif_tmr(struct k_timer *timer);
+
+int start_wg_timer(uint32_t period)
+{
+	ARG_UNUSED(period);
+	return 0;
+}
+
+int stop_wg_timer(void)
+{
+	return 0;
+}
+
+enum net_verdict net_ipv4_input(struct net_pkt *pkt, bool is_loopback)
+{
+	ARG_UNUSED(pkt);
+	ARG_UNUSED(is_loopback);
+	return NET_OK;
+}
+
+static struct host_tunnel *active;
+
+static void remote_receive_data(struct host_tunnel *tunnel, const uint8_t *data, size_t len)
+{
+	const struct message_transport_data *hdr = (const struct message_transport_data *)data;
+	struct wireguard_keypair *keypair;
+	uint64_t counter;
+	size_t enc_len;
+
+	if (len < sizeof(*hdr) + WIREGUARD_AUTHTAG_LEN) {
+		tunnel->rx_bad++;
+		return;
+	}
+	enc_len = len - sizeof(*hdr);
+	counter = U8TO64_LITTLE(hdr->counter);
+	keypair = get_peer_keypair_for_idx(tunnel->remote_peer, hdr->receiver);
+	if (!keypair || (counter != tunnel->rx_next_counter) ||
+		!wireguard_decrypt_packet(tunnel->rx_last, hdr->enc_packet, enc_len, counter, keypair)) {
+		tunnel->rx_bad++;
+		return;
+	}
+	if (keypair == &tunnel->remote_peer->next_keypair) {
+		// First data on a session we answered: it becomes current
+		keypair_update(&tunnel->remote, tunnel->remote_peer, keypair);
+	}
+	tunnel->rx_next_counter = counter + 1;
+	tunnel->rx_last_len = enc_len - WIREGUARD_AUTHTAG_LEN;
+	tunnel->rx_packets++;
+	tunnel->rx_bytes += tunnel->rx_last_len;
+	if (tunnel->rx_hook) {
+		tunnel->rx_hook(tunnel, tunnel->rx_last, tunnel->rx_last_len);
+	}
+}
+
+ssize_t __wrap_sendto(int fd, const void *buf, size_t len, int flags, const struct sockaddr *addr, socklen_t addr_len)
+{
+	ARG_UNUSED(fd);
+	ARG_UNUSED(flags);
+	ARG_UNUSED(addr);
+	ARG_UNUSED(addr_len);
+
+	if (!active || (len > HOST_TUNNEL_MAX_DATAGRAM)) {
+		return -1;
+	}
+	if (wireguard_get_message_type(buf, len) == MESSAGE_TRANSPORT_DATA) {
+		remote_receive_data(active, buf, len);
+	} else {
+		memcpy(active->pending, buf, len);
+		active->pending_len = len;
+	}
+	return (ssize_t)len;
+}
+
+static void local_receive(struct host_tunnel *tunnel, void *data, size_t len)
+{
+	ip_addr_t addr = IPADDR4_INIT_BYTES(127, 0, 0, 1);
+	struct pbuf p;
+
+	memset(&p, 0, sizeof(p));
+	p.payload = data;
+	p.len = (u16_t)len;
+	p.tot_len = p.len;
+	wireguardif_network_rx(tunnel->local, &p, &addr, WG_PEER_PORT);
+}
+
+bool host_tunnel_pump(struct host_tunnel *tunnel)
+{
+	struct message_handshake_initiation *initiation;
+	struct message_handshake_response response;
+	struct wireguard_peer *peer;
+
+	if (tunnel->pending_len == 0) {
+		return false;
+	}
+	if (wireguard_get_message_type(tunnel->pending, tunnel->pending_len) == MESSAGE_HANDSHAKE_INITIATION) {
+		initiation = (struct message_handshake_initiation *)tunnel->pending;
+		peer = wireguard_process_initiation_message(&tunnel->remote, initiation);
+		if (peer && wireguard_create_handshake_response(&tunnel->remote, peer, &response)) {
+			wireguard_start_session(&tunnel->remote, peer, false);
+			tunnel->rx_next_counter = 0;
+			local_receive(tunnel, &response, sizeof(response));
+		}
+	}
+	tunnel->pending_len = 0;
+	return true;
+}
+
+bool host_tunnel_init(struct host_tunnel *tunnel)
+{
+	uint8_t local_private[WIREGUARD_PRIVATE_KEY_LEN];
+	uint8_t remote_private[WIREGUARD_PRIVATE_KEY_LEN];
+	char local_private_b64[64];
+	char remote_public_b64[64];
+	size_t b64_len;
+	struct wireguardif_init_data init_data;
+	struct wireguardif_peer peer;
+
+	memset(tunnel, 0, sizeof(*tunnel));
+	active = tunnel;
+
+	wireguard_random_bytes(local_private, sizeof(local_private));
+	wireguard_random_bytes(remote_private, sizeof(remote_private));
+
+	wireguard_init();
+	if (!wireguard_device_init(&tunnel->remote, remote_private)) {
+		return false;
+	}
+
+	b64_len = sizeof(local_private_b64);
+	if (!wireguard_base64_encode(local_private, sizeof(local_private), local_private_b64, &b64_len)) {
+		return false;
+	}
+	init_data.private_key = local_private_b64;
+	init_data.listen_port = WG_CLIENT_PORT;
+	tunnel->netif.sockfd = -1;
+	tunnel->netif.state = &init_data;
+	if (wireguardif_init(&tunnel->netif) != ERR_OK) {
+		return false;
+	}
+	tunnel->local = (struct wireguard_device *)tunnel->netif.state;
+	wg_netif = &tunnel->netif;
+
+	tunnel->remote_peer = peer_alloc(&tunnel->remote);
+	if (!tunnel->remote_peer ||
+		!wireguard_peer_init(&tunnel->remote, tunnel->remote_peer, tunnel->local->public_key, NULL)) {
+		return false;
+	}
+
+	b64_len = sizeof(remote_public_b64);
+	if (!wireguard_base64_encode(tunnel->remote.public_key, WIREGUARD_PUBLIC_KEY_LEN, remote_public_b64, &b64_len)) {
+		return false;
+	}
+	wireguardif_peer_init(&peer);
+	peer.public_key = remote_public_b64;
+	peer.keep_alive = 0;
+	peer.endpoint_ip = (ip_addr_t)IPADDR4_INIT_BYTES(127, 0, 0, 1);
+	peer.allowed_ip = (ip_addr_t)HOST_TUNNEL_REMOTE_IP;
+	peer.allowed_mask = (ip_addr_t)IPADDR4_INIT_BYTES(255, 255, 255, 255);
+	if ((wireguardif_add_peer(&tunnel->netif, &peer, &tunnel->local_peer_index) != ERR_OK) ||
+		(wireguardif_connect(&tunnel->netif, tunnel->local_peer_index) != ERR_OK)) {
+		return false;
+	}
+	return true;
+}
+
+bool host_tunnel_up(struct host_tunnel *tunnel)
+{
+	if (!host_tunnel_init(tunnel)) {
+		return false;
+	}
+
+	// The periodic timer sends the initiation, the remote answers it
+	wireguardif_tmr(NULL);
+	if (!host_tunnel_pump(tunnel)) {
+		return false;
+	}
+	return peer_lookup_by_peer_index(tunnel->local, tunnel->local_peer_index)->curr_keypair.valid;
+}
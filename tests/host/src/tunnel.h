@@ -0,0 +1,61 @@
+/*
+ * Copyright (c) 2024 Chunghan Yi <chunghan.yi@gmail.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*
+ * A tunnel between the WireGuard network interface under test (wireguardif.c,
+ * the "local" side) and a bare protocol core device standing in for the
+ * remote peer. Datagrams the interface sends are caught by wrapping
+ * sendto(); transport data is decrypted and checked right away, handshake
+ * messages are answered by host_tunnel_pump().
+ */
+
+#ifndef HOST_TUNNEL_H_
+#define HOST_TUNNEL_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "wireguardif.h"
+#include "wireguard.h"
+
+#define HOST_TUNNEL_MAX_DATAGRAM	(2048)
+
+struct host_tunnel {
+	struct netif netif;
+	struct wireguard_device *local;
+	u16_t local_peer_index;
+
+	struct wireguard_device remote;
+	struct wireguard_peer *remote_peer;
+
+	// Transport data received by the remote side
+	uint64_t rx_packets;
+	uint64_t rx_bytes;
+	uint64_t rx_bad;
+	uint64_t rx_next_counter;
+	size_t rx_last_len;
+	uint8_t rx_last[HOST_TUNNEL_MAX_DATAGRAM];
+	// Called with every packet the remote side decrypts (keepalives have length 0), may be NULL
+	void (*rx_hook)(struct host_tunnel *tunnel, const uint8_t *data, size_t len);
+
+	// Handshake message waiting for host_tunnel_pump()
+	size_t pending_len;
+	uint8_t pending[HOST_TUNNEL_MAX_DATAGRAM];
+};
+
+// The address inside the tunnel that routes to the remote peer
+#define HOST_TUNNEL_REMOTE_IP	IPADDR4_INIT_BYTES(10, 0, 0, 2)
+
+// Bring up both sides and add the peers, without starting a handshake
+bool host_tunnel_init(struct host_tunnel *tunnel);
+
+// host_tunnel_init() and complete a handshake initiated by the local side
+bool host_tunnel_up(struct host_tunnel *tunnel);
+
+// Answer a handshake message the local side sent, returns false if there was none
+bool host_tunnel_pump(struct host_tunnel *tunnel);
+
+#endif /* HOST_TUNNEL_H_ */
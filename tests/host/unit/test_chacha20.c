@@ -0,0 +1,141 @@
+/*
+ * Copyright (c) 2024 Chunghan Yi <chunghan.yi@gmail.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*
+ * ChaCha20 against the RFC 7539 test vectors, with the vector backend in
+ * use. The RFC nonce is 96 bits; the vectors with a non zero first nonce
+ * word are run by writing the state words directly after chacha20_init().
+ */
+
+#include <string.h>
+
+#include <zephyr/kernel.h>
+
+#include "host_test.h"
+#include "chacha20.h"
+
+static void set_rfc_nonce(struct chacha20_ctx *ctx, uint32_t counter, const uint8_t *nonce)
+{
+	ctx->state[12] = counter;
+	ctx->state[13] = (uint32_t)nonce[0] | ((uint32_t)nonce[1] << 8) | ((uint32_t)nonce[2] << 16) | ((uint32_t)nonce[3] << 24);
+	ctx->state[14] = (uint32_t)nonce[4] | ((uint32_t)nonce[5] << 8) | ((uint32_t)nonce[6] << 16) | ((uint32_t)nonce[7] << 24);
+	ctx->state[15] = (uint32_t)nonce[8] | ((uint32_t)nonce[9] << 8) | ((uint32_t)nonce[10] << 16) | ((uint32_t)nonce[11] << 24);
+}
+
+// RFC 7539 A.1 test vector #1: all zero key and nonce, block counter 0
+static void test_zero_key(void)
+{
+	struct chacha20_ctx ctx;
+	uint8_t key[32] = { 0 };
+	uint8_t zero[64] = { 0 };
+	uint8_t expect[64];
+	uint8_t out[64];
+
+	host_hex(expect,
+		"76b8e0ada0f13d90405d6ae55386bd28bdd219b8a08ded1aa836efcc8b770dc7"
+		"da41597c5157488d7724e03fb8d84a376a43b8f41518a11cc387b669b2ee6586");
+	chacha20_init(&ctx, key, 0);
+	chacha20(&ctx, out, zero, sizeof(zero));
+	CHECK_MEM(out, expect, sizeof(expect));
+	CHECK(ctx.state[12] == 1);
+}
+
+// RFC 7539 2.3.2: the block function
+static void test_block(void)
+{
+	struct chacha20_ctx ctx;
+	uint8_t key[32];
+	uint8_t nonce[12];
+	uint8_t zero[64] = { 0 };
+	uint8_t expect[64];
+	uint8_t out[64];
+
+	host_hex(key, "000102030405060708090a0b0c0d0e0f101112131415161718191a1b1c1d1e1f");
+	host_hex(nonce, "000000090000004a00000000");
+	host_hex(expect,
+		"10f1e7e4d13b5915500fdd1fa32071c4c7d1f4c733c068030422aa9ac3d46c4e"
+		"d2826446079faa0914c2d705d98b02a2b5129cd1de164eb9cbd083e8a2503c4e");
+	chacha20_init(&ctx, key, 0);
+	set_rfc_nonce(&ctx, 1, nonce);
+	chacha20(&ctx, out, zero, sizeof(zero));
+	CHECK_MEM(out, expect, sizeof(expect));
+}
+
+// RFC 7539 2.4.2: encryption, 114 bytes over two blocks, also split at the block boundary
+static void test_encrypt(void)
+{
+	static const char plain[] = "Ladies and Gentlemen of the class of '99: If I could offer you only one tip for "
+		"the future, sunscreen would be it.";
+	struct chacha20_ctx ctx;
+	uint8_t key[32];
+	uint8_t nonce[12];
+	uint8_t expect[114];
+	uint8_t out[114];
+
+	CHECK(strlen(plain) == sizeof(expect));
+	host_hex(key, "000102030405060708090a0b0c0d0e0f101112131415161718191a1b1c1d1e1f");
+	host_hex(nonce, "000000000000004a00000000");
+	host_hex(expect,
+		"6e2e359a2568f98041ba0728dd0d6981e97e7aec1d4360c20a27afccfd9fae0b"
+		"f91b65c5524733ab8f593dabcd62b3571639d624e65152ab8f530c359f0861d8"
+		"07ca0dbf500d6a6156a38e088a22b65e52bc514d16ccf806818ce91ab7793736"
+		"5af90bbf74a35be6b40b8eedf2785e42874d");
+
+	chacha20_init(&ctx, key, 0);
+	set_rfc_nonce(&ctx, 1, nonce);
+	chacha20(&ctx, out, (const uint8_t *)plain, sizeof(out));
+	CHECK_MEM(out, expect, sizeof(expect));
+
+	chacha20_init(&ctx, key, 0);
+	set_rfc_nonce(&ctx, 1, nonce);
+	chacha20(&ctx, out, (const uint8_t *)plain, 64);
+	chacha20(&ctx, out + 64, (const uint8_t *)plain + 64, sizeof(out) - 64);
+	CHECK_MEM(out, expect, sizeof(expect));
+
+	// And back, in place
+	chacha20_init(&ctx, key, 0);
+	set_rfc_nonce(&ctx, 1, nonce);
+	chacha20(&ctx, out, out, sizeof(out));
+	CHECK_MEM(out, plain, sizeof(out));
+}
+
+// The WireGuard nonce is 32 zero bits followed by the 64 bit little endian counter
+static void test_wireguard_nonce(void)
+{
+	struct chacha20_ctx ctx;
+	uint8_t key[32] = { 0 };
+
+	chacha20_init(&ctx, key, 0x0807060504030201ULL);
+	CHECK(ctx.state[12] == 0);
+	CHECK(ctx.state[13] == 0);
+	CHECK(ctx.state[14] == 0x04030201);
+	CHECK(ctx.state[15] == 0x08070605);
+}
+
+// draft-arciszewski-xchacha-02 2.2.1: HChaCha20
+static void test_hchacha20(void)
+{
+	uint8_t key[32];
+	uint8_t nonce[16];
+	uint8_t expect[32];
+	uint8_t out[32];
+
+	host_hex(key, "000102030405060708090a0b0c0d0e0f101112131415161718191a1b1c1d1e1f");
+	host_hex(nonce, "000000090000004a0000000031415927");
+	host_hex(expect, "82413b4227b27bfed30e42508a877d73a0f9e4d58a74a853c12ec41326d3ecdc");
+	hchacha20(out, nonce, key);
+	CHECK_MEM(out, expect, sizeof(expect));
+}
+
+int main(void)
+{
+	test_zero_key();
+	test_block();
+	test_encrypt();
+	test_wireguard_nonce();
+	test_hchacha20();
+	return host_test_result("test_chacha20");
+}
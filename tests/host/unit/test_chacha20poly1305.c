@@ -0,0 +1,124 @@
+/*
+ * Copyright (c) 2024 Chunghan Yi <chunghan.yi@gmail.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*
+ * The single pass ChaCha20-Poly1305 (and the precomputed keystream
+ * variant) must produce exactly what the two pass _ref versions
+ * do, for every length around the 16 and 64 byte block boundaries, with and
+ * without associated data, in place and misaligned, and must reject a
+ * flipped bit anywhere in the message.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <zephyr/kernel.h>
+
+#include "host_test.h"
+#include "chacha20poly1305.h"
+
+#define MAX_TEXT	(1600)
+#define MAX_AD		(80)
+#define TAG_LEN		(16)
+
+static uint8_t key[32];
+static uint8_t plain[MAX_TEXT + 8];
+static uint8_t ad[MAX_AD];
+static uint8_t expect[MAX_TEXT + TAG_LEN];
+static uint8_t out[MAX_TEXT + TAG_LEN + 8];
+static uint8_t back[MAX_TEXT + 8];
+
+static void fill(uint8_t *p, size_t len)
+{
+	size_t x;
+
+	for (x = 0; x < len; x++) {
+		p[x] = (uint8_t)rand();
+	}
+}
+
+static void check_one(size_t len, size_t ad_len, uint64_t nonce, size_t offset)
+{
+	uint8_t keystream[(MAX_TEXT / 64 + 2) * 64];
+	uint8_t *dst = out + offset;
+	uint8_t *src = plain + offset;
+	size_t split;
+	size_t bit;
+
+	fill(src, len);
+	fill(ad, ad_len);
+	chacha20poly1305_encrypt_ref(expect, src, len, ad, ad_len, nonce, key);
+
+	// One pass encrypt
+	chacha20poly1305_encrypt(dst, src, len, ad, ad_len, nonce, key);
+	CHECK_MEM(dst, expect, len + TAG_LEN);
+
+	// Precomputed keystream
+	chacha20poly1305_keystream(keystream, (len + 63) / 64, nonce, key);
+	chacha20poly1305_encrypt_keystream(dst, src, len, ad, ad_len, keystream);
+	CHECK_MEM(dst, expect, len + TAG_LEN);
+
+	// Every decrypt accepts it
+	CHECK(chacha20poly1305_decrypt_ref(back, expect, len + TAG_LEN, ad, ad_len, nonce, key));
+	CHECK_MEM(back, src, len);
+	memset(back, 0, len);
+	CHECK(chacha20poly1305_decrypt(back, expect, len + TAG_LEN, ad, ad_len, nonce, key));
+	CHECK_MEM(back, src, len);
+	memset(back, 0, len);
+	CHECK(chacha20poly1305_decrypt_verify(back, expect, len + TAG_LEN, ad, ad_len, nonce, key));
+	CHECK_MEM(back, src, len);
+
+	// In place
+	memcpy(dst, src, len);
+	chacha20poly1305_encrypt(dst, dst, len, ad, ad_len, nonce, key);
+	CHECK_MEM(dst, expect, len + TAG_LEN);
+	CHECK(chacha20poly1305_decrypt(dst, dst, len + TAG_LEN, ad, ad_len, nonce, key));
+	CHECK_MEM(dst, src, len);
+
+	// A flipped bit: decrypt wipes the output, decrypt_verify leaves it alone
+	memcpy(dst, expect, len + TAG_LEN);
+	bit = (size_t)rand() % ((len + TAG_LEN) * 8);
+	dst[bit / 8] ^= (uint8_t)(1 << (bit % 8));
+	CHECK(!chacha20poly1305_decrypt_ref(back, dst, len + TAG_LEN, ad, ad_len, nonce, key));
+	memset(back, 0x55, len);
+	CHECK(!chacha20poly1305_decrypt_verify(back, dst, len + TAG_LEN, ad, ad_len, nonce, key));
+	for (split = 0; split < len; split++) {
+		CHECK(back[split] == 0x55);
+	}
+	CHECK(!chacha20poly1305_decrypt(back, dst, len + TAG_LEN, ad, ad_len, nonce, key));
+	for (split = 0; split < len; split++) {
+		CHECK(back[split] == 0);
+	}
+	if (ad_len > 0) {
+		ad[(size_t)rand() % ad_len] ^= 0x80;
+		CHECK(!chacha20poly1305_decrypt(back, expect, len + TAG_LEN, ad, ad_len, nonce, key));
+	}
+}
+
+int main(void)
+{
+	static const size_t ad_lens[] = { 0, 1, 15, 16, 17, 32, 63, 64, 65, MAX_AD };
+	size_t len;
+	size_t x;
+	int trial;
+
+	srand(9);
+	fill(key, sizeof(key));
+
+	// Every length up to a few blocks, each with all the interesting AD lengths
+	for (len = 0; len <= 260; len++) {
+		for (x = 0; x < ARRAY_SIZE(ad_lens); x++) {
+			check_one(len, ad_lens[x], (uint64_t)len * 31 + x, len & 3);
+		}
+	}
+	// Random lengths up to a full MTU, random counters including the top of the range
+	for (trial = 0; trial < 3000; trial++) {
+		len = (size_t)rand() % (MAX_TEXT + 1);
+		check_one(len, (size_t)rand() % (MAX_AD + 1),
+			(trial & 1) ? (uint64_t)rand() : (UINT64_MAX - (uint64_t)trial), (size_t)rand() % 8);
+	}
+	return host_test_result("test_chacha20poly1305");
+}
@@ -0,0 +1,202 @@
+/*
+ * Copyright (c) 2024 Chunghan Yi <chunghan.yi@gmail.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*
+ * Timing leak test for crypto_equal() and crypto_zero(), after dudect
+ * (Reparaz, Balasch, Verbauwhede: "Dude, is my code constant time?").
+ * Each function is timed on two classes of input picked at random per
+ * call, and Welch's t-test compares the two timing distributions. A
+ * |t| above the threshold means the time depends on the data.
+ *
+ * The classes are chosen to catch the usual leaks: for crypto_equal(),
+ * equal buffers against buffers that differ in the first byte, where an
+ * early exit would return soonest; for crypto_zero(), a buffer of zeros
+ * against random data. An early exit compare is run through the same test
+ * to show that the harness detects a leak of that size.
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <zephyr/kernel.h>
+
+#include "host_test.h"
+#include "crypto.h"
+
+// dudect treats |t| > 10 as a definite leak, well clear of what noise on a busy host reaches
+#define T_THRESHOLD	(10.0)
+#define COMPARE_LEN	(32)
+// Measurements above this many cycles were interrupted, and are dropped
+#define MAX_CYCLES	(2000)
+
+struct welch {
+	double mean[2];
+	double m2[2];
+	uint64_t n[2];
+};
+
+static void welch_add(struct welch *w, int cls, double x)
+{
+	double delta;
+
+	w->n[cls]++;
+	delta = x - w->mean[cls];
+	w->mean[cls] += delta / (double)w->n[cls];
+	w->m2[cls] += delta * (x - w->mean[cls]);
+}
+
+static double welch_t(const struct welch *w)
+{
+	double v0 = w->m2[0] / (double)(w->n[0] - 1);
+	double v1 = w->m2[1] / (double)(w->n[1] - 1);
+
+	return (w->mean[0] - w->mean[1]) / sqrt((v0 / (double)w->n[0]) + (v1 / (double)w->n[1]));
+}
+
+static inline uint64_t fenced_cycles(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	uint64_t t;
+
+	__builtin_ia32_lfence();
+	t = host_cycles();
+	__builtin_ia32_lfence();
+	return t;
+#else
+	return host_cycles();
+#endif
+}
+
+static bool early_exit_equal(const uint8_t *a, const uint8_t *b, size_t size)
+{
+	size_t x;
+
+	for (x = 0; x < size; x++) {
+		if (a[x] != b[x]) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static uint8_t a[64];
+static uint8_t b[2][64];
+
+static double t_equal(bool (*equal)(const uint8_t *a, const uint8_t *b, size_t size), uint64_t samples)
+{
+	struct welch w;
+	volatile bool result;
+	uint64_t start;
+	uint64_t cycles;
+	uint64_t x;
+	int cls;
+
+	memset(&w, 0, sizeof(w));
+	memset(a, 0xab, sizeof(a));
+	memset(b[0], 0xab, sizeof(b[0]));
+	memcpy(b[1], b[0], sizeof(b[1]));
+	b[1][0] ^= 1;
+
+	for (x = 0; x < samples; x++) {
+		cls = rand() & 1;
+		start = fenced_cycles();
+		result = equal(a, b[cls], COMPARE_LEN);
+		cycles = fenced_cycles() - start;
+		(void)result;
+		if (cycles < MAX_CYCLES) {
+			welch_add(&w, cls, (double)cycles);
+		}
+	}
+	return welch_t(&w);
+}
+
+// Inputs are prepared a batch at a time, so filling them does not run right before the measurement
+#define ZERO_BATCH	(1024)
+
+static double t_zero(uint64_t samples)
+{
+	static uint8_t buf[ZERO_BATCH][64];
+	static uint8_t classes[ZERO_BATCH];
+	struct welch w;
+	uint64_t start;
+	uint64_t cycles;
+	uint64_t x;
+	size_t i;
+	size_t j;
+
+	memset(&w, 0, sizeof(w));
+	for (x = 0; x < samples; x += ZERO_BATCH) {
+		for (i = 0; i < ZERO_BATCH; i++) {
+			classes[i] = (uint8_t)(rand() & 1);
+			for (j = 0; j < sizeof(buf[i]); j++) {
+				buf[i][j] = classes[i] ? (uint8_t)rand() : 0;
+			}
+		}
+		for (i = 0; i < ZERO_BATCH; i++) {
+			start = fenced_cycles();
+			crypto_zero(buf[i], sizeof(buf[i]));
+			cycles = fenced_cycles() - start;
+			if (cycles < MAX_CYCLES) {
+				welch_add(&w, classes[i], (double)cycles);
+			}
+		}
+	}
+	return welch_t(&w);
+}
+
+static void check_results(void)
+{
+	uint8_t x[80];
+	uint8_t y[80];
+	size_t n;
+	size_t offset;
+	size_t d;
+
+	// Every length and alignment, with the difference anywhere or nowhere
+	for (n = 0; n <= 64; n++) {
+		for (offset = 0; offset < 4; offset++) {
+			for (d = 0; d <= n; d++) {
+				for (size_t i = 0; i < sizeof(x); i++) {
+					x[i] = y[i] = (uint8_t)(i * 7);
+				}
+				if (d < n) {
+					y[offset + d] ^= 0x10;
+				}
+				CHECK(crypto_equal(x + offset, y + offset, n) == (d == n));
+			}
+		}
+	}
+
+	memset(x, 0x55, sizeof(x));
+	crypto_zero(x + 3, 50);
+	for (n = 0; n < sizeof(x); n++) {
+		CHECK(x[n] == (((n >= 3) && (n < 53)) ? 0 : 0x55));
+	}
+}
+
+int main(int argc, char **argv)
+{
+	uint64_t samples = host_full_run(argc, argv) ? 20000000 : 1000000;
+	double t;
+
+	srand(17);
+	check_results();
+
+	t = t_equal(crypto_equal, samples);
+	printf("crypto_equal, %d bytes, equal against first byte differs: t = %.2f\n", COMPARE_LEN, t);
+	CHECK(fabs(t) < T_THRESHOLD);
+
+	t = t_zero(samples);
+	printf("crypto_zero, zeros against random data: t = %.2f\n", t);
+	CHECK(fabs(t) < T_THRESHOLD);
+
+	t = t_equal(early_exit_equal, samples);
+	printf("early exit compare (leaks by design): t = %.2f\n", t);
+	CHECK(fabs(t) > T_THRESHOLD);
+
+	return host_test_result("test_constant_time");
+}
@@ -0,0 +1,179 @@
+/*
+ * Copyright (c) 2024 Chunghan Yi <chunghan.yi@gmail.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*
+ * The PSA provider (src/crypto-psa.c, on the host's mbedTLS) must be
+ * interchangeable with the builtin one: the same ciphertexts and shared
+ * secrets for the same inputs, each decrypting what the other encrypted,
+ * and the same rejections. Handshakes then run with PSA doing all the
+ * X25519 and AEAD work, and the transport data they produce is opened with
+ * the builtin code.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <zephyr/kernel.h>
+
+#include "host_test.h"
+#include "crypto.h"
+#include "handshake.h"
+
+#define MAX_TEXT	(1600)
+#define MAX_AD		(80)
+#define TAG_LEN		(16)
+
+static uint8_t key[32];
+static uint8_t nonce[24];
+static uint8_t plain[MAX_TEXT];
+static uint8_t ad[MAX_AD];
+static uint8_t expect[MAX_TEXT + TAG_LEN];
+static uint8_t out[MAX_TEXT + TAG_LEN];
+static uint8_t back[MAX_TEXT];
+
+static void fill(uint8_t *p, size_t len)
+{
+	size_t x;
+
+	for (x = 0; x < len; x++) {
+		p[x] = (uint8_t)rand();
+	}
+}
+
+static void check_aead(const struct wireguard_crypto_provider *psa, const struct wireguard_crypto_provider *builtin)
+{
+	uint64_t counter;
+	size_t len;
+	size_t ad_len;
+	size_t flip;
+	int trial;
+
+	for (trial = 0; trial < 500; trial++) {
+		len = (size_t)rand() % (MAX_TEXT + 1);
+		ad_len = (size_t)rand() % (MAX_AD + 1);
+		counter = ((uint64_t)rand() << 32) | (uint64_t)rand();
+		fill(key, sizeof(key));
+		fill(plain, len);
+		fill(ad, ad_len);
+
+		builtin->aead_encrypt(expect, plain, len, ad, ad_len, counter, key);
+		psa->aead_encrypt(out, plain, len, ad, ad_len, counter, key);
+		CHECK_MEM(out, expect, len + TAG_LEN);
+
+		// In place, as the transmit path does it
+		memcpy(out, plain, len);
+		psa->aead_encrypt(out, out, len, ad, ad_len, counter, key);
+		CHECK_MEM(out, expect, len + TAG_LEN);
+
+		CHECK(psa->aead_decrypt(back, expect, len + TAG_LEN, ad, ad_len, counter, key));
+		CHECK_MEM(back, plain, len);
+		CHECK(psa->aead_decrypt_verify(back, expect, len + TAG_LEN, ad, ad_len, counter, key));
+		CHECK_MEM(back, plain, len);
+
+		flip = (size_t)rand() % (len + TAG_LEN);
+		expect[flip] ^= (uint8_t)(1 << (rand() % 8));
+		CHECK(!psa->aead_decrypt(back, expect, len + TAG_LEN, ad, ad_len, counter, key));
+		CHECK(!psa->aead_decrypt_verify(back, expect, len + TAG_LEN, ad, ad_len, counter, key));
+		CHECK(!builtin->aead_decrypt(back, expect, len + TAG_LEN, ad, ad_len, counter, key));
+	}
+	CHECK(!psa->aead_decrypt(back, expect, TAG_LEN - 1, ad, 0, 0, key));
+}
+
+static void check_xaead(const struct wireguard_crypto_provider *psa, const struct wireguard_crypto_provider *builtin)
+{
+	size_t len;
+	int trial;
+
+	// Only cookie replies use it, with 16 bytes of text
+	for (trial = 0; trial < 200; trial++) {
+		len = (size_t)rand() % 65;
+		fill(key, sizeof(key));
+		fill(nonce, sizeof(nonce));
+		fill(plain, len);
+		fill(ad, 16);
+
+		builtin->xaead_encrypt(expect, plain, len, ad, 16, nonce, key);
+		psa->xaead_encrypt(out, plain, len, ad, 16, nonce, key);
+		CHECK_MEM(out, expect, len + TAG_LEN);
+		CHECK(psa->xaead_decrypt(back, expect, len + TAG_LEN, ad, 16, nonce, key));
+		CHECK_MEM(back, plain, len);
+
+		expect[0] ^= 1;
+		CHECK(!psa->xaead_decrypt(back, expect, len + TAG_LEN, ad, 16, nonce, key));
+	}
+}
+
+static void check_x25519(const struct wireguard_crypto_provider *psa, const struct wireguard_crypto_provider *builtin)
+{
+	uint8_t scalar[32];
+	uint8_t point[32];
+	uint8_t expected[32];
+	uint8_t shared[32];
+	int trial;
+
+	for (trial = 0; trial < 200; trial++) {
+		fill(scalar, sizeof(scalar));
+		fill(point, sizeof(point));
+		// The builtin code does not ignore the top bit of u as RFC 7748 asks, the callers never set it
+		point[31] &= 0x7f;
+		CHECK(builtin->x25519(expected, scalar, point) == 0);
+		CHECK(psa->x25519(shared, scalar, point) == 0);
+		CHECK_MEM(shared, expected, sizeof(shared));
+	}
+
+	// Both reject a point of small order (here 0), whose result is all zero
+	memset(point, 0, sizeof(point));
+	CHECK(builtin->x25519(expected, scalar, point) != 0);
+	CHECK(psa->x25519(shared, scalar, point) != 0);
+}
+
+static void check_random(const struct wireguard_crypto_provider *psa)
+{
+	static const uint8_t zero[64];
+	uint8_t bytes[64];
+
+	CHECK(psa->random_bytes(bytes, sizeof(bytes)));
+	CHECK(memcmp(bytes, zero, sizeof(bytes)) != 0);
+}
+
+static void check_handshake(const struct wireguard_crypto_provider *builtin)
+{
+	static struct host_handshake_pair pair;
+	struct wireguard_keypair *sent;
+	struct wireguard_keypair *received;
+	uint8_t packet[100 + TAG_LEN];
+	uint64_t counter;
+	int n;
+
+	CHECK(host_handshake_pair_init(&pair));
+	for (n = 0; n < 5; n++) {
+		CHECK(host_handshake_run(&pair));
+		CHECK(host_handshake_keys_match(&pair));
+	}
+
+	sent = &pair.initiator_peer->curr_keypair;
+	received = &pair.responder_peer->next_keypair;
+	fill(plain, 100);
+	counter = sent->sending_counter;
+	wireguard_encrypt_packet(packet, plain, 100, sent);
+	CHECK(builtin->aead_decrypt(back, packet, sizeof(packet), NULL, 0, counter, received->receiving_key));
+	CHECK_MEM(back, plain, 100);
+}
+
+int main(void)
+{
+	srand(16);
+	CHECK(strcmp(wireguard_crypto->name, "psa") == 0);
+	CHECK(wireguard_crypto->init());
+
+	check_aead(wireguard_crypto, &wireguard_crypto_builtin);
+	check_xaead(wireguard_crypto, &wireguard_crypto_builtin);
+	check_x25519(wireguard_crypto, &wireguard_crypto_builtin);
+	check_random(wireguard_crypto);
+	check_handshake(&wireguard_crypto_builtin);
+
+	return host_test_result("test_crypto_psa");
+}
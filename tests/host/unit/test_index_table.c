@@ -0,0 +1,227 @@
+/*
+ * Copyright (c) 2024 Chunghan Yi <chunghan.yi@gmail.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*
+ * The session index table of a device must hold exactly the indexes its
+ * peers hold - the local index of the handshake in progress and of each
+ * keypair - each entered for the peer that holds it. A hub device with
+ * CONFIG_WIREGUARD_MAX_PEERS peers, each one a separate remote device, goes
+ * through a random mix of handshakes in both directions, lost initiations,
+ * keypair rotation and destruction, and peers being removed and added back.
+ * After every step the table of every device is compared with what its
+ * peers hold, and every held index must be found by the lookups.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <zephyr/kernel.h>
+
+#include "host_test.h"
+#include "wireguard-platform.h"
+#include "wireguard.h"
+
+#define STEPS	(3000)
+
+static struct wireguard_device hub;
+static struct wireguard_device remotes[WIREGUARD_MAX_PEERS];
+
+static void add_index(uint32_t *indexes, uint16_t *owners, size_t *count, uint32_t index, uint16_t owner)
+{
+	if (index != 0) {
+		indexes[*count] = index;
+		owners[*count] = owner;
+		(*count)++;
+	}
+}
+
+static void check_table(struct wireguard_device *device)
+{
+	uint32_t indexes[WIREGUARD_MAX_PEERS * 4];
+	uint16_t owners[WIREGUARD_MAX_PEERS * 4];
+	struct wireguard_handshake *handshake;
+	struct wireguard_peer *peer;
+	size_t count = 0;
+	size_t entries = 0;
+	size_t x;
+	size_t y;
+	bool found;
+
+	for (x = 0; x < WIREGUARD_MAX_PEERS; x++) {
+		peer = &device->peers[x];
+		if (!peer->valid) {
+			continue;
+		}
+		add_index(indexes, owners, &count, peer_identity(device, peer)->handshake.local_index, (uint16_t)(x + 1));
+		add_index(indexes, owners, &count, peer->curr_keypair.local_index, (uint16_t)(x + 1));
+		add_index(indexes, owners, &count, peer->prev_keypair.local_index, (uint16_t)(x + 1));
+		add_index(indexes, owners, &count, peer->next_keypair.local_index, (uint16_t)(x + 1));
+	}
+
+	// No index is held twice
+	for (x = 0; x < count; x++) {
+		for (y = x + 1; y < count; y++) {
+			CHECK(indexes[x] != indexes[y]);
+		}
+	}
+
+	// Every entry is a held index, entered for its holder
+	for (x = 0; x < WIREGUARD_INDEX_TABLE_SIZE; x++) {
+		if (device->index_table[x].peer == 0) {
+			continue;
+		}
+		entries++;
+		found = false;
+		for (y = 0; y < count; y++) {
+			if (indexes[y] == device->index_table[x].key) {
+				CHECK(owners[y] == device->index_table[x].peer);
+				found = true;
+			}
+		}
+		CHECK(found);
+	}
+	CHECK(entries == count);
+
+	// And the lookups find every one of them
+	for (x = 0; x < WIREGUARD_MAX_PEERS; x++) {
+		peer = &device->peers[x];
+		if (!peer->valid) {
+			continue;
+		}
+		handshake = &peer_identity(device, peer)->handshake;
+		if (handshake->valid && handshake->initiator) {
+			CHECK(peer_lookup_by_handshake(device, handshake->local_index) == peer);
+		}
+		if (peer->curr_keypair.valid) {
+			CHECK(peer_lookup_by_receiver(device, peer->curr_keypair.local_index) == peer);
+		}
+		if (peer->prev_keypair.valid) {
+			CHECK(peer_lookup_by_receiver(device, peer->prev_keypair.local_index) == peer);
+		}
+		if (peer->next_keypair.valid) {
+			CHECK(peer_lookup_by_receiver(device, peer->next_keypair.local_index) == peer);
+		}
+	}
+}
+
+// Handshake from initiator to responder, where each side has exactly one peer for the other
+static bool handshake(struct wireguard_device *initiator, struct wireguard_peer *initiator_peer,
+	struct wireguard_device *responder, bool complete)
+{
+	struct message_handshake_initiation initiation;
+	struct message_handshake_response response;
+	struct wireguard_peer *peer;
+
+	// Initiations from one peer are rate limited, make it look like time has passed
+	host_advance_time(1000);
+
+	if (!wireguard_create_handshake_initiation(initiator, initiator_peer, &initiation)) {
+		return false;
+	}
+	if (!complete) {
+		// Lost on the way
+		return true;
+	}
+	peer = wireguard_process_initiation_message(responder, &initiation);
+	if (!peer || !wireguard_create_handshake_response(responder, peer, &response)) {
+		return false;
+	}
+	wireguard_start_session(responder, peer, false);
+
+	if ((peer_lookup_by_handshake(initiator, response.receiver) != initiator_peer) ||
+		!wireguard_process_handshake_response(initiator, initiator_peer, &response)) {
+		return false;
+	}
+	wireguard_start_session(initiator, initiator_peer, true);
+	return true;
+}
+
+static struct wireguard_peer *hub_peer(size_t x)
+{
+	return &hub.peers[x];
+}
+
+// The only peer of remote x, which is the hub
+static struct wireguard_peer *remote_peer(size_t x)
+{
+	return &remotes[x].peers[0];
+}
+
+static bool add_hub_peer(size_t x)
+{
+	struct wireguard_peer *peer = peer_alloc(&hub);
+
+	return (peer == hub_peer(x)) && wireguard_peer_init(&hub, peer, remotes[x].public_key, NULL);
+}
+
+static void step(void)
+{
+	size_t x = (size_t)rand() % WIREGUARD_MAX_PEERS;
+	struct wireguard_peer *peer = hub_peer(x);
+	struct wireguard_keypair *keypairs[] = { &peer->curr_keypair, &peer->prev_keypair, &peer->next_keypair };
+	struct wireguard_keypair *keypair;
+
+	switch (rand() % 6) {
+	case 0:
+		CHECK(handshake(&hub, peer, &remotes[x], true));
+		break;
+	case 1:
+		CHECK(handshake(&remotes[x], remote_peer(x), &hub, true));
+		break;
+	case 2:
+		CHECK(handshake(&hub, peer, &remotes[x], false));
+		break;
+	case 3:
+		// The first data message on the session the hub answered
+		if (peer->next_keypair.valid) {
+			keypair_update(&hub, peer, &peer->next_keypair);
+		}
+		break;
+	case 4:
+		keypair = keypairs[rand() % ARRAY_SIZE(keypairs)];
+		if (keypair->valid) {
+			keypair_destroy(&hub, keypair);
+		}
+		break;
+	default:
+		peer_free(&hub, peer);
+		CHECK(add_hub_peer(x));
+		break;
+	}
+}
+
+int main(void)
+{
+	uint8_t key[WIREGUARD_PRIVATE_KEY_LEN];
+	struct wireguard_peer *peer;
+	size_t x;
+	int s;
+
+	srand(1);
+	wireguard_init();
+	wireguard_random_bytes(key, sizeof(key));
+	CHECK(wireguard_device_init(&hub, key));
+	for (x = 0; x < WIREGUARD_MAX_PEERS; x++) {
+		wireguard_random_bytes(key, sizeof(key));
+		CHECK(wireguard_device_init(&remotes[x], key));
+		peer = peer_alloc(&remotes[x]);
+		CHECK(peer && wireguard_peer_init(&remotes[x], peer, hub.public_key, NULL));
+		CHECK(add_hub_peer(x));
+	}
+	if (host_failures) {
+		return host_test_result("test_index_table");
+	}
+
+	for (s = 0; (s < STEPS) && !host_failures; s++) {
+		step();
+		check_table(&hub);
+		check_table(&remotes[s % WIREGUARD_MAX_PEERS]);
+	}
+	if (host_failures) {
+		printf("failed at step %d\n", s);
+	}
+	return host_test_result("test_index_table");
+}
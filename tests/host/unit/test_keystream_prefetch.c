@@ -0,0 +1,244 @@
+/*
+ * Copyright (c) 2024 Chunghan Yi <chunghan.yi@gmail.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*
+ * CONFIG_WIREGUARD_KEYSTREAM_PREFETCH: a packet encrypted with prefetched
+ * keystream must be exactly what wireguard_encrypt_packet() gives for the same
+ * keypair and counter, the keystream must be wiped together with its keypair,
+ * and no keystream generated for a keypair that has since been replaced may be
+ * used, even when the new keypair got the same local index.
+ *
+ * The rekey in the middle of a prefetch is run from inside
+ * chacha20poly1305_keystream() (wrapped), which is where the prefetch work
+ * item would be preempted on a target. wireguard_random_bytes() is wrapped so
+ * that the new session can be given the index of the keypair it replaces.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <zephyr/kernel.h>
+
+#include "host_test.h"
+#include "handshake.h"
+#include "tunnel.h"
+#include "chacha20poly1305.h"
+
+#define DEPTH		CONFIG_WIREGUARD_KEYSTREAM_PREFETCH_DEPTH
+// Longest text the prefetched keystream covers, longer packets are encrypted on the spot
+#define MAX_TEXT	(CONFIG_WIREGUARD_KEYSTREAM_PREFETCH_BLOCKS * 64)
+
+void __real_chacha20poly1305_keystream(uint8_t *out, size_t blocks, uint64_t nonce, const uint8_t *key);
+void __real_wireguard_random_bytes(void *bytes, size_t size);
+
+static struct host_handshake_pair pair;
+static uint8_t plain[1500];
+static uint8_t out[1500 + WIREGUARD_AUTHTAG_LEN];
+static uint8_t expect[1500 + WIREGUARD_AUTHTAG_LEN];
+
+// Run from inside the next keystream generation, then cleared
+static void (*during_keystream)(void);
+// Returned by the next 4 byte random read, which is the next local index reserved
+static uint32_t forced_index;
+
+void __wrap_chacha20poly1305_keystream(uint8_t *out, size_t blocks, uint64_t nonce, const uint8_t *key)
+{
+	void (*fn)(void) = during_keystream;
+
+	__real_chacha20poly1305_keystream(out, blocks, nonce, key);
+	if (fn) {
+		during_keystream = NULL;
+		fn();
+	}
+}
+
+void __wrap_wireguard_random_bytes(void *bytes, size_t size)
+{
+	if (forced_index && (size == sizeof(forced_index))) {
+		memcpy(bytes, &forced_index, size);
+		forced_index = 0;
+		return;
+	}
+	__real_wireguard_random_bytes(bytes, size);
+}
+
+static struct wireguard_keypair *sending(void)
+{
+	return &pair.initiator_peer->curr_keypair;
+}
+
+// Encrypt len bytes with whatever is in the ring and compare with the plain encryption on a copy of the keypair
+static void check_encrypt(size_t len)
+{
+	struct wireguard_keypair *keypair = sending();
+	struct wireguard_keypair reference = *keypair;
+	size_t x;
+
+	for (x = 0; x < len; x++) {
+		plain[x] = (uint8_t)rand();
+	}
+	wireguard_encrypt_packet(expect, plain, len, &reference);
+	wireguard_keystream_encrypt(&pair.initiator, pair.initiator_peer, out, plain, len, keypair);
+	CHECK_MEM(out, expect, len + WIREGUARD_AUTHTAG_LEN);
+	CHECK(keypair->sending_counter == reference.sending_counter);
+	crypto_zero(&reference, sizeof(reference));
+}
+
+static void prefetch(void)
+{
+	wireguard_keystream_prefetch(&pair.initiator, pair.initiator_peer, sending());
+}
+
+static size_t held(void)
+{
+	return wireguard_keystream_held(&pair.initiator, pair.initiator_peer);
+}
+
+// The keystream rings are indexed by peer slot and shared by all devices of the process, so the responder's
+// peer is moved off the initiator's slot - otherwise its keypair changes would wipe the initiator's ring
+static bool pair_init(void)
+{
+	struct wireguard_peer *placeholder;
+	uint8_t key[WIREGUARD_PUBLIC_KEY_LEN];
+
+	if (!host_handshake_pair_init(&pair)) {
+		return false;
+	}
+	peer_free(&pair.responder, pair.responder_peer);
+	wireguard_random_bytes(key, sizeof(key));
+	placeholder = peer_alloc(&pair.responder);
+	if (!placeholder || !wireguard_peer_init(&pair.responder, placeholder, key, NULL)) {
+		return false;
+	}
+	pair.responder_peer = peer_alloc(&pair.responder);
+	return pair.responder_peer && ((pair.responder_peer - pair.responder.peers) != (pair.initiator_peer - pair.initiator.peers)) &&
+		wireguard_peer_init(&pair.responder, pair.responder_peer, pair.initiator.public_key, NULL) &&
+		host_handshake_run(&pair);
+}
+
+// Through the network interface, where every packet sent kicks a refill: all of them decrypt on the other side
+static void test_tunnel(void)
+{
+	static struct host_tunnel tunnel;
+	const ip_addr_t dst = HOST_TUNNEL_REMOTE_IP;
+	struct wireguard_peer *peer;
+	uint64_t received;
+	struct pbuf p;
+	size_t sizes[] = { 32, MAX_TEXT - 16, MAX_TEXT, 1000 };
+	int x;
+
+	CHECK(host_tunnel_up(&tunnel));
+	peer = peer_lookup_by_peer_index(tunnel.local, tunnel.local_peer_index);
+	received = tunnel.rx_packets;
+
+	memset(plain, 0, sizeof(plain));
+	plain[0] = 0x45;
+	memset(&p, 0, sizeof(p));
+	p.payload = plain;
+	for (x = 0; x < 4 * DEPTH; x++) {
+		p.len = (u16_t)sizes[x % ARRAY_SIZE(sizes)];
+		p.tot_len = p.len;
+		CHECK(wireguardif_output(&tunnel.netif, &p, &dst) == ERR_OK);
+		CHECK(wireguard_keystream_held(tunnel.local, peer) == DEPTH);
+	}
+	CHECK(tunnel.rx_packets - received == 4 * DEPTH);
+	CHECK(tunnel.rx_bad == 0);
+}
+
+// Prefetched and on-the-spot encryption give the same bytes, around the length the keystream covers
+static void test_same_ciphertext(void)
+{
+	static const size_t lengths[] = { 0, 16, MAX_TEXT - 16, MAX_TEXT, MAX_TEXT + 16, 1024 };
+	size_t x;
+
+	for (x = 0; x < ARRAY_SIZE(lengths); x++) {
+		prefetch();
+		CHECK(held() == DEPTH);
+		check_encrypt(lengths[x]);
+		// The slot that was used is wiped, whether or not the packet fit
+		CHECK(held() == DEPTH - 1);
+	}
+	// Nothing prefetched at all
+	while (held() > 0) {
+		check_encrypt(16);
+	}
+	check_encrypt(16);
+}
+
+static void test_wipe_on_destroy(void)
+{
+	prefetch();
+	CHECK(held() == DEPTH);
+	keypair_destroy(&pair.initiator, sending());
+	CHECK(held() == 0);
+	CHECK(host_handshake_run(&pair));
+}
+
+// A rekey between prefetch and send: the new keypair starts at counter 0 again but is a different keypair
+static void test_rekey(void)
+{
+	int x;
+
+	prefetch();
+	CHECK(held() == DEPTH);
+	CHECK(host_handshake_run(&pair));
+	// The old keypair is now the previous one and still held, so is its keystream
+	CHECK(held() == DEPTH);
+	for (x = 0; x < DEPTH + 1; x++) {
+		check_encrypt(16);
+	}
+	prefetch();
+	for (x = 0; x < DEPTH + 1; x++) {
+		check_encrypt(16);
+	}
+}
+
+static void destroy_and_reuse_index(void)
+{
+	uint32_t index = sending()->local_index;
+
+	keypair_destroy(&pair.initiator, sending());
+	forced_index = index;
+	CHECK(host_handshake_run(&pair));
+	CHECK(forced_index == 0);
+	CHECK(sending()->local_index == index);
+}
+
+// The keypair is replaced while the prefetch is generating its first slot, and the new one takes over the local index
+// and counters of the old one: what the prefetch generated with the old key must not be used for the new keypair
+static void test_rekey_during_prefetch(void)
+{
+	int x;
+
+	// Start from an empty ring and a keypair that has not sent yet
+	keypair_destroy(&pair.initiator, sending());
+	CHECK(host_handshake_run(&pair));
+	CHECK(held() == 0);
+	CHECK(sending()->sending_counter == 0);
+
+	during_keystream = destroy_and_reuse_index;
+	prefetch();
+	CHECK(during_keystream == NULL);
+	CHECK(held() == 0);
+	for (x = 0; x < DEPTH + 1; x++) {
+		check_encrypt(16);
+	}
+}
+
+int main(void)
+{
+	test_tunnel();
+
+	CHECK(pair_init());
+	if (host_failures) {
+		return host_test_result("test_keystream_prefetch");
+	}
+	test_same_ciphertext();
+	test_wipe_on_destroy();
+	test_rekey();
+	test_rekey_during_prefetch();
+	return host_test_result("test_keystream_prefetch");
+}
@@ -0,0 +1,162 @@
+/*
+ * Copyright (c) 2024 Chunghan Yi <chunghan.yi@gmail.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*
+ * Poly1305 with 32 and 64 bit limbs, each with and without the AVX2 Horner
+ * chains, against the RFC 7539 vectors (2.5.2 and A.3, which include the
+ * carry and reduction corner cases), then against each other on random
+ * keys and messages fed in random pieces.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <zephyr/kernel.h>
+
+#include "host_test.h"
+#include "poly1305_variants.h"
+
+static const char ietf_text[] =
+	"Any submission to the IETF intended by the Contributor for publication as all or part of an IETF "
+	"Internet-Draft or RFC and any statement made within the context of an IETF activity is considered an "
+	"\"IETF Contribution\". Such statements include oral statements in IETF sessions, as well as written and "
+	"electronic communications made at any time or place, which are addressed to";
+
+static const char jabberwocky[] =
+	"'Twas brillig, and the slithy toves\nDid gyre and gimble in the wabe:\n"
+	"All mimsy were the borogoves,\nAnd the mome raths outgrabe.";
+
+struct rfc_vector {
+	const char *name;
+	const char *key;
+	// Hex message, or text when hex is NULL
+	const char *hex;
+	const char *text;
+	const char *tag;
+};
+
+static const struct rfc_vector vectors[] = {
+	{ "2.5.2",
+	  "85d6be7857556d337f4452fe42d506a80103808afb0db2fd4abff6af4149f51b", NULL,
+	  "Cryptographic Forum Research Group", "a8061dc1305136c6c22b8baf0c0127a9" },
+	{ "A.3 #1",
+	  "0000000000000000000000000000000000000000000000000000000000000000",
+	  "00000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000",
+	  NULL, "00000000000000000000000000000000" },
+	{ "A.3 #2",
+	  "0000000000000000000000000000000036e5f6b5c5e06070f0efca96227a863e", NULL,
+	  ietf_text, "36e5f6b5c5e06070f0efca96227a863e" },
+	{ "A.3 #3",
+	  "36e5f6b5c5e06070f0efca96227a863e00000000000000000000000000000000", NULL,
+	  ietf_text, "f3477e7cd95417af89a6b8794c310cf0" },
+	{ "A.3 #4",
+	  "1c9240a5eb55d38af333888604f6b5f0473917c1402b80099dca5cbc207075c0", NULL,
+	  jabberwocky, "4541669a7eaaee61e708dc7cbcc5eb62" },
+	{ "A.3 #5",
+	  "0200000000000000000000000000000000000000000000000000000000000000",
+	  "ffffffffffffffffffffffffffffffff", NULL, "03000000000000000000000000000000" },
+	{ "A.3 #6",
+	  "02000000000000000000000000000000ffffffffffffffffffffffffffffffff",
+	  "02000000000000000000000000000000", NULL, "03000000000000000000000000000000" },
+	{ "A.3 #7",
+	  "0100000000000000000000000000000000000000000000000000000000000000",
+	  "fffffffffffffffffffffffffffffffff0ffffffffffffffffffffffffffffff11000000000000000000000000000000",
+	  NULL, "05000000000000000000000000000000" },
+	{ "A.3 #8",
+	  "0100000000000000000000000000000000000000000000000000000000000000",
+	  "fffffffffffffffffffffffffffffffffbfefefefefefefefefefefefefefefe01010101010101010101010101010101",
+	  NULL, "00000000000000000000000000000000" },
+	{ "A.3 #9",
+	  "0200000000000000000000000000000000000000000000000000000000000000",
+	  "fdffffffffffffffffffffffffffffff", NULL, "faffffffffffffffffffffffffffffff" },
+	{ "A.3 #10",
+	  "0100000000000000040000000000000000000000000000000000000000000000",
+	  "e33594d7505e43b900000000000000003394d7505e4379cd01000000000000000000000000000000000000000000000001000000000000000000000000000000",
+	  NULL, "14000000000000005500000000000000" },
+	{ "A.3 #11",
+	  "0100000000000000040000000000000000000000000000000000000000000000",
+	  "e33594d7505e43b900000000000000003394d7505e4379cd010000000000000000000000000000000000000000000000",
+	  NULL, "13000000000000000000000000000000" },
+};
+
+static void test_rfc_vectors(const struct poly1305_variant *variant)
+{
+	static uint8_t message[512];
+	poly1305_context ctx;
+	uint8_t key[32];
+	uint8_t tag[16];
+	uint8_t mac[16];
+	size_t len;
+	size_t x;
+
+	for (x = 0; x < ARRAY_SIZE(vectors); x++) {
+		host_hex(key, vectors[x].key);
+		host_hex(tag, vectors[x].tag);
+		if (vectors[x].hex) {
+			len = host_hex(message, vectors[x].hex);
+		} else {
+			len = strlen(vectors[x].text);
+			memcpy(message, vectors[x].text, len);
+		}
+		variant->init(&ctx, key);
+		variant->update(&ctx, message, len);
+		variant->finish(&ctx, mac);
+		if (memcmp(mac, tag, sizeof(tag)) != 0) {
+			fprintf(stderr, "%s: RFC 7539 %s: wrong tag\n", variant->name, vectors[x].name);
+			host_failures++;
+		}
+	}
+}
+
+static void test_against_each_other(void)
+{
+	static uint8_t message[4096];
+	uint8_t key[32];
+	uint8_t mac[ARRAY_SIZE(poly1305_variants)][16];
+	poly1305_context ctx;
+	size_t len;
+	size_t done;
+	size_t piece;
+	size_t v;
+	size_t x;
+	int trial;
+
+	for (trial = 0; trial < 3000; trial++) {
+		for (x = 0; x < sizeof(key); x++) {
+			key[x] = (trial % 7 == 0) ? 0xff : (uint8_t)rand();
+		}
+		len = (size_t)rand() % sizeof(message);
+		for (x = 0; x < len; x++) {
+			message[x] = (trial % 5 == 0) ? 0xff : (uint8_t)rand();
+		}
+		for (v = 0; v < ARRAY_SIZE(poly1305_variants); v++) {
+			srand((unsigned int)trial);
+			poly1305_variants[v].init(&ctx, key);
+			for (done = 0; done < len; done += piece) {
+				piece = (trial & 1) ? (len - done) : MIN((size_t)rand() % 700 + 1, len - done);
+				poly1305_variants[v].update(&ctx, message + done, piece);
+			}
+			poly1305_variants[v].finish(&ctx, mac[v]);
+			if ((v > 0) && memcmp(mac[v], mac[0], sizeof(mac[0])) != 0) {
+				fprintf(stderr, "%s differs from %s, %zu byte message\n",
+					poly1305_variants[v].name, poly1305_variants[0].name, len);
+				host_failures++;
+			}
+		}
+		srand((unsigned int)trial + 100000);
+	}
+}
+
+int main(void)
+{
+	size_t v;
+
+	for (v = 0; v < ARRAY_SIZE(poly1305_variants); v++) {
+		test_rfc_vectors(&poly1305_variants[v]);
+	}
+	test_against_each_other();
+	return host_test_result("test_poly1305");
+}
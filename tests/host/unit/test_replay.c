@@ -0,0 +1,243 @@
+/*
+ * Copyright (c) 2024 Chunghan Yi <chunghan.yi@gmail.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*
+ * The RFC 6479 replay window (wireguard_replay_would_accept/_commit):
+ * reordering anywhere inside the window, duplicates, jumps of more than
+ * the whole ring, the ring index wrapping around (also across the 32 bit
+ * word index boundary) and REJECT_AFTER_MESSAGES. A randomised run checks
+ * it against a reference set of seen counters.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <zephyr/kernel.h>
+
+#include "host_test.h"
+#include "wireguard.h"
+
+// Bits in the ring; only the last WIREGUARD_REPLAY_WINDOW counters are guaranteed to be remembered
+#define RING_BITS	(WIREGUARD_REPLAY_WORDS * 32)
+
+static struct wireguard_keypair keypair;
+
+// Accepted exactly once, and would_accept agrees with commit both times
+static bool accept_once(uint64_t seq)
+{
+	bool first;
+
+	if (!wireguard_replay_would_accept(&keypair, seq)) {
+		return false;
+	}
+	first = wireguard_replay_commit(&keypair, seq);
+	return first && !wireguard_replay_would_accept(&keypair, seq) && !wireguard_replay_commit(&keypair, seq);
+}
+
+static void reset(void)
+{
+	memset(&keypair, 0, sizeof(keypair));
+}
+
+static void shuffle(uint64_t *seq, size_t count)
+{
+	uint64_t tmp;
+	size_t x;
+	size_t y;
+
+	for (x = count - 1; x > 0; x--) {
+		y = (size_t)rand() % (x + 1);
+		tmp = seq[x];
+		seq[x] = seq[y];
+		seq[y] = tmp;
+	}
+}
+
+static void test_in_order(void)
+{
+	uint64_t seq;
+
+	reset();
+	// Counter 0 is the first packet of every session
+	for (seq = 0; seq < 5000; seq++) {
+		CHECK(accept_once(seq));
+	}
+	for (seq = 5000 - WIREGUARD_REPLAY_WINDOW; seq < 5000; seq++) {
+		CHECK(!wireguard_replay_commit(&keypair, seq));
+	}
+	// Older than the window
+	CHECK(!wireguard_replay_would_accept(&keypair, 0));
+	CHECK(!wireguard_replay_commit(&keypair, 5000 - RING_BITS - 1));
+}
+
+static void test_reordering(void)
+{
+	static uint64_t seq[WIREGUARD_REPLAY_WINDOW];
+	uint64_t base;
+	size_t x;
+	int round;
+
+	reset();
+	// Each block of a full window arrives in random order, after the newest of the block
+	for (round = 0, base = 0; round < 50; round++, base += WIREGUARD_REPLAY_WINDOW) {
+		for (x = 0; x < ARRAY_SIZE(seq); x++) {
+			seq[x] = base + x;
+		}
+		shuffle(seq, ARRAY_SIZE(seq) - 1);
+		CHECK(accept_once(base + WIREGUARD_REPLAY_WINDOW - 1));
+		for (x = 0; x < ARRAY_SIZE(seq) - 1; x++) {
+			CHECK(accept_once(seq[x]));
+		}
+		for (x = 0; x < ARRAY_SIZE(seq); x++) {
+			CHECK(!wireguard_replay_would_accept(&keypair, base + x));
+		}
+	}
+}
+
+static void test_jump(void)
+{
+	uint64_t jump;
+	uint64_t seq;
+	int n;
+
+	for (n = 1; n <= 5; n++) {
+		reset();
+		// Every bit of the ring set, up to the last bit of the current word
+		for (seq = 0; seq < 3 * RING_BITS + 31; seq++) {
+			CHECK(wireguard_replay_commit(&keypair, seq));
+		}
+		// Jump by more than the ring, to a counter that lands on a different word offset each time
+		jump = seq + ((uint64_t)n * RING_BITS) + (uint64_t)n * 37;
+		CHECK(accept_once(jump));
+		// The whole window behind the jump is new - no stale bit from before the jump may survive
+		for (seq = jump - WIREGUARD_REPLAY_WINDOW; seq < jump; seq++) {
+			CHECK(accept_once(seq));
+		}
+		CHECK(!wireguard_replay_would_accept(&keypair, jump - RING_BITS - 1));
+		CHECK(!wireguard_replay_would_accept(&keypair, 3 * RING_BITS - 1));
+	}
+
+	// A jump of less than the ring clears only what it slides over
+	reset();
+	for (seq = 0; seq < 100; seq++) {
+		CHECK(wireguard_replay_commit(&keypair, seq));
+	}
+	CHECK(accept_once(100 + WIREGUARD_REPLAY_WINDOW / 2));
+	for (seq = 100 + WIREGUARD_REPLAY_WINDOW / 2 - WIREGUARD_REPLAY_WINDOW; seq < 100; seq++) {
+		CHECK(!wireguard_replay_would_accept(&keypair, seq));
+	}
+	for (seq = 100; seq < 100 + WIREGUARD_REPLAY_WINDOW / 2; seq++) {
+		CHECK(accept_once(seq));
+	}
+}
+
+static void test_wraparound(void)
+{
+	static const uint64_t starts[] = {
+		0,
+		// seq / 32 crosses 2^32, where a 32 bit word index would wrap
+		(1ULL << 37) - 3 * RING_BITS,
+		(1ULL << 32) - RING_BITS,
+	};
+	uint64_t seq;
+	uint64_t top;
+	size_t s;
+
+	for (s = 0; s < ARRAY_SIZE(starts); s++) {
+		reset();
+		// Around the ring many times, in pairs swapped with the one half a window back
+		top = starts[s] + 50 * RING_BITS;
+		for (seq = starts[s]; seq < top; seq += 2) {
+			CHECK(accept_once(seq + 1));
+			if (seq >= starts[s] + WIREGUARD_REPLAY_WINDOW) {
+				CHECK(accept_once(seq - WIREGUARD_REPLAY_WINDOW / 2));
+				CHECK(!wireguard_replay_would_accept(&keypair, seq - WIREGUARD_REPLAY_WINDOW / 2 + 1));
+			}
+		}
+	}
+}
+
+static void test_reject_after_messages(void)
+{
+	uint64_t seq;
+
+	reset();
+	CHECK(!wireguard_replay_would_accept(&keypair, REJECT_AFTER_MESSAGES));
+	CHECK(!wireguard_replay_commit(&keypair, REJECT_AFTER_MESSAGES));
+	CHECK(!wireguard_replay_commit(&keypair, UINT64_MAX));
+
+	for (seq = REJECT_AFTER_MESSAGES - 100; seq < REJECT_AFTER_MESSAGES; seq++) {
+		CHECK(accept_once(seq));
+	}
+	CHECK(!wireguard_replay_would_accept(&keypair, REJECT_AFTER_MESSAGES));
+	CHECK(!wireguard_replay_commit(&keypair, REJECT_AFTER_MESSAGES));
+	CHECK(!wireguard_replay_commit(&keypair, UINT64_MAX));
+	CHECK(!wireguard_replay_commit(&keypair, REJECT_AFTER_MESSAGES - 1));
+}
+
+// Against a set of seen counters: new counters ahead or inside the window are accepted, repeats never are
+static void test_random(void)
+{
+	static uint8_t seen[1 << 22];
+	bool expect;
+	bool accepted;
+	bool any = false;
+	uint64_t highest = 0;
+	uint64_t seq;
+	int r;
+	int x;
+
+	reset();
+	for (x = 0; x < 2000000; x++) {
+		r = rand() % 100;
+		if (r < 60) {
+			seq = highest + 1 + (uint64_t)(rand() % 3);
+		} else if (r < 95) {
+			seq = (highest > RING_BITS + 100) ? highest - (uint64_t)(rand() % (RING_BITS + 100)) :
+				(uint64_t)rand() % (highest + 1);
+		} else {
+			seq = highest + (uint64_t)(rand() % (4 * RING_BITS));
+		}
+		if (seq >= sizeof(seen)) {
+			break;
+		}
+
+		accepted = wireguard_replay_would_accept(&keypair, seq);
+		CHECK(wireguard_replay_commit(&keypair, seq) == accepted);
+		CHECK(!(accepted && seen[seq]));
+		if (!any || (seq > highest)) {
+			expect = true;
+		} else if ((highest - seq) < WIREGUARD_REPLAY_WINDOW) {
+			expect = !seen[seq];
+		} else if ((highest - seq) >= RING_BITS) {
+			expect = false;
+		} else {
+			// Between the guaranteed window and the ring size depends on where in its word highest sits
+			expect = accepted;
+		}
+		CHECK(accepted == expect);
+
+		if (accepted) {
+			seen[seq] = 1;
+			if (!any || (seq > highest)) {
+				highest = seq;
+			}
+			any = true;
+		}
+	}
+}
+
+int main(void)
+{
+	srand(20);
+	test_in_order();
+	test_reordering();
+	test_jump();
+	test_wraparound();
+	test_reject_after_messages();
+	test_random();
+	return host_test_result("test_replay");
+}
@@ -0,0 +1,133 @@
+/*
+ * Copyright (c) 2024 Chunghan Yi <chunghan.yi@gmail.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*
+ * CONFIG_WIREGUARD_ROUTE_CACHE: every change to the allowed IPs - adding or
+ * removing an allowed IP, removing a peer - must drop the cached lookups, the
+ * "no peer" entries as much as the others. Each case first warms the cache
+ * (the repeated lookup is a hit), changes the allowed IPs, and then expects a
+ * miss and the route the trie gives now.
+ *
+ * Routes are told apart by what wireguardif_output() returns: ERR_OK for the
+ * tunnel's remote peer, which has a session, ERR_CONN for a second peer
+ * without one, and ERR_RTE when no peer allows the address.
+ */
+
+#include <string.h>
+
+#include <zephyr/kernel.h>
+
+#include "host_test.h"
+#include "tunnel.h"
+#include "wireguard-platform.h"
+
+static struct host_tunnel tunnel;
+static struct wireguardif_stats last;
+
+// 10.0.1.5, inside 10.0.1.0/24 - set up in main()
+static ip_addr_t dst;
+static ip_addr_t subnet;
+static ip_addr_t subnet_mask;
+static ip_addr_t host_mask;
+
+static err_t route(void)
+{
+	uint8_t packet[32];
+	struct pbuf p;
+
+	memset(packet, 0, sizeof(packet));
+	packet[0] = 0x45;
+	memset(&p, 0, sizeof(p));
+	p.payload = packet;
+	p.len = sizeof(packet);
+	p.tot_len = p.len;
+	return wireguardif_output(&tunnel.netif, &p, &dst);
+}
+
+// Lookups since the last call that hit and missed the cache
+static void cache_delta(uint32_t *hits, uint32_t *misses)
+{
+	struct wireguardif_stats now;
+
+	wireguardif_get_stats(&tunnel.netif, &now);
+	*hits = now.route_cache_hits - last.route_cache_hits;
+	*misses = now.route_cache_misses - last.route_cache_misses;
+	last = now;
+}
+
+// The route is looked up once after a change (a miss) and once more from the cache (a hit)
+static void check_route(err_t expect)
+{
+	uint32_t hits;
+	uint32_t misses;
+
+	cache_delta(&hits, &misses);
+	CHECK(route() == expect);
+	cache_delta(&hits, &misses);
+	CHECK((hits == 0) && (misses == 1));
+	CHECK(route() == expect);
+	cache_delta(&hits, &misses);
+	CHECK((hits == 1) && (misses == 0));
+}
+
+static bool add_second_peer(u16_t *peer_index)
+{
+	uint8_t public_key[WIREGUARD_PUBLIC_KEY_LEN];
+	char public_key_b64[64];
+	size_t b64_len = sizeof(public_key_b64);
+	struct wireguardif_peer peer;
+
+	wireguard_random_bytes(public_key, sizeof(public_key));
+	if (!wireguard_base64_encode(public_key, sizeof(public_key), public_key_b64, &b64_len)) {
+		return false;
+	}
+	wireguardif_peer_init(&peer);
+	peer.public_key = public_key_b64;
+	peer.allowed_ip = dst;
+	peer.allowed_mask = host_mask;
+	return wireguardif_add_peer(&tunnel.netif, &peer, peer_index) == ERR_OK;
+}
+
+int main(void)
+{
+	u16_t second;
+
+	dst = (ip_addr_t)IPADDR4_INIT_BYTES(10, 0, 1, 5);
+	subnet = (ip_addr_t)IPADDR4_INIT_BYTES(10, 0, 1, 0);
+	subnet_mask = (ip_addr_t)IPADDR4_INIT_BYTES(255, 255, 255, 0);
+	host_mask = (ip_addr_t)IPADDR4_INIT_BYTES(255, 255, 255, 255);
+
+	CHECK(host_tunnel_up(&tunnel));
+	if (host_failures) {
+		return host_test_result("test_route_cache");
+	}
+
+	// Nothing allows the address yet: the cached "no peer" must go when an allowed IP covering it is added
+	check_route(ERR_RTE);
+	CHECK(wireguardif_add_allowed_ip(&tunnel.netif, tunnel.local_peer_index, &subnet, &subnet_mask) == ERR_OK);
+	check_route(ERR_OK);
+
+	// A second peer with a more specific prefix takes the address over
+	CHECK(add_second_peer(&second));
+	check_route(ERR_CONN);
+
+	// Removing that prefix gives it back to the first peer
+	CHECK(wireguardif_remove_allowed_ip(&tunnel.netif, second, &dst, &host_mask) == ERR_OK);
+	check_route(ERR_OK);
+
+	// And so does removing the peer
+	CHECK(wireguardif_add_allowed_ip(&tunnel.netif, second, &dst, &host_mask) == ERR_OK);
+	check_route(ERR_CONN);
+	CHECK(wireguardif_remove_peer(&tunnel.netif, second) == ERR_OK);
+	check_route(ERR_OK);
+
+	// Back to no peer at all
+	CHECK(wireguardif_remove_allowed_ip(&tunnel.netif, tunnel.local_peer_index, &subnet, &subnet_mask) == ERR_OK);
+	check_route(ERR_RTE);
+
+	CHECK(tunnel.rx_bad == 0);
+	return host_test_result("test_route_cache");
+}
@@ -0,0 +1,152 @@
+/*
+ * Copyright (c) 2024 Chunghan Yi <chunghan.yi@gmail.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*
+ * CONFIG_WIREGUARD_TX_STAGING: packets sent on the tunnel before the peer has
+ * a session are held, start the handshake right away and arrive at the remote
+ * side in the order they were sent once the handshake response is in. The
+ * queue holds at most CONFIG_WIREGUARD_TX_STAGING_DEPTH packets per peer and
+ * drops the oldest ones beyond that.
+ */
+
+#include <string.h>
+
+#include <zephyr/kernel.h>
+#include <zephyr/net/net_pkt.h>
+
+#include "host_test.h"
+#include "tunnel.h"
+
+#define PACKET_SIZE	(64)
+
+static uint8_t received[64];
+static size_t received_count;
+static size_t keepalives;
+
+static void record(struct host_tunnel *tunnel, const uint8_t *data, size_t len)
+{
+	ARG_UNUSED(tunnel);
+
+	if (len == 0) {
+		keepalives++;
+	} else if (received_count < ARRAY_SIZE(received)) {
+		received[received_count++] = data[PACKET_SIZE - 1];
+	}
+}
+
+static bool start(struct host_tunnel *tunnel)
+{
+	if (!host_tunnel_init(tunnel)) {
+		return false;
+	}
+	tunnel->rx_hook = record;
+	received_count = 0;
+	keepalives = 0;
+	return true;
+}
+
+// What wg_tun.c does with a packet from the tunnel interface: send it, and stage it if there is no session yet
+static err_t send_packet(struct host_tunnel *tunnel, uint8_t seq)
+{
+	const ip_addr_t dst = HOST_TUNNEL_REMOTE_IP;
+	uint8_t packet[PACKET_SIZE];
+	struct net_pkt *pkt;
+	struct pbuf p;
+	err_t err;
+
+	memset(packet, 0, sizeof(packet));
+	packet[0] = 0x45;
+	packet[PACKET_SIZE - 1] = seq;
+	memset(&p, 0, sizeof(p));
+	p.payload = packet;
+	p.len = PACKET_SIZE;
+	p.tot_len = p.len;
+
+	err = wireguardif_output(&tunnel->netif, &p, &dst);
+	if (err != ERR_CONN) {
+		return err;
+	}
+	pkt = net_pkt_alloc_with_buffer(NULL, PACKET_SIZE, AF_INET, 0, K_NO_WAIT);
+	CHECK(pkt != NULL);
+	CHECK(net_pkt_write(pkt, packet, PACKET_SIZE) == 0);
+	err = wireguardif_stage_pkt(&tunnel->netif, pkt, &dst);
+	if (err != ERR_OK) {
+		net_pkt_unref(pkt);
+		return err;
+	}
+	return ERR_CONN;
+}
+
+// Fewer packets than the queue holds all arrive, in order, ahead of the keepalive and of later traffic
+static void test_order(struct host_tunnel *tunnel)
+{
+	const uint8_t count = CONFIG_WIREGUARD_TX_STAGING_DEPTH - 1;
+	struct wireguardif_stats before;
+	struct wireguardif_stats after;
+	uint8_t x;
+
+	CHECK(start(tunnel));
+	wireguardif_get_stats(&tunnel->netif, &before);
+
+	for (x = 0; x < count; x++) {
+		CHECK(send_packet(tunnel, x) == ERR_CONN);
+		// The first packet starts the handshake without waiting for the timer
+		CHECK(tunnel->pending_len > 0);
+	}
+	CHECK(tunnel->rx_packets == 0);
+
+	CHECK(host_tunnel_pump(tunnel));
+	CHECK(received_count == count);
+	for (x = 0; x < received_count; x++) {
+		CHECK(received[x] == x);
+	}
+	CHECK(keepalives == 1);
+
+	CHECK(send_packet(tunnel, count) == ERR_OK);
+	CHECK(received_count == (size_t)count + 1);
+	CHECK(received[count] == count);
+	CHECK(tunnel->rx_bad == 0);
+
+	wireguardif_get_stats(&tunnel->netif, &after);
+	CHECK(after.tx_staged - before.tx_staged == count);
+	CHECK(after.tx_staged_dropped == before.tx_staged_dropped);
+}
+
+// More packets than the queue holds: the oldest are dropped and the newest DEPTH arrive in order
+static void test_bound(struct host_tunnel *tunnel)
+{
+	const uint8_t extra = 3;
+	const uint8_t count = CONFIG_WIREGUARD_TX_STAGING_DEPTH + extra;
+	struct wireguardif_stats before;
+	struct wireguardif_stats after;
+	uint8_t x;
+
+	CHECK(start(tunnel));
+	wireguardif_get_stats(&tunnel->netif, &before);
+
+	for (x = 0; x < count; x++) {
+		CHECK(send_packet(tunnel, x) == ERR_CONN);
+	}
+	wireguardif_get_stats(&tunnel->netif, &after);
+	CHECK(after.tx_staged - before.tx_staged == count);
+	CHECK(after.tx_staged_dropped - before.tx_staged_dropped == extra);
+
+	CHECK(host_tunnel_pump(tunnel));
+	CHECK(received_count == CONFIG_WIREGUARD_TX_STAGING_DEPTH);
+	for (x = 0; x < received_count; x++) {
+		CHECK(received[x] == extra + x);
+	}
+	CHECK(tunnel->rx_bad == 0);
+}
+
+int main(void)
+{
+	static struct host_tunnel tunnel;
+
+	test_order(&tunnel);
+	test_bound(&tunnel);
+	return host_test_result("test_tx_staging");
+}